@@ -0,0 +1,152 @@
+/**
+	active_localization.cpp
+
+	Purpose: expected-information-gain evaluation of many candidate
+	actions in one batched pass.
+
+	Blurring commutes with a cyclic shift, so the belief after any
+	action is a shifted view of one blurred grid, and its entropy
+	terms are shifted views of one q * log(q) grid. For each action
+	and color the posterior entropy then only needs two sums over the
+	cells of that color in the shifted view: the predicted mass A_c
+	and the entropy term B_c. Both are dot products of the blurred
+	grids with the map's per-color planes, read at an offset; no
+	per-action grid is ever built.
+
+	With motion classes on the map the blur depends on where the
+	shifted beliefs land, so it no longer commutes with the shift.
+	Each action then gets its own predicted grid, shifted and blurred
+	as move() does it, and the sums are read without an offset.
+*/
+
+#include <vector>
+#include <cmath>
+#include "active_localization.h"
+#include "kernels.h"
+#include "motion_noise.h"
+
+using namespace std;
+
+/**
+    Dot product of a grid with a plane read shifted by (dy, dx):
+    sum over cells y of grid[y] * plane[y + (dy, dx)], cyclically.
+*/
+float shifted_dot(const float* grid, const float* plane, int height, int width, int dy, int dx) {
+	int shift = ((dx % width) + width) % width;
+	float total = 0.0;
+	for (int i = 0; i < height; i++) {
+		const float* row = grid + (size_t) i * width;
+		const float* p = plane + (size_t) ((((i + dy) % height) + height) % height) * width;
+		// columns [0, width - shift) meet plane columns [shift, width)
+		total += dot_kernel(row, p + shift, width - shift);
+		total += dot_kernel(row + width - shift, p, shift);
+	}
+	return total;
+}
+
+// Fills q log q of every cell of a grid and returns its sum.
+double fill_plogp(const float* predicted, float* plogp, int area) {
+	double total = 0.0;
+	for (int k = 0; k < area; k++) {
+		plogp[k] = predicted[k] > 0.0f ? predicted[k] * log(predicted[k]) : 0.0f;
+		total += plogp[k];
+	}
+	return total;
+}
+
+/**
+    Scores candidate actions.
+
+    @param beliefs - the current normalized beliefs, row-major.
+
+    @param map - the compiled map; its per-color planes are reused,
+    	   and its motion classes, if any, replace blurring.
+
+    @param actions - the candidate (dy, dx) motions.
+
+    @return - one score per action, in the order given.
+*/
+vector <ActionScore> evaluate_actions(const float* beliefs, const CompiledMap& map,
+	const vector <CandidateAction>& actions, float p_hit, float p_miss, float blurring)
+{
+	int height = map.height;
+	int width = map.width;
+	int area = height * width;
+	int colors = map.palette.size();
+
+	// without motion classes, shared by every action: the blurred belief and its q log q plane
+	bool classed = !map.motion_classes.empty();
+	vector <float> predicted (area);
+	vector <float> plogp (area);
+	vector <float> shifted (classed ? area : 0);
+	double total_plogp = 0.0;
+	if (!classed) {
+		blur_kernel(beliefs, &predicted[0], height, width, blurring);
+		normalize_kernel(&predicted[0], area);
+		total_plogp = fill_plogp(&predicted[0], &plogp[0], area);
+	}
+
+	double log_hit = log(p_hit);
+	double log_miss = log(p_miss);
+	double norm = p_hit + (colors - 1) * p_miss;
+
+	vector <ActionScore> scores;
+	for (size_t a = 0; a < actions.size(); a++) {
+		int dy = actions[a].dy;
+		int dx = actions[a].dx;
+
+		// the planes are read at the action's offset, or in place when the grid is already moved
+		int read_dy = dy, read_dx = dx;
+		if (classed) {
+			shift_kernel(beliefs, &shifted[0], height, width, dy, dx);
+			blur_classes_kernel(&shifted[0], &predicted[0], height, width,
+				&map.motion_classes[0], &map.class_blurring[0]);
+			normalize_kernel(&predicted[0], area);
+			total_plogp = fill_plogp(&predicted[0], &plogp[0], area);
+			read_dy = read_dx = 0;
+		}
+		double expected = 0.0;
+		double mass_left = 1.0;
+		double plogp_left = total_plogp;
+
+		for (int c = 0; c < colors; c++) {
+			// the last color gets whatever the others did not claim
+			double mass, term;
+			if (c < colors - 1) {
+				mass = shifted_dot(&predicted[0], map.plane(c), height, width, read_dy, read_dx);
+				term = shifted_dot(&plogp[0], map.plane(c), height, width, read_dy, read_dx);
+				mass_left -= mass;
+				plogp_left -= term;
+			}
+			else {
+				mass = mass_left;
+				term = plogp_left;
+			}
+
+			double z = p_hit * mass + p_miss * (1.0 - mass);
+			double s = p_hit * (term + mass * log_hit)
+				+ p_miss * ((total_plogp - term) + (1.0 - mass) * log_miss);
+			if (z > 0.0) {
+				expected += (z / norm) * (log(z) - s / z);
+			}
+		}
+
+		ActionScore score;
+		score.dy = dy;
+		score.dx = dx;
+		score.expected_entropy = expected;
+		score.information_gain = -total_plogp - expected;
+		scores.push_back(score);
+	}
+	return scores;
+}
+
+int best_action(const vector <ActionScore>& scores) {
+	int best = -1;
+	for (size_t a = 0; a < scores.size(); a++) {
+		if (best < 0 || scores[a].information_gain > scores[best].information_gain) {
+			best = a;
+		}
+	}
+	return best;
+}
@@ -0,0 +1,39 @@
+#ifndef ACTIVE_LOCALIZATION_H
+#define ACTIVE_LOCALIZATION_H
+
+#include <vector>
+#include "compiled_map.h"
+
+// A motion the robot could make next.
+struct CandidateAction {
+	int dy, dx;
+};
+
+// How much a candidate action is expected to disambiguate the pose.
+struct ActionScore {
+	int dy, dx;
+
+	// entropy (nats) of the posterior after moving and sensing,
+	// averaged over the colors that could be sensed
+	double expected_entropy;
+
+	// entropy after moving minus expected_entropy
+	double information_gain;
+};
+
+/**
+    Scores candidate actions by expected posterior entropy, i.e. the
+    expectation over sensed colors of the entropy after move() and
+    sense(). The sensor model is the normalized form of p_hit /
+    p_miss over the map palette. The motion model is the filter's:
+    the map's motion classes when it has any (blurring is then
+    unused, and each action costs a shift and blur of the grid),
+    else the uniform blurring.
+*/
+std::vector <ActionScore> evaluate_actions(const float* beliefs, const CompiledMap& map,
+	const std::vector <CandidateAction>& actions, float p_hit, float p_miss, float blurring);
+
+// Returns the index of the score with the largest information gain, or -1 if there are none.
+int best_action(const std::vector <ActionScore>& scores);
+
+#endif /* ACTIVE_LOCALIZATION_H */
@@ -0,0 +1,456 @@
+/**
+	async_io.cpp
+
+	Purpose: io_uring-backed asynchronous file I/O without liburing,
+	and a prefetching log reader on top of it. The ring is driven
+	directly: requests are written into the mapped submission queue
+	and io_uring_enter submits them; completions are read from the
+	mapped completion queue.
+*/
+
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include "async_io.h"
+
+#ifdef LOCALIZER_HAS_POSIX_IO
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef LOCALIZER_HAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+using namespace std;
+
+// Marks the write half of a write + fdatasync pair.
+const unsigned long long WRITE_HALF = 1ULL << 62;
+
+AsyncFileIO::AsyncFileIO(int queue_depth, bool try_uring) :
+	ring_fd(-1), depth(queue_depth), pending(0), next_request(1), registered(false),
+	sq_ring(NULL), cq_ring(NULL), sqes(NULL)
+{
+	if (try_uring) {
+		setup_uring(queue_depth);
+	}
+}
+
+AsyncFileIO::~AsyncFileIO() {
+	while (pending > 0) {
+		reap(true);
+	}
+#ifdef LOCALIZER_HAS_IO_URING
+	if (ring_fd >= 0) {
+		munmap(sqes, sqes_bytes);
+		if (cq_ring != sq_ring) {
+			munmap(cq_ring, cq_ring_bytes);
+		}
+		munmap(sq_ring, sq_ring_bytes);
+		close(ring_fd);
+	}
+#endif
+}
+
+bool AsyncFileIO::uses_uring() const {
+	return ring_fd >= 0;
+}
+
+int AsyncFileIO::in_flight() const {
+	return pending;
+}
+
+#ifdef LOCALIZER_HAS_IO_URING
+
+// Maps the rings of a new io_uring. Leaves ring_fd at -1 on any failure.
+bool AsyncFileIO::setup_uring(int queue_depth) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = syscall(__NR_io_uring_setup, queue_depth, &params);
+	if (fd < 0) {
+		return false;
+	}
+
+	sq_ring_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_ring_bytes = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single) {
+		sq_ring_bytes = cq_ring_bytes = max(sq_ring_bytes, cq_ring_bytes);
+	}
+
+	sq_ring = mmap(NULL, sq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	cq_ring = single ? sq_ring
+		: mmap(NULL, cq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	sqes_bytes = params.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = cq_ring == MAP_FAILED ? MAP_FAILED
+		: mmap(NULL, sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+		if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+			munmap(cq_ring, cq_ring_bytes);
+		}
+		munmap(sq_ring, sq_ring_bytes);
+		close(fd);
+		return false;
+	}
+
+	char* sq = (char*) sq_ring;
+	char* cq = (char*) cq_ring;
+	sq_head = (unsigned*) (sq + params.sq_off.head);
+	sq_tail = (unsigned*) (sq + params.sq_off.tail);
+	sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+	sq_array = (unsigned*) (sq + params.sq_off.array);
+	cq_head = (unsigned*) (cq + params.cq_off.head);
+	cq_tail = (unsigned*) (cq + params.cq_off.tail);
+	cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+	cqes = cq + params.cq_off.cqes;
+	depth = params.sq_entries;
+	ring_fd = fd;
+
+	// kernels before 5.6 have neither the probe nor IORING_OP_READ / WRITE
+	vector <char> probe_storage (sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op), 0);
+	struct io_uring_probe* probe = (struct io_uring_probe*) &probe_storage[0];
+	bool supported = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0
+		&& probe->last_op >= IORING_OP_WRITE
+		&& (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) != 0
+		&& (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED) != 0;
+	if (!supported) {
+		munmap(sqes, sqes_bytes);
+		if (cq_ring != sq_ring) {
+			munmap(cq_ring, cq_ring_bytes);
+		}
+		munmap(sq_ring, sq_ring_bytes);
+		close(fd);
+		ring_fd = -1;
+		return false;
+	}
+	return true;
+}
+
+bool AsyncFileIO::register_buffers(char* const* buffers, int count, size_t size) {
+	if (ring_fd < 0 || registered) {
+		return false;
+	}
+	vector <struct iovec> vectors (count);
+	for (int b = 0; b < count; b++) {
+		vectors[b].iov_base = buffers[b];
+		vectors[b].iov_len = size;
+	}
+	registered = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, &vectors[0], count) == 0;
+	return registered;
+}
+
+// Returns a cleared submission entry, reaping first if the queue is full.
+void* AsyncFileIO::next_sqe() {
+	while (pending + 2 > depth) {
+		reap(true);
+	}
+	unsigned tail = *sq_tail;
+	unsigned index = tail & *sq_mask;
+	struct io_uring_sqe* sqe = (struct io_uring_sqe*) sqes + index;
+	memset(sqe, 0, sizeof(*sqe));
+	sq_array[index] = index;
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+void AsyncFileIO::submit(int count) {
+	pending += count;
+	while (syscall(__NR_io_uring_enter, ring_fd, count, 0, 0, NULL, 0) < 0 && errno == EINTR) {
+	}
+}
+
+// Moves finished requests from the completion queue into completed.
+void AsyncFileIO::reap(bool block) {
+	if (ring_fd < 0 || pending == 0) {
+		return;
+	}
+	unsigned head = *cq_head;
+	if (block && head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+		while (syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0
+			&& errno == EINTR)
+		{
+		}
+	}
+	unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		struct io_uring_cqe* cqe = (struct io_uring_cqe*) cqes + (head & *cq_mask);
+		finish(cqe->user_data, cqe->res);
+		pending--;
+	}
+	__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+#else
+
+bool AsyncFileIO::setup_uring(int) {
+	return false;
+}
+
+bool AsyncFileIO::register_buffers(char* const*, int, size_t) {
+	return false;
+}
+
+void AsyncFileIO::reap(bool) {
+}
+
+#endif
+
+#ifdef LOCALIZER_HAS_POSIX_IO
+
+// Reads until bytes are in, the file ends or an error. Returns the bytes read or -errno.
+long pread_all(int fd, char* data, size_t bytes, off_t offset) {
+	long total = 0;
+	while ((size_t) total < bytes) {
+		ssize_t count = pread(fd, data + total, bytes - total, offset + total);
+		if (count <= 0) {
+			total = count < 0 && total == 0 ? -errno : total;
+			break;
+		}
+		total += count;
+	}
+	return total;
+}
+
+// Writes all bytes, then fdatasync when sync is set. Returns the bytes written or -errno.
+long pwrite_all(int fd, const char* data, size_t bytes, off_t offset, bool sync) {
+	long total = 0;
+	while ((size_t) total < bytes) {
+		ssize_t count = pwrite(fd, data + total, bytes - total, offset + total);
+		if (count <= 0) {
+			total = count < 0 ? -errno : total;
+			break;
+		}
+		total += count;
+	}
+	if (sync && total >= 0 && fdatasync(fd) != 0) {
+		total = -errno;
+	}
+	return total;
+}
+
+#else
+
+long pread_all(int, char*, size_t, off_t) {
+	return -ENOSYS;
+}
+
+long pwrite_all(int, const char*, size_t, off_t, bool) {
+	return -ENOSYS;
+}
+
+#endif
+
+long AsyncFileIO::read(int fd, char* data, size_t bytes, off_t offset, int buffer) {
+	long request = next_request++;
+	if (ring_fd < 0) {
+		completed[request] = pread_all(fd, data, bytes, offset);
+		return request;
+	}
+
+#ifdef LOCALIZER_HAS_IO_URING
+	struct io_uring_sqe* sqe = (struct io_uring_sqe*) next_sqe();
+	bool fixed = registered && buffer >= 0;
+	sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long long) data;
+	sqe->len = bytes;
+	sqe->off = offset;
+	sqe->buf_index = fixed ? buffer : 0;
+	sqe->user_data = request;
+	submit(1);
+#endif
+	return request;
+}
+
+long AsyncFileIO::write(int fd, const char* data, size_t bytes, off_t offset, int buffer, bool sync) {
+	long request = next_request++;
+	if (ring_fd < 0) {
+		completed[request] = pwrite_all(fd, data, bytes, offset, sync);
+		return request;
+	}
+
+#ifdef LOCALIZER_HAS_IO_URING
+	// with sync, the fdatasync is linked behind the write and completes the request
+	struct io_uring_sqe* sqe = (struct io_uring_sqe*) next_sqe();
+	bool fixed = registered && buffer >= 0;
+	sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long long) data;
+	sqe->len = bytes;
+	sqe->off = offset;
+	sqe->buf_index = fixed ? buffer : 0;
+	sqe->user_data = sync ? request | WRITE_HALF : request;
+
+	// punt to the kernel's workers: an inline buffered write would copy on this thread
+	sqe->flags = IOSQE_ASYNC;
+	if (sync) {
+		sqe->flags |= IOSQE_IO_LINK;
+		struct io_uring_sqe* flush = (struct io_uring_sqe*) next_sqe();
+		flush->opcode = IORING_OP_FSYNC;
+		flush->fd = fd;
+		flush->fsync_flags = IORING_FSYNC_DATASYNC;
+		flush->user_data = request;
+	}
+	submit(sync ? 2 : 1);
+#endif
+	return request;
+}
+
+/**
+    Records a completion. The write half of a synced write keeps its
+    byte count until the fdatasync completes; a failed write cancels
+    the fdatasync and its own error is reported.
+*/
+void AsyncFileIO::finish(unsigned long long user_data, long result) {
+	if (user_data & WRITE_HALF) {
+		partial[(long) (user_data & ~WRITE_HALF)] = result;
+		return;
+	}
+	long request = (long) user_data;
+	map <long, long>::iterator written = partial.find(request);
+	if (written != partial.end()) {
+		result = written->second < 0 ? written->second : (result < 0 ? result : written->second);
+		partial.erase(written);
+	}
+	completed[request] = result;
+}
+
+bool AsyncFileIO::done(long request, long& result) {
+	reap(false);
+	map <long, long>::iterator found = completed.find(request);
+	if (found == completed.end()) {
+		return false;
+	}
+	result = found->second;
+	completed.erase(found);
+	return true;
+}
+
+long AsyncFileIO::wait(long request) {
+	long result;
+	while (!done(request, result)) {
+		if (pending == 0) {
+			return -EINVAL;
+		}
+		reap(true);
+	}
+	return result;
+}
+
+PrefetchedLog::PrefetchedLog(string file_name, size_t chunk_bytes, int chunks, bool try_uring) :
+	stalls(0), io(2 * chunks, try_uring), fd(-1), file_bytes(0), next_offset(0),
+	chunk_bytes(chunk_bytes), storage(chunk_bytes * chunks), requests(chunks, 0), offsets(chunks, 0),
+	active(-1)
+{
+#ifndef LOCALIZER_HAS_POSIX_IO
+	stream.open(file_name.c_str(), ios::binary);
+#else
+	fd = open(file_name.c_str(), O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0) {
+		return;
+	}
+	file_bytes = info.st_size;
+
+	vector <char*> buffers (chunks);
+	for (int c = 0; c < chunks; c++) {
+		buffers[c] = &storage[c * chunk_bytes];
+	}
+	io.register_buffers(&buffers[0], chunks, chunk_bytes);
+	for (int c = 0; c < chunks; c++) {
+		submit_chunk(c);
+	}
+#endif
+}
+
+PrefetchedLog::~PrefetchedLog() {
+	for (size_t c = 0; c < requests.size(); c++) {
+		if (requests[c] != 0) {
+			io.wait(requests[c]);
+		}
+	}
+#ifdef LOCALIZER_HAS_POSIX_IO
+	if (fd >= 0) {
+		close(fd);
+	}
+#endif
+}
+
+bool PrefetchedLog::is_open() const {
+#ifdef LOCALIZER_HAS_POSIX_IO
+	return fd >= 0;
+#else
+	return stream.is_open();
+#endif
+}
+
+// Starts reading the next unread part of the file into a chunk.
+void PrefetchedLog::submit_chunk(int chunk) {
+	requests[chunk] = 0;
+	if (next_offset >= file_bytes) {
+		return;
+	}
+	offsets[chunk] = next_offset;
+	requests[chunk] = io.read(fd, &storage[chunk * chunk_bytes], chunk_bytes, next_offset, chunk);
+	next_offset += chunk_bytes;
+}
+
+/**
+    Moves on to the next chunk in file order once the current one is
+    parsed, handing the parsed one straight back to the device. A
+    read that came back short of the chunk (or failed, e.g. with
+    -EINVAL where the kernel lacks the opcode) is completed with
+    pread, so no bytes go missing from the middle of the log.
+*/
+PrefetchedLog::int_type PrefetchedLog::underflow() {
+	if (gptr() < egptr()) {
+		return traits_type::to_int_type(*gptr());
+	}
+#ifndef LOCALIZER_HAS_POSIX_IO
+	stream.read(&storage[0], chunk_bytes);
+	if (stream.gcount() <= 0) {
+		return traits_type::eof();
+	}
+	setg(&storage[0], &storage[0], &storage[0] + stream.gcount());
+	return traits_type::to_int_type(*gptr());
+#else
+	int chunks = requests.size();
+	if (active >= 0) {
+		submit_chunk(active);
+	}
+	active = (active + 1) % chunks;
+	if (fd < 0 || requests[active] == 0) {
+		return traits_type::eof();
+	}
+
+	long bytes;
+	if (!io.done(requests[active], bytes)) {
+		stalls++;
+		bytes = io.wait(requests[active]);
+	}
+	requests[active] = 0;
+	char* chunk = &storage[active * chunk_bytes];
+	long expected = (long) min((off_t) chunk_bytes, file_bytes - offsets[active]);
+	if (bytes < expected) {
+		bytes = max(bytes, 0L);
+		long rest = pread_all(fd, chunk + bytes, expected - bytes, offsets[active] + bytes);
+		bytes += max(rest, 0L);
+	}
+	if (bytes <= 0) {
+		return traits_type::eof();
+	}
+	setg(chunk, chunk, chunk + bytes);
+	return traits_type::to_int_type(*gptr());
+#endif
+}
@@ -0,0 +1,144 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include <streambuf>
+#include <fstream>
+#include <sys/types.h>
+#include <stddef.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LOCALIZER_HAS_POSIX_IO 1
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define LOCALIZER_HAS_IO_URING 1
+#endif
+#endif
+
+/**
+	Asynchronous file reads and writes for one thread. On Linux the
+	requests go to an io_uring driven through raw system calls;
+	where io_uring is missing or refused (old kernels, seccomp) each
+	request runs right away with pread / pwrite and completes at
+	once, so callers are written the same way either way. Without
+	POSIX file descriptors every request fails with -ENOSYS; the
+	classes below use streams there instead.
+
+	Buffers handed to register_buffers() are pinned by the kernel
+	once, and requests on them skip the per-request page mapping.
+*/
+class AsyncFileIO {
+public:
+	AsyncFileIO(int queue_depth = 32, bool try_uring = true);
+	~AsyncFileIO();
+
+	// True when requests go through io_uring.
+	bool uses_uring() const;
+
+	/**
+	    Registers count buffers of size bytes each; buffer index k then
+	    refers to buffers[k]. Returns false (and requests stay
+	    unregistered) on the fallback or when the kernel refuses.
+	*/
+	bool register_buffers(char* const* buffers, int count, size_t size);
+
+	/**
+	    Submits a read of bytes at offset into data, which must stay
+	    valid until the request completes. buffer is the registered
+	    buffer data lies in, or -1. Returns the request id.
+	*/
+	long read(int fd, char* data, size_t bytes, off_t offset, int buffer = -1);
+
+	// Submits a write, followed by fdatasync when sync is set.
+	long write(int fd, const char* data, size_t bytes, off_t offset, int buffer = -1, bool sync = false);
+
+	/**
+	    Returns true when a request has completed, with its result:
+	    the bytes transferred or -errno. Never blocks.
+	*/
+	bool done(long request, long& result);
+
+	// Blocks until a request completes and returns its result.
+	long wait(long request);
+
+	// Requests submitted and not yet reaped.
+	int in_flight() const;
+
+private:
+	int ring_fd;
+	int depth;
+	int pending;
+	long next_request;
+	bool registered;
+	std::map <long, long> completed;
+	std::map <long, long> partial;
+
+	// io_uring rings, mapped from the kernel
+	void* sq_ring;
+	void* cq_ring;
+	void* sqes;
+	size_t sq_ring_bytes, cq_ring_bytes, sqes_bytes;
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	void* cqes;
+
+	bool setup_uring(int queue_depth);
+	void* next_sqe();
+	void submit(int count);
+	void reap(bool block);
+	void finish(unsigned long long user_data, long result);
+
+	AsyncFileIO(const AsyncFileIO&);
+	AsyncFileIO& operator=(const AsyncFileIO&);
+};
+
+/**
+	A log file read through AsyncFileIO: chunks reads are kept in
+	flight ahead of the chunk being parsed, in registered buffers,
+	so the reader only waits when the device is slower than the
+	parser. It is a streambuf, so an istream over it can be passed
+	to the replay functions (see replay.h). Without POSIX I/O the
+	chunks are read from an ifstream when the parser reaches them.
+*/
+class PrefetchedLog : public std::streambuf {
+public:
+	PrefetchedLog(std::string file_name, size_t chunk_bytes = 1 << 20, int chunks = 4,
+		bool try_uring = true);
+	~PrefetchedLog();
+
+	bool is_open() const;
+
+	// Chunks that were not read yet when the parser reached them.
+	long stalls;
+
+protected:
+	int_type underflow();
+
+private:
+	AsyncFileIO io;
+	int fd;
+	off_t file_bytes;
+	off_t next_offset;
+	size_t chunk_bytes;
+	std::vector <char> storage;
+	std::vector <long> requests;
+	// the file offset each chunk was read from
+	std::vector <off_t> offsets;
+	int active;
+#ifndef LOCALIZER_HAS_POSIX_IO
+	std::ifstream stream;
+#endif
+
+	void submit_chunk(int chunk);
+};
+
+#endif /* ASYNC_IO_H */
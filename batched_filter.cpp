@@ -0,0 +1,206 @@
+/**
+	batched_filter.cpp
+
+	Purpose: lockstep sense / move / normalize across BATCH_LANES
+	independent filters stored lane-interleaved.
+*/
+
+#include <vector>
+#include <algorithm>
+#include "batched_filter.h"
+#include "kernels.h"
+#include "simd.h"
+
+using namespace std;
+
+// the lane loops step by whole vectors, with no scalar tail
+static_assert(BATCH_LANES % SIMD_WIDTH == 0, "BATCH_LANES must be a multiple of SIMD_WIDTH");
+
+FilterBatch::FilterBatch(int height, int width) :
+	height(height), width(width),
+	beliefs((size_t) height * width * BATCH_LANES, 1.0f / (height * width)),
+	colors((size_t) height * width * BATCH_LANES, 0),
+	scratch((size_t) height * width * BATCH_LANES)
+{
+}
+
+void FilterBatch::set_map(int lane, const vector < vector <char> >& grid) {
+	float uniform = 1.0f / (height * width);
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			size_t cell = (size_t) i * width + j;
+			colors[cell * BATCH_LANES + lane] = grid[i][j];
+			beliefs[cell * BATCH_LANES + lane] = uniform;
+		}
+	}
+}
+
+void FilterBatch::sense(const char* sensed, float p_hit, float p_miss) {
+	bool active[BATCH_LANES];
+	fill(active, active + BATCH_LANES, true);
+	sense(sensed, p_hit, p_miss, active);
+}
+
+/**
+    Senses one color per lane. The likelihood of every lane of a cell
+    is selected by comparing the lane's map color with its sensed
+    color, so all lanes are updated by the same instructions. An
+    inactive lane is weighed by 1 and not rescaled, so a robot with
+    no reading keeps its beliefs exactly, even when p_miss is 0.
+
+    @param sensed - BATCH_LANES colors, one per lane.
+
+    @param active - BATCH_LANES flags, true for lanes that sense.
+*/
+void FilterBatch::sense(const char* sensed, float p_hit, float p_miss, const bool* active) {
+	int area = height * width;
+	float totals[BATCH_LANES] = {0};
+	float hit[BATCH_LANES], miss[BATCH_LANES];
+	for (int lane = 0; lane < BATCH_LANES; lane++) {
+		hit[lane] = active[lane] ? p_hit : 1.0f;
+		miss[lane] = active[lane] ? p_miss : 1.0f;
+	}
+
+	for (int cell = 0; cell < area; cell++) {
+		float* b = &beliefs[(size_t) cell * BATCH_LANES];
+		const char* c = &colors[(size_t) cell * BATCH_LANES];
+		for (int lane = 0; lane < BATCH_LANES; lane++) {
+			b[lane] *= (c[lane] == sensed[lane]) ? hit[lane] : miss[lane];
+			totals[lane] += b[lane];
+		}
+	}
+
+	float scale[BATCH_LANES];
+	for (int lane = 0; lane < BATCH_LANES; lane++) {
+		scale[lane] = active[lane] && totals[lane] != 0.0f ? 1.0f / totals[lane] : 1.0f;
+	}
+	for (int cell = 0; cell < area; cell++) {
+		float* b = &beliefs[(size_t) cell * BATCH_LANES];
+		for (int v = 0; v < BATCH_LANES; v += SIMD_WIDTH) {
+			simd_store(simd_load(b + v) * simd_load(scale + v), b + v);
+		}
+	}
+}
+
+// Blurs beliefs into scratch, writing cell (i, j) to (i + dy, j + dx).
+void FilterBatch::blur_into(int dy, int dx, float blurring) {
+	BlurWeights w = blur_weights(blurring);
+	simd_float center(w.center);
+	simd_float adjacent(w.adjacent);
+	simd_float corner(w.corner);
+
+	for (int i = 0; i < height; i++) {
+		int u = (i - 1 + height) % height;
+		int d = (i + 1) % height;
+		int oi = (((i + dy) % height) + height) % height;
+		for (int j = 0; j < width; j++) {
+			int l = (j - 1 + width) % width;
+			int r = (j + 1) % width;
+			int oj = (((j + dx) % width) + width) % width;
+
+			const float* in = &beliefs[0];
+			float* out = &scratch[((size_t) oi * width + oj) * BATCH_LANES];
+			size_t um = (size_t) u * width, mm = (size_t) i * width, dm = (size_t) d * width;
+
+			for (int v = 0; v < BATCH_LANES; v += SIMD_WIDTH) {
+				simd_float sides = simd_load(in + (um + j) * BATCH_LANES + v)
+					+ simd_load(in + (dm + j) * BATCH_LANES + v)
+					+ simd_load(in + (mm + l) * BATCH_LANES + v)
+					+ simd_load(in + (mm + r) * BATCH_LANES + v);
+				simd_float corners = simd_load(in + (um + l) * BATCH_LANES + v)
+					+ simd_load(in + (um + r) * BATCH_LANES + v)
+					+ simd_load(in + (dm + l) * BATCH_LANES + v)
+					+ simd_load(in + (dm + r) * BATCH_LANES + v);
+				simd_store(center * simd_load(in + (mm + j) * BATCH_LANES + v)
+					+ adjacent * sides + corner * corners, out + v);
+			}
+		}
+	}
+}
+
+void FilterBatch::move(int dy, int dx, float blurring) {
+	blur_into(dy, dx, blurring);
+	beliefs.swap(scratch);
+	normalize();
+}
+
+/**
+    Moves each lane by its own offset. The blur is shared by all
+    lanes; only the final shift is done lane by lane.
+
+    @param dy - BATCH_LANES row offsets.
+
+    @param dx - BATCH_LANES column offsets.
+*/
+void FilterBatch::move(const int* dy, const int* dx, float blurring) {
+	bool active[BATCH_LANES];
+	fill(active, active + BATCH_LANES, true);
+	move(dy, dx, blurring, active);
+}
+
+/**
+    Moves only some lanes, as when filters of different robots share
+    a batch and only some of them reported a motion. The blur is still
+    computed for every lane; inactive lanes just do not take it, and
+    are not renormalized.
+
+    @param active - BATCH_LANES flags, true for lanes that move.
+*/
+void FilterBatch::move(const int* dy, const int* dx, float blurring, const bool* active) {
+	blur_into(0, 0, blurring);
+
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			float* out = &beliefs[((size_t) i * width + j) * BATCH_LANES];
+			for (int lane = 0; lane < BATCH_LANES; lane++) {
+				if (!active[lane]) {
+					continue;
+				}
+				int si = (((i - dy[lane]) % height) + height) % height;
+				int sj = (((j - dx[lane]) % width) + width) % width;
+				out[lane] = scratch[((size_t) si * width + sj) * BATCH_LANES + lane];
+			}
+		}
+	}
+	normalize(active);
+}
+
+void FilterBatch::normalize() {
+	bool active[BATCH_LANES];
+	fill(active, active + BATCH_LANES, true);
+	normalize(active);
+}
+
+// Normalizes the active lanes; the others are scaled by 1.
+void FilterBatch::normalize(const bool* active) {
+	int area = height * width;
+	float totals[BATCH_LANES] = {0};
+
+	for (int cell = 0; cell < area; cell++) {
+		const float* b = &beliefs[(size_t) cell * BATCH_LANES];
+		for (int v = 0; v < BATCH_LANES; v += SIMD_WIDTH) {
+			simd_store(simd_load(totals + v) + simd_load(b + v), totals + v);
+		}
+	}
+
+	float scale[BATCH_LANES];
+	for (int lane = 0; lane < BATCH_LANES; lane++) {
+		scale[lane] = active[lane] && totals[lane] != 0.0f ? 1.0f / totals[lane] : 1.0f;
+	}
+	for (int cell = 0; cell < area; cell++) {
+		float* b = &beliefs[(size_t) cell * BATCH_LANES];
+		for (int v = 0; v < BATCH_LANES; v += SIMD_WIDTH) {
+			simd_store(simd_load(b + v) * simd_load(scale + v), b + v);
+		}
+	}
+}
+
+vector < vector <float> > FilterBatch::lane_beliefs(int lane) const {
+	vector < vector <float> > grid (height, vector <float> (width));
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			grid[i][j] = beliefs[((size_t) i * width + j) * BATCH_LANES + lane];
+		}
+	}
+	return grid;
+}
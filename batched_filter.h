@@ -0,0 +1,59 @@
+#ifndef BATCHED_FILTER_H
+#define BATCHED_FILTER_H
+
+#include <vector>
+
+// Number of independent filters advanced together by a FilterBatch.
+const int BATCH_LANES = 16;
+
+/**
+	Runs BATCH_LANES independent histogram filters of the same
+	dimensions in lockstep. The same cell of every filter is stored
+	contiguously (one lane group per cell), so each step is a single
+	sweep over the cells doing BATCH_LANES-wide vector work, with no
+	per-filter calls. Suited to the many small maps of simulation
+	and test farms.
+*/
+class FilterBatch {
+public:
+	int height, width;
+
+	// beliefs[cell * BATCH_LANES + lane], cells row-major
+	std::vector <float> beliefs;
+
+	// colors[cell * BATCH_LANES + lane], the map of each lane
+	std::vector <char> colors;
+
+	FilterBatch(int height, int width);
+
+	// Gives a lane its map and resets its beliefs to uniform.
+	void set_map(int lane, const std::vector < std::vector <char> >& grid);
+
+	// Senses colors[lane] in every lane and normalizes.
+	void sense(const char* sensed, float p_hit, float p_miss);
+
+	// Same, but lanes whose active flag is false keep their beliefs.
+	void sense(const char* sensed, float p_hit, float p_miss, const bool* active);
+
+	// Moves every lane by the same (dy, dx) and normalizes.
+	void move(int dy, int dx, float blurring);
+
+	// Moves each lane by its own (dy[lane], dx[lane]) and normalizes.
+	void move(const int* dy, const int* dx, float blurring);
+
+	// Same, but lanes whose active flag is false keep their beliefs.
+	void move(const int* dy, const int* dx, float blurring, const bool* active);
+
+	// Normalizes every lane.
+	void normalize();
+
+	// Returns the beliefs of one lane as a grid.
+	std::vector < std::vector <float> > lane_beliefs(int lane) const;
+
+private:
+	std::vector <float> scratch;
+	void blur_into(int dy, int dx, float blurring);
+	void normalize(const bool* active);
+};
+
+#endif /* BATCHED_FILTER_H */
@@ -0,0 +1,155 @@
+/**
+	belief_snapshot.cpp
+
+	Purpose: epoch-based RCU publication of belief versions, so that
+	threads can read the latest posterior while the filter thread
+	keeps stepping, without locks and without copying the grid.
+
+	Epochs: global_epoch only grows. A reader announces the epoch it
+	saw before loading the current version; the writer retires a
+	replaced version with the epoch that follows the swap. A reader
+	that announced that epoch or later loaded the pointer after the
+	swap, so it cannot hold the retired version; a version is freed
+	once every active reader announced an epoch at least that large,
+	or has already recorded that it pinned some other version.
+*/
+
+#include <vector>
+#include <atomic>
+#include "belief_snapshot.h"
+
+using namespace std;
+
+SnapshotPublisher::SnapshotPublisher() : allocated(0), current(NULL), global_epoch(1) {
+	for (int s = 0; s < MAX_SNAPSHOT_READERS; s++) {
+		slots[s].epoch.store(0);
+		slots[s].pinned.store(NULL);
+		slots[s].claimed.store(false);
+	}
+}
+
+// Frees every version. All readers must be gone.
+SnapshotPublisher::~SnapshotPublisher() {
+	delete current.load();
+	for (size_t r = 0; r < retired.size(); r++) {
+		delete retired[r];
+	}
+	for (size_t p = 0; p < pool.size(); p++) {
+		delete pool[p];
+	}
+}
+
+void SnapshotPublisher::publish(vector <float>& cells, int height, int width) {
+	BeliefVersion* version;
+	if (!pool.empty()) {
+		version = pool.back();
+		pool.pop_back();
+	}
+	else {
+		version = new BeliefVersion();
+		allocated++;
+	}
+
+	// hand the caller's buffer to the version and take the old one back
+	version->cells.swap(cells);
+	cells.resize(version->cells.size());
+	version->height = height;
+	version->width = width;
+	version->epoch = global_epoch.load();
+
+	BeliefVersion* old = current.exchange(version);
+	uint64_t after = global_epoch.fetch_add(1) + 1;
+	if (old != NULL) {
+		retired.push_back(old);
+		retired_at.push_back(after);
+	}
+	reclaim();
+}
+
+/**
+    Moves retired versions no reader can still hold into the pool.
+    A reader inside a guard protects the one version it recorded
+    as pinned; until it has recorded one, it protects every version
+    retired after the epoch it announced.
+*/
+void SnapshotPublisher::reclaim() {
+	uint64_t epochs[MAX_SNAPSHOT_READERS];
+	const BeliefVersion* pins[MAX_SNAPSHOT_READERS];
+	for (int s = 0; s < MAX_SNAPSHOT_READERS; s++) {
+		epochs[s] = slots[s].epoch.load();
+		pins[s] = epochs[s] != 0 ? slots[s].pinned.load() : NULL;
+	}
+
+	size_t kept = 0;
+	for (size_t r = 0; r < retired.size(); r++) {
+		bool held = false;
+		for (int s = 0; s < MAX_SNAPSHOT_READERS && !held; s++) {
+			if (epochs[s] == 0) {
+				continue;
+			}
+			held = pins[s] != NULL ? pins[s] == retired[r] : epochs[s] < retired_at[r];
+		}
+
+		if (!held) {
+			pool.push_back(retired[r]);
+		}
+		else {
+			retired[kept] = retired[r];
+			retired_at[kept] = retired_at[r];
+			kept++;
+		}
+	}
+	retired.resize(kept);
+	retired_at.resize(kept);
+}
+
+const BeliefVersion* SnapshotPublisher::latest() const {
+	return current.load(memory_order_relaxed);
+}
+
+int SnapshotPublisher::retired_count() const {
+	return retired.size();
+}
+
+SnapshotReader::SnapshotReader(SnapshotPublisher& publisher) : publisher(publisher), slot(-1) {
+	for (int s = 0; s < MAX_SNAPSHOT_READERS; s++) {
+		bool expected = false;
+		if (publisher.slots[s].claimed.compare_exchange_strong(expected, true)) {
+			slot = s;
+			break;
+		}
+	}
+}
+
+SnapshotReader::~SnapshotReader() {
+	if (slot >= 0) {
+		publisher.slots[slot].pinned.store(NULL);
+		publisher.slots[slot].epoch.store(0);
+		publisher.slots[slot].claimed.store(false);
+	}
+}
+
+bool SnapshotReader::registered() const {
+	return slot >= 0;
+}
+
+SnapshotGuard::SnapshotGuard(SnapshotReader& reader) : reader(reader), pinned(NULL) {
+	if (reader.slot < 0) {
+		return;
+	}
+	SnapshotPublisher& p = reader.publisher;
+	p.slots[reader.slot].epoch.store(p.global_epoch.load());
+	pinned = p.current.load();
+	p.slots[reader.slot].pinned.store(pinned);
+}
+
+SnapshotGuard::~SnapshotGuard() {
+	if (reader.slot >= 0) {
+		reader.publisher.slots[reader.slot].pinned.store(NULL);
+		reader.publisher.slots[reader.slot].epoch.store(0);
+	}
+}
+
+const BeliefVersion* SnapshotGuard::version() const {
+	return pinned;
+}
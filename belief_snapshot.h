@@ -0,0 +1,111 @@
+#ifndef BELIEF_SNAPSHOT_H
+#define BELIEF_SNAPSHOT_H
+
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+
+// One published posterior. Never modified while readers can see it.
+struct BeliefVersion {
+	uint64_t epoch;
+	int height, width;
+	std::vector <float> cells;
+};
+
+// Most reader threads one publisher can serve at once.
+const int MAX_SNAPSHOT_READERS = 64;
+
+/**
+	Epoch-based RCU for beliefs. The filter thread publishes each new
+	posterior by swapping its buffer into a BeliefVersion (no copy);
+	reader threads pin the latest version with a SnapshotGuard, which
+	costs two atomic stores and a load and never blocks the writer.
+	A replaced version is retired and, once no reader that could have
+	seen it is still inside a guard, its buffer returns to a pool that
+	later publishes reuse. Readers also record the version they pinned,
+	so a reader that is descheduled inside a guard holds back only
+	that one version, not everything retired since its epoch.
+
+	publish() and latest() may only be called from the writer thread.
+*/
+class SnapshotPublisher {
+public:
+	SnapshotPublisher();
+	~SnapshotPublisher();
+
+	/**
+	    Publishes cells as the newest version. cells receives a recycled
+	    buffer of the same size in exchange, ready for the next step.
+	*/
+	void publish(std::vector <float>& cells, int height, int width);
+
+	// The newest version (writer side), or NULL before the first publish.
+	const BeliefVersion* latest() const;
+
+	// Versions allocated so far; stays small once buffers are recycled.
+	int allocated;
+
+	// Versions waiting for readers to move on.
+	int retired_count() const;
+
+private:
+	friend class SnapshotReader;
+	friend class SnapshotGuard;
+
+	struct ReaderSlot {
+		std::atomic <uint64_t> epoch;
+		std::atomic <const BeliefVersion*> pinned;
+		std::atomic <bool> claimed;
+		char padding[64 - sizeof(std::atomic <uint64_t>) - sizeof(std::atomic <const BeliefVersion*>)
+			- sizeof(std::atomic <bool>)];
+	};
+
+	std::atomic <BeliefVersion*> current;
+	std::atomic <uint64_t> global_epoch;
+	ReaderSlot slots[MAX_SNAPSHOT_READERS];
+
+	// writer-only bookkeeping
+	std::vector <BeliefVersion*> retired;
+	std::vector <uint64_t> retired_at;
+	std::vector <BeliefVersion*> pool;
+
+	void reclaim();
+};
+
+/**
+	A reader thread's registration with a publisher. Create one per
+	reader thread and keep it for the thread's lifetime.
+*/
+class SnapshotReader {
+public:
+	SnapshotReader(SnapshotPublisher& publisher);
+	~SnapshotReader();
+
+	// False when all MAX_SNAPSHOT_READERS slots were taken.
+	bool registered() const;
+
+private:
+	friend class SnapshotGuard;
+	SnapshotPublisher& publisher;
+	int slot;
+};
+
+/**
+	Pins the latest published version for the guard's lifetime.
+	The version (and its cells) stays valid and unchanged until the
+	guard is destroyed. Guards of one reader must not nest.
+*/
+class SnapshotGuard {
+public:
+	SnapshotGuard(SnapshotReader& reader);
+	~SnapshotGuard();
+
+	// The pinned version, or NULL if nothing was published yet.
+	const BeliefVersion* version() const;
+
+private:
+	SnapshotReader& reader;
+	const BeliefVersion* pinned;
+};
+
+#endif /* BELIEF_SNAPSHOT_H */
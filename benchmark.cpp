@@ -0,0 +1,580 @@
+/**
+	benchmark.cpp
+
+	Purpose: times the flat SIMD kernels against the scalar
+	reference functions (sense, blur, normalize) on square grids
+	of increasing size ("benchmark kernels", the default), and
+	row-major against tile-major blur across map aspect ratios
+	("benchmark layouts"), and cached against streaming stores for
+	move on an out-of-cache grid ("benchmark streaming"), and many
+	small independent filters one by one against FilterBatch
+	("benchmark batched"), and candidate actions scored one by one
+	against evaluate_actions ("benchmark actions"). "benchmark tune
+	[file]" auto-tunes the kernels for this machine and writes the
+	profile applications load at startup (see tuning.h). "benchmark
+	jitter [core ...]" reports step latency percentiles under
+	background load, normally and in real-time mode pinned to the
+	given cores (see realtime.h). "benchmark replay" replays a
+	synthetic event log sequentially and through the coroutine
+	pipeline (see replay.h). "benchmark io" times checkpoint saves
+	on the filter thread and log reads, with io_uring and with the
+	pread / pwrite fallback (see async_io.h). "benchmark edits"
+	compares full map recompiles with incremental edits.
+	"benchmark calibrate" times one EM iteration of the calibrator on
+	one thread and on every core (see calibration.h). "benchmark
+	denormals" times sense on denormal beliefs, as they are, floored
+	by the health checks and under FTZ / DAZ (see numeric_health.h).
+	"benchmark channels" compares a three-channel sense done one
+	channel at a time with the fused and joint-code kernels (see
+	map_channels.h).
+	Build once
+	per instruction set, e.g.
+
+		g++ -O2 -std=c++17 -msse2    benchmark.cpp -o bench_sse
+		g++ -O2 -std=c++17 -mavx2    benchmark.cpp -o bench_avx2
+		g++ -O2 -std=c++17 -mavx512f benchmark.cpp -o bench_avx512
+*/
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <fstream>
+#include <random>
+#include "localizer.cpp"
+
+using namespace std;
+
+// Returns the mean wall time of one call of fn in microseconds.
+template <typename Fn>
+double time_us(Fn fn, int repeats) {
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int r = 0; r < repeats; r++) {
+		fn();
+	}
+	chrono::duration<double, micro> elapsed = chrono::steady_clock::now() - start;
+	return elapsed.count() / repeats;
+}
+
+// Builds a striped red/green map.
+vector < vector <char> > striped_map(int height, int width) {
+	vector < vector <char> > map (height, vector <char> (width, 'g'));
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			if ((i + j) % 3 == 0) {
+				map[i][j] = 'r';
+			}
+		}
+	}
+	return map;
+}
+
+void print_row(const char* name, int size, double reference, double kernel) {
+	cout << name << "\t" << size << "x" << size << "\t"
+		<< reference << " us\t" << kernel << " us\t"
+		<< reference / kernel << "x" << endl;
+}
+
+void benchmark_kernels() {
+	cout << "SIMD width: " << SIMD_WIDTH << " floats" << endl;
+	cout << "step\tgrid\treference\tkernel\tspeedup" << endl;
+
+	int sizes[] = {64, 256, 1024};
+	for (int s = 0; s < 3; s++) {
+		int size = sizes[s];
+		int count = size * size;
+		int repeats = size >= 1024 ? 5 : 50;
+
+		vector < vector <char> > map = striped_map(size, size);
+		vector < vector <float> > beliefs = initialize_beliefs(map);
+		CompiledMap compiled = compile_map(map);
+		vector <float> cells = flatten(beliefs);
+		vector <float> out (count);
+		const float* plane = compiled.plane(compiled.color_index('r'));
+
+		double ref = time_us([&]() { sense('r', map, beliefs, 0.9, 0.1); }, repeats);
+		double fast = time_us([&]() {
+			sense_kernel(&cells[0], plane, &out[0], count, 0.9, 0.1);
+			normalize_kernel(&out[0], count);
+		}, repeats);
+		print_row("sense", size, ref, fast);
+
+		ref = time_us([&]() { blur(beliefs, 0.12); }, repeats);
+		fast = time_us([&]() {
+			blur_kernel(&cells[0], &out[0], size, size, 0.12);
+			normalize_kernel(&out[0], count);
+		}, repeats);
+		print_row("blur", size, ref, fast);
+
+		ref = time_us([&]() { normalize(beliefs); }, repeats);
+		fast = time_us([&]() { normalize_kernel(&cells[0], count); }, repeats);
+		print_row("normalize", size, ref, fast);
+	}
+}
+
+void benchmark_layouts() {
+	cout << "blur + normalize, 4M cells, microseconds per call" << endl;
+	cout << "grid\trow-major\ttile 32\ttile 64\ttile 128" << endl;
+
+	int shapes[][2] = {{2048, 2048}, {512, 8192}, {128, 32768}, {16, 262144}, {8192, 512}, {32768, 128}};
+	int tiles[] = {32, 64, 128};
+	for (int s = 0; s < 6; s++) {
+		int height = shapes[s][0];
+		int width = shapes[s][1];
+		int count = height * width;
+		vector <float> cells (count, 1.0f / count);
+		vector <float> out (count);
+
+		double flat = time_us([&]() {
+			blur_kernel(&cells[0], &out[0], height, width, 0.12);
+			normalize_kernel(&out[0], count);
+		}, 5);
+		cout << height << "x" << width << "\t" << flat;
+
+		for (int t = 0; t < 3; t++) {
+			TiledGrid in = to_tiled(&cells[0], height, width, tiles[t]);
+			TiledGrid blurred (height, width, tiles[t]);
+			double tiled = time_us([&]() {
+				blur_tiled(in, blurred, 0.12);
+				normalize_tiled(blurred);
+			}, 5);
+			cout << "\t" << tiled;
+		}
+		cout << endl;
+	}
+}
+
+void benchmark_streaming() {
+	int height = 4096;
+	int width = 4096;
+	int count = height * width;
+	vector <float> cells (count, 1.0f / count);
+	vector <float> out (count, 0.0f);
+	StreamingConfig saved = streaming_config;
+
+	cout << "move (shift + blur), " << height << "x" << width
+		<< ", streaming threshold " << saved.threshold_bytes / (1024 * 1024) << " MiB" << endl;
+	cout << "mode\tprefetch rows\tms\tGB/s (read + write)" << endl;
+
+	for (int streaming = 0; streaming < 2; streaming++) {
+		for (int prefetch = 0; prefetch <= (streaming ? 8 : 0); prefetch += 2) {
+			streaming_config.threshold_bytes = streaming ? 0 : (size_t) -1;
+			streaming_config.prefetch_rows = prefetch;
+			double us = time_us([&]() {
+				move_kernel(&cells[0], &out[0], height, width, 1, 1, 0.12);
+			}, 10);
+			double gbs = 2.0 * count * sizeof(float) / (us * 1000.0);
+			cout << (streaming ? "stream" : "cached") << "\t" << prefetch << "\t"
+				<< us / 1000.0 << "\t" << gbs << endl;
+		}
+	}
+	streaming_config = saved;
+}
+
+void benchmark_batched() {
+	int height = 5;
+	int width = 5;
+	int batches = 1000;
+	int steps = 20;
+	vector < vector <char> > map = striped_map(height, width);
+
+	vector < vector < vector <float> > > singles (batches * BATCH_LANES, initialize_beliefs(map));
+	double ref = time_us([&]() {
+		for (size_t f = 0; f < singles.size(); f++) {
+			for (int s = 0; s < steps; s++) {
+				singles[f] = sense('r', map, singles[f], 0.8, 0.2);
+				singles[f] = move(1, 0, singles[f], 0.1);
+			}
+		}
+	}, 1);
+
+	vector <FilterBatch> farm (batches, FilterBatch(height, width));
+	for (int b = 0; b < batches; b++) {
+		for (int lane = 0; lane < BATCH_LANES; lane++) {
+			farm[b].set_map(lane, map);
+		}
+	}
+	char sensed[BATCH_LANES];
+	for (int lane = 0; lane < BATCH_LANES; lane++) {
+		sensed[lane] = 'r';
+	}
+	double fast = time_us([&]() {
+		for (int b = 0; b < batches; b++) {
+			for (int s = 0; s < steps; s++) {
+				farm[b].sense(sensed, 0.8, 0.2);
+				farm[b].move(1, 0, 0.1);
+			}
+		}
+	}, 1);
+
+	double filter_steps = (double) batches * BATCH_LANES * steps;
+	cout << batches * BATCH_LANES << " filters on " << height << "x" << width
+		<< " maps, " << steps << " sense+move steps each" << endl;
+	cout << "reference\t" << filter_steps / ref << " filter-steps/us" << endl;
+	cout << "batched\t" << filter_steps / fast << " filter-steps/us\t"
+		<< ref / fast << "x" << endl;
+}
+
+void benchmark_actions() {
+	int size = 128;
+	float p_hit = 4.0, p_miss = 1.0, blurring = 0.1;
+	vector < vector <char> > map = striped_map(size, size);
+	vector < vector <float> > beliefs = initialize_beliefs(map);
+	HistogramFilter filter (map, p_hit, p_miss, blurring);
+	const char colors[] = "rg";
+
+	vector <CandidateAction> actions;
+	for (int dy = -2; dy <= 2; dy++) {
+		for (int dx = -2; dx <= 2; dx++) {
+			CandidateAction action = {dy, dx};
+			actions.push_back(action);
+		}
+	}
+
+	// one move() and one sense() per action and color
+	double ref = time_us([&]() {
+		for (size_t a = 0; a < actions.size(); a++) {
+			vector < vector <float> > predicted = move(actions[a].dy, actions[a].dx, beliefs, blurring);
+			for (int c = 0; c < 2; c++) {
+				sense(colors[c], map, predicted, p_hit, p_miss);
+			}
+		}
+	}, 1);
+	double fast = time_us([&]() { filter.evaluate_actions(actions); }, 10);
+
+	cout << actions.size() << " candidate actions on " << size << "x" << size << endl;
+	cout << "move + sense per action\t" << ref << " us" << endl;
+	cout << "evaluate_actions\t" << fast << " us\t" << ref / fast << "x" << endl;
+}
+
+void tune(string file_name) {
+	int sizes[] = {256, 1024, 2048, 4096};
+	TuningProfile profile = autotune(vector <int> (sizes, sizes + 4), &cout);
+	cout << "threads " << profile.threads << " from " << profile.parallel_min_cells << " cells, "
+		<< "streaming above " << profile.streaming_threshold_bytes / (1024 * 1024) << " MiB, "
+		<< "prefetch " << profile.prefetch_rows << " rows" << endl;
+	if (!write_tuning_profile(file_name, profile)) {
+		cout << "X - could not write " << file_name << endl;
+		return;
+	}
+	cout << "wrote " << file_name << endl;
+}
+
+// Times steps of a filter one by one and prints latency percentiles in microseconds.
+void report_step_latency(const char* name, HistogramFilter& filter, int steps) {
+	vector <double> latency (steps);
+	for (int s = 0; s < steps; s++) {
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		filter.sense(s % 3 ? 'g' : 'r');
+		filter.move(1, s % 2);
+		latency[s] = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+	}
+	sort(latency.begin(), latency.end());
+	cout << name << "\t" << latency[steps / 2] << "\t" << latency[steps * 99 / 100]
+		<< "\t" << latency[min(steps - 1, steps * 999 / 1000)] << "\t" << latency[steps - 1] << endl;
+}
+
+/**
+    Background load for the jitter benchmark: each thread sweeps a
+    large buffer and keeps allocating and freeing memory, which
+    competes for cores, cache and page tables.
+*/
+void background_load(atomic <bool>* stop) {
+	vector <char> sweep (32 * 1024 * 1024);
+	while (!stop->load()) {
+		for (size_t k = 0; k < sweep.size() && !stop->load(); k += 64) {
+			sweep[k]++;
+		}
+		vector <char> churn (8 * 1024 * 1024, 1);
+	}
+}
+
+void benchmark_jitter(const vector <int>& cores) {
+	int size = 512;
+	int steps = 5000;
+	HistogramFilter filter (striped_map(size, size), 0.9, 0.1, 0.12);
+
+	atomic <bool> stop (false);
+	vector <thread> load;
+	int threads = max(1, (int) thread::hardware_concurrency());
+	for (int t = 0; t < threads; t++) {
+		load.push_back(thread(background_load, &stop));
+	}
+
+	cout << "step latency (sense + move), " << size << "x" << size << ", " << steps << " steps, "
+		<< threads << " load threads, microseconds" << endl;
+	cout << "mode\tp50\tp99\tp99.9\tmax" << endl;
+	report_step_latency("normal", filter, steps);
+
+	RealtimeConfig config = default_realtime_config();
+	config.cores = cores.empty() ? vector <int> (1, 0) : cores;
+	config.fifo_priority = 50;
+	config.lock_memory = true;
+	RealtimeStatus status = filter.enter_realtime(config);
+	report_step_latency("realtime", filter, steps);
+	cout << "pinned " << status.pinned << ", SCHED_FIFO " << status.fifo
+		<< ", mlockall " << status.locked << endl;
+
+	stop.store(true);
+	for (size_t t = 0; t < load.size(); t++) {
+		load[t].join();
+	}
+}
+
+void print_replay(const char* name, const ReplayReport& report) {
+	cout << name << "\t" << report.seconds * 1000.0 << " ms\t" << report.events / report.seconds << " events/s";
+	for (size_t s = 0; s < report.stages.size(); s++) {
+		cout << "\t" << report.stages[s].name << " " << report.stages[s].busy_seconds * 1000.0 << " ms";
+	}
+	cout << endl;
+}
+
+void benchmark_replay() {
+	int size = 256;
+	int events = 20000;
+	vector < vector <char> > map = striped_map(size, size);
+	ostringstream log;
+	for (int e = 0; e < events; e++) {
+		if (e % 2) {
+			log << "M " << e % 3 - 1 << " 1\n";
+		}
+		else {
+			log << "S " << (e % 5 ? 'g' : 'r') << "\n";
+		}
+	}
+
+	cout << "replay of " << events << " events on " << size << "x" << size
+		<< " (busy time per stage)" << endl;
+	HistogramFilter first (map, 0.9, 0.1, 0.12);
+	istringstream first_log (log.str());
+	ostringstream first_out;
+	print_replay("sequential", replay_sequential(first_log, first, first_out));
+
+	HistogramFilter second (map, 0.9, 0.1, 0.12);
+	istringstream second_log (log.str());
+	ostringstream second_out;
+	print_replay("pipelined", replay_pipelined(second_log, second, second_out));
+}
+
+void benchmark_io() {
+	int size = 1024;
+	int saves = 50;
+	vector <float> cells ((size_t) size * size, 1.0f / (size * size));
+	string checkpoint_file = "localizer-bench.ckpt";
+	string log_file = "localizer-bench.log";
+
+	cout << "checkpoint of " << size << "x" << size << " with fdatasync, " << saves
+		<< " saves, time on the filter thread" << endl;
+	cout << "backend\tsave us\tflush us\tsaved\tskipped" << endl;
+	for (int uring = 1; uring >= 0; uring--) {
+		CheckpointWriter writer (checkpoint_file, size, size, true, uring == 1);
+		double save_us = 0.0;
+		for (int s = 0; s < saves; s++) {
+			save_us += time_us([&]() { writer.save(&cells[0], s); }, 1);
+			this_thread::sleep_for(chrono::milliseconds(2));
+		}
+		double flush_us = time_us([&]() { writer.flush(); }, 1);
+		cout << (uring ? "io_uring" : "pwrite") << "\t" << save_us / saves << "\t" << flush_us
+			<< "\t" << writer.saved << "\t" << writer.skipped << endl;
+	}
+
+	ofstream outfile (log_file);
+	for (int e = 0; e < 2000000; e++) {
+		outfile << (e % 2 ? "M 1 0\n" : "S r\n");
+	}
+	outfile.close();
+	cout << "reading a " << 2000000 << "-event log" << endl;
+	for (int uring = 1; uring >= 0; uring--) {
+		long lines = 0;
+		long stalls = 0;
+		double us = time_us([&]() {
+			PrefetchedLog prefetched (log_file, 1 << 20, 4, uring == 1);
+			istream log (&prefetched);
+			string line;
+			while (getline(log, line)) {
+				lines++;
+			}
+			stalls = prefetched.stalls;
+		}, 1);
+		cout << (uring ? "io_uring" : "pread") << "\t" << us / 1000.0 << " ms\t" << lines << " lines\t"
+			<< stalls << " stalls" << endl;
+	}
+	remove(checkpoint_file.c_str());
+	remove(log_file.c_str());
+}
+
+// Full recompiles against apply_edits for a few repainted cells.
+void benchmark_edits() {
+	cout << "grid\tcompile\t16 edits\tspeedup" << endl;
+	int sizes[] = {256, 1024, 2048};
+	for (int s = 0; s < 3; s++) {
+		int size = sizes[s];
+		vector < vector <char> > map = striped_map(size, size);
+		CompiledMap compiled = compile_map(map);
+		vector <MapEdit> edits;
+		for (int e = 0; e < 16; e++) {
+			MapEdit edit = {(e * 131) % size, (e * 257) % size, e % 2 == 0 ? 'g' : 'r'};
+			edits.push_back(edit);
+		}
+
+		double full = time_us([&]() { compile_map(map); }, 5);
+		double incremental = time_us([&]() { compiled.apply_edits(edits); }, 1000);
+		cout << size << "x" << size << "\t" << full << " us\t" << incremental << " us\t"
+			<< full / incremental << "x" << endl;
+	}
+}
+
+// E-step throughput of calibrate over synthetic runs, one thread against all cores.
+void benchmark_calibrate() {
+	vector < vector <char> > map = striped_map(64, 64);
+	CompiledMap compiled = compile_map(map);
+	mt19937 rng (3);
+	vector < vector <ReplayEvent> > runs (64);
+	for (size_t r = 0; r < runs.size(); r++) {
+		for (int e = 0; e < 1000; e++) {
+			ReplayEvent event = {e % 2 == 0 ? 'S' : 'M', "rg"[rng() % 2], (int) (rng() % 3) - 1, (int) (rng() % 3) - 1};
+			runs[r].push_back(event);
+		}
+	}
+
+	int cores = max(1u, thread::hardware_concurrency());
+	cout << "64 runs x 1000 events, 64x64 map, one EM iteration" << endl;
+	cout << "threads\tms\tevents/s" << endl;
+	for (int threads = 1; threads <= cores; threads = threads == cores ? cores + 1 : min(cores, threads * 2)) {
+		double us = time_us([&]() { calibrate(compiled, runs, 0.6, 0.4, 0.2, threads, 0); }, 3);
+		cout << threads << "\t" << us / 1000 << "\t" << (long) (64000 / (us / 1e6)) << endl;
+	}
+}
+
+// Sense steps on beliefs that have drifted into the denormal range, plain, floored and flushed.
+void benchmark_denormals() {
+	int size = 512;
+	vector < vector <char> > map (size, vector <char> (size, 'r'));
+	map[size / 2][size / 2] = 'g';
+	cout << "sense on a " << size << "x" << size << " grid of denormal beliefs, us per step" << endl;
+
+	for (int variant = 0; variant < 3; variant++) {
+		HistogramFilter filter (map, 1.0, 0.5, 0.1);
+		vector <float> cells (size * size, 1e-39f);
+		cells[0] = 1.0f;
+		filter.set_beliefs(&cells[0], size, size);
+		if (variant == 1) {
+			filter.set_health_checks(true);
+		}
+		FlushDenormals flush (variant == 2);
+
+		// sensing 'r' keeps the red cells where they are, relative to each other
+		double us = time_us([&]() { filter.sense('r'); }, 50);
+		HealthCounts counts = scan_health(filter.beliefs(), size * size, DEFAULT_BELIEF_FLOOR);
+		const char* names[] = {"plain", "floored", "FTZ/DAZ"};
+		cout << names[variant] << "\t" << us << " us\t" << counts.denormals << " denormal cells left" << endl;
+	}
+}
+
+// Three readings sensed one plane pass per channel, with fused lookups and through joint codes.
+void benchmark_channels() {
+	cout << "grid\tper channel\tfused\tjoint\tspeedup" << endl;
+	int sizes[] = {256, 1024, 2048};
+	for (int s = 0; s < 3; s++) {
+		int size = sizes[s];
+		vector < vector <char> > grids[3];
+		grids[0] = striped_map(size, size);
+		grids[1] = grids[2] = grids[0];
+		for (int i = 0; i < size; i++) {
+			for (int j = 0; j < size; j++) {
+				grids[1][i][j] = "wct"[(i / 4 + j / 4) % 3];
+				grids[2][i][j] = (i * 7 + j) % 29 == 0 ? 'F' : '.';
+			}
+		}
+		const char seen[] = {'g', 't', 'F'};
+
+		CompiledMap compiled[3];
+		MapChannel channels[3];
+		vector <float> weights (3 * 256, 1.0f);
+		ChannelLikelihood lookups[3];
+		vector <const unsigned char*> values;
+		vector <int> palette_sizes;
+		vector <const float*> tables;
+		for (int c = 0; c < 3; c++) {
+			compiled[c] = compile_map(grids[c]);
+			compile_channel(channels[c], "", grids[c], 0.9, 0.1);
+			channel_weights(channels[c].palette, seen[c], 0.9, 0.1, &weights[c * 256]);
+			lookups[c].values = &channels[c].values[0];
+			lookups[c].weights = &weights[c * 256];
+			values.push_back(&channels[c].values[0]);
+			palette_sizes.push_back(channels[c].palette.size());
+			tables.push_back(&weights[c * 256]);
+		}
+		JointCodes codes;
+		build_joint_codes(values, palette_sizes, size * size, codes);
+		vector <float> table (codes.size);
+
+		int area = size * size;
+		vector <float> cells (area, 1.0f / area), out (area);
+		double separate = time_us([&]() {
+			const float* in = &cells[0];
+			for (int c = 0; c < 3; c++) {
+				sense_kernel(in, compiled[c].plane(compiled[c].color_index(seen[c])), &out[0], area, 0.9, 0.1);
+				in = &out[0];
+			}
+		}, 20);
+		double fused = time_us([&]() { fused_sense_kernel(&cells[0], lookups, 3, &out[0], area); }, 20);
+		double joint = time_us([&]() {
+			joint_weights(codes, palette_sizes, tables, &table[0]);
+			joint_sense_kernel(&cells[0], &codes.codes[0], &table[0], &out[0], area);
+		}, 20);
+		cout << size << "x" << size << "\t" << separate << " us\t" << fused << " us\t" << joint << " us\t"
+			<< separate / joint << "x" << endl;
+	}
+}
+
+int main(int argc, char** argv) {
+	string mode = argc > 1 ? argv[1] : "kernels";
+	if (mode == "layouts") {
+		benchmark_layouts();
+	}
+	else if (mode == "streaming") {
+		benchmark_streaming();
+	}
+	else if (mode == "batched") {
+		benchmark_batched();
+	}
+	else if (mode == "actions") {
+		benchmark_actions();
+	}
+	else if (mode == "jitter") {
+		vector <int> cores;
+		for (int a = 2; a < argc; a++) {
+			cores.push_back(atoi(argv[a]));
+		}
+		benchmark_jitter(cores);
+	}
+	else if (mode == "io") {
+		benchmark_io();
+	}
+	else if (mode == "replay") {
+		benchmark_replay();
+	}
+	else if (mode == "edits") {
+		benchmark_edits();
+	}
+	else if (mode == "calibrate") {
+		benchmark_calibrate();
+	}
+	else if (mode == "denormals") {
+		benchmark_denormals();
+	}
+	else if (mode == "channels") {
+		benchmark_channels();
+	}
+	else if (mode == "tune") {
+		tune(argc > 2 ? argv[2] : default_tuning_file());
+	}
+	else {
+		benchmark_kernels();
+	}
+	return 0;
+}
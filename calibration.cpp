@@ -0,0 +1,204 @@
+/**
+	calibration.cpp
+
+	Purpose: fits the sensor and motion parameters of the filter to
+	logged runs with expectation maximization. Each run is one
+	forward-backward pass built on the flat kernels; runs are
+	independent, so they are spread over a worker pool with per-thread
+	counts that are only added up at the end of an iteration.
+*/
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include "calibration.h"
+#include "kernels.h"
+#include "parallel.h"
+
+using namespace std;
+
+void SufficientStats::add(const SufficientStats& other) {
+	sense_events += other.sense_events;
+	expected_hits += other.expected_hits;
+	move_events += other.move_events;
+	expected_stays += other.expected_stays;
+	log_likelihood += other.log_likelihood;
+}
+
+vector <ReplayEvent> read_replay_log(istream& log) {
+	vector <ReplayEvent> events;
+	string line;
+	ReplayEvent event;
+	while (getline(log, line)) {
+		if (parse_replay_event(line, event)) {
+			events.push_back(event);
+		}
+	}
+	return events;
+}
+
+/**
+    One filter step of the forward pass, normalized.
+
+    @return - the log of the sensed color's probability for a sense,
+    	   0 for a move.
+*/
+double forward_step(const CompiledMap& map, const ReplayEvent& event, const float* before, float* after,
+	float p_hit, float p_miss, float blurring)
+{
+	size_t area = (size_t) map.height * map.width;
+	if (event.kind == 'S') {
+		int index = map.color_index(event.color);
+		sense_kernel(before, index < 0 ? NULL : map.plane(index), after, area, p_hit, p_miss);
+		return log((double) normalize_kernel(after, area));
+	}
+	move_kernel(before, after, map.height, map.width, event.dy, event.dx, blurring);
+	normalize_kernel(after, area);
+	return 0.0;
+}
+
+/**
+    Forward-backward over one run. The forward pass is the filter
+    itself; the backward pass runs the same kernels with the motions
+    reversed, since the blur window is symmetric. Expected hits come
+    from the smoothed belief at each sense; expected stays from the
+    share of each move's two-slice posterior that has no noise offset.
+
+    Keeping every forward posterior would take (events + 1) grids.
+    Instead the forward pass keeps one every stride = sqrt(events)
+    events, and the backward pass recomputes the posteriors of each
+    segment from its checkpoint, so a run holds about 2 sqrt(events)
+    grids for one extra forward pass.
+
+    @return - the counts of the run.
+*/
+SufficientStats expected_counts(const CompiledMap& map, const vector <ReplayEvent>& run,
+	float p_hit, float p_miss, float blurring)
+{
+	SufficientStats stats = {0.0, 0.0, 0.0, 0.0, 0.0};
+	int height = map.height, width = map.width;
+	size_t area = (size_t) height * width;
+	size_t steps = run.size();
+	size_t stride = max((size_t) 1, (size_t) ceil(sqrt((double) steps)));
+	size_t segments = (steps + stride - 1) / stride;
+
+	// checkpoint s is the filtered belief before event s * stride
+	vector <float> checkpoints (segments * area);
+	vector <float> belief (area, 1.0f / area), next (area);
+	for (size_t t = 0; t < steps; t++) {
+		if (t % stride == 0) {
+			copy(belief.begin(), belief.end(), checkpoints.begin() + (t / stride) * area);
+		}
+		stats.log_likelihood += forward_step(map, run[t], &belief[0], &next[0], p_hit, p_miss, blurring);
+		belief.swap(next);
+	}
+
+	// alpha[t - first] is the filtered belief before event t of the segment
+	vector <float> alpha ((min(stride, steps) + 1) * area);
+	vector <float> beta (area, 1.0f), moved (area), shifted (area);
+	for (size_t s = segments; s-- > 0; ) {
+		size_t first = s * stride, last = min(steps, first + stride);
+		copy(checkpoints.begin() + s * area, checkpoints.begin() + (s + 1) * area, alpha.begin());
+		for (size_t t = first; t < last; t++) {
+			forward_step(map, run[t], &alpha[(t - first) * area], &alpha[(t - first + 1) * area],
+				p_hit, p_miss, blurring);
+		}
+
+		for (size_t t = last; t-- > first; ) {
+			const float* before = &alpha[(t - first) * area];
+			const float* after = &alpha[(t - first + 1) * area];
+			if (run[t].kind == 'S') {
+				int index = map.color_index(run[t].color);
+				const float* plane = index < 0 ? NULL : map.plane(index);
+				double hit = 0.0, all = 0.0;
+				for (size_t k = 0; k < area; k++) {
+					double smoothed = (double) after[k] * beta[k];
+					all += smoothed;
+					hit += plane == NULL ? 0.0 : smoothed * plane[k];
+				}
+				stats.sense_events++;
+				stats.expected_hits += all > 0.0 ? hit / all : 0.0;
+				sense_kernel(&beta[0], plane, &beta[0], area, p_hit, p_miss);
+			}
+			else {
+				move_kernel(&beta[0], &moved[0], height, width, -run[t].dy, -run[t].dx, blurring);
+				shift_kernel(&beta[0], &shifted[0], height, width, -run[t].dy, -run[t].dx);
+				double all = dot_kernel(before, &moved[0], area);
+				stats.move_events++;
+				stats.expected_stays += all > 0.0 ? (1.0 - blurring) * dot_kernel(before, &shifted[0], area) / all : 0.0;
+				beta.swap(moved);
+			}
+			normalize_kernel(&beta[0], area);
+		}
+	}
+	return stats;
+}
+
+// Per-thread counts, each on its own cache lines.
+struct alignas(64) PaddedStats {
+	SufficientStats stats;
+};
+
+/**
+    Runs expectation maximization. The M step has a closed form: the
+    hit rate is the expected share of senses that saw the robot's
+    color, spread as p_miss over the other palette colors, and the
+    blurring is the expected share of moves that did not land on the
+    intended cell.
+
+    @return - the fitted parameters and the log likelihood of every
+    	   iteration. EM normally raises it every iteration, but the
+    	   clamped M step does not guarantee that; it may dip slightly
+    	   near convergence.
+*/
+CalibrationResult calibrate(const CompiledMap& map, const vector < vector <ReplayEvent> >& runs,
+	float p_hit, float p_miss, float blurring, int threads, int max_iterations, double tolerance)
+{
+	if (threads <= 0) {
+		threads = max(1u, thread::hardware_concurrency());
+	}
+	threads = max(1, min(threads, (int) runs.size()));
+	WorkerPool pool (threads);
+	vector <PaddedStats> partial (threads);
+	int other_colors = max(1, (int) map.palette.size() - 1);
+
+	CalibrationResult result = {p_hit, p_miss, blurring, 0, vector <double> ()};
+	for (int iteration = 0; iteration <= max_iterations; iteration++) {
+		atomic <size_t> next_run (0);
+		pool.run(threads, [&](int worker) {
+			SufficientStats& stats = partial[worker].stats;
+			stats = SufficientStats();
+			for (size_t r; (r = next_run++) < runs.size(); ) {
+				stats.add(expected_counts(map, runs[r], result.p_hit, result.p_miss, result.blurring));
+			}
+		});
+
+		SufficientStats total = {0.0, 0.0, 0.0, 0.0, 0.0};
+		for (int w = 0; w < threads; w++) {
+			total.add(partial[w].stats);
+		}
+		result.log_likelihoods.push_back(total.log_likelihood);
+
+		size_t n = result.log_likelihoods.size();
+		bool converged = n > 1 && result.log_likelihoods[n - 1] - result.log_likelihoods[n - 2]
+			< tolerance * max(1.0, total.sense_events);
+		if (converged || iteration == max_iterations) {
+			break;
+		}
+
+		if (total.sense_events > 0.0) {
+			// a rate of exactly 0 or 1 would make some sensed colors impossible
+			float hit_rate = min(1.0 - 1e-4, max(1e-4, total.expected_hits / total.sense_events));
+			result.p_hit = hit_rate;
+			result.p_miss = (1.0f - hit_rate) / other_colors;
+		}
+		if (total.move_events > 0.0) {
+			result.blurring = 1.0 - total.expected_stays / total.move_events;
+		}
+		result.iterations++;
+	}
+	return result;
+}
@@ -0,0 +1,60 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <vector>
+#include <iostream>
+#include "compiled_map.h"
+#include "replay.h"
+
+/**
+	Expected counts gathered from logged runs by forward-backward,
+	enough to refit the sensor and motion parameters. Counts from
+	different runs (or threads) add up.
+*/
+struct SufficientStats {
+	double sense_events;
+	// expected number of senses that saw the color of the robot's cell
+	double expected_hits;
+	double move_events;
+	// expected number of moves that landed exactly on the intended cell
+	double expected_stays;
+	// log likelihood of the sensed colors under the current parameters
+	double log_likelihood;
+
+	void add(const SufficientStats& other);
+};
+
+struct CalibrationResult {
+	float p_hit, p_miss, blurring;
+	int iterations;
+	// log likelihood of all runs before each iteration, then after the last
+	std::vector <double> log_likelihoods;
+};
+
+// Reads a replay log (see replay.h) into a list of events.
+std::vector <ReplayEvent> read_replay_log(std::istream& log);
+
+/**
+    The E step for one run: forward-backward over the run's events,
+    starting from a uniform belief. A sense of color c has probability
+    p_hit where the map has c and p_miss elsewhere; a move lands on
+    the intended cell with probability 1 - blurring and on each of
+    the eight neighbors with the weights of the blur window. Holds
+    about 2 sqrt(events) belief grids at a time, not one per event.
+*/
+SufficientStats expected_counts(const CompiledMap& map, const std::vector <ReplayEvent>& run,
+	float p_hit, float p_miss, float blurring);
+
+/**
+    Fits p_hit, p_miss and blurring to logged runs by expectation
+    maximization, starting from the given values. Runs are spread
+    over threads worker threads (0 uses one per core), each summing
+    its own counts; the counts are added up once per iteration. Stops
+    after max_iterations or when the log likelihood improves by less
+    than tolerance per sensed color.
+*/
+CalibrationResult calibrate(const CompiledMap& map, const std::vector < std::vector <ReplayEvent> >& runs,
+	float p_hit, float p_miss, float blurring, int threads = 0, int max_iterations = 50,
+	double tolerance = 1e-6);
+
+#endif /* CALIBRATION_H */
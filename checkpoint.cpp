@@ -0,0 +1,204 @@
+/**
+	checkpoint.cpp
+
+	Purpose: asynchronous, crash-safe belief checkpoints in a two
+	slot file. Slot k lives at offset k * slot_bytes (page aligned)
+	and carries a sequence number and a checksum of its cells, so a
+	torn write is detected and the older slot is used.
+*/
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <string.h>
+#include <stdint.h>
+#include "checkpoint.h"
+
+#ifdef LOCALIZER_HAS_POSIX_IO
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+using namespace std;
+
+const char CHECKPOINT_MAGIC[8] = {'L', 'O', 'C', 'C', 'K', 'P', 'T', '\0'};
+const uint32_t CHECKPOINT_VERSION = 1;
+
+// FNV-1a over 64-bit words (then the tail bytes), to keep save() cheap on large grids.
+uint64_t checkpoint_checksum(const char* bytes, size_t count) {
+	uint64_t hash = 14695981039346656037ULL;
+	size_t k = 0;
+	for (; k + 8 <= count; k += 8) {
+		uint64_t word;
+		memcpy(&word, bytes + k, 8);
+		hash = (hash ^ word) * 1099511628211ULL;
+	}
+	for (; k < count; k++) {
+		hash = (hash ^ (unsigned char) bytes[k]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Bytes of one slot: the header and cells, rounded up to whole pages.
+size_t checkpoint_slot_bytes(int height, int width) {
+	size_t bytes = sizeof(CheckpointHeader) + (size_t) height * width * sizeof(float);
+	return (bytes + 4095) / 4096 * 4096;
+}
+
+CheckpointWriter::CheckpointWriter(string file_name, int height, int width, bool sync, bool try_uring) :
+	saved(0), skipped(0), failed(0), io(8, try_uring), fd(-1), height(height), width(width), sync(sync),
+	slot_bytes(checkpoint_slot_bytes(height, width)), storage(2 * slot_bytes, 0), request(0), sequence(0)
+{
+#ifdef LOCALIZER_HAS_POSIX_IO
+	fd = open(file_name.c_str(), O_RDWR | O_CREAT, 0644);
+	char* buffers[2] = {&storage[0], &storage[slot_bytes]};
+	io.register_buffers(buffers, 2, slot_bytes);
+#else
+	// create the file first: an in | out fstream does not
+	ofstream(file_name.c_str(), ios::binary | ios::app).close();
+	stream.open(file_name.c_str(), ios::binary | ios::in | ios::out);
+#endif
+}
+
+CheckpointWriter::~CheckpointWriter() {
+	flush();
+#ifdef LOCALIZER_HAS_POSIX_IO
+	if (fd >= 0) {
+		close(fd);
+	}
+#endif
+}
+
+bool CheckpointWriter::is_open() const {
+#ifdef LOCALIZER_HAS_POSIX_IO
+	return fd >= 0;
+#else
+	return stream.is_open();
+#endif
+}
+
+// Collects the result of the checkpoint in flight, if it is done (or block).
+void CheckpointWriter::reap(bool block) {
+	if (request == 0) {
+		return;
+	}
+	long result;
+	if (block) {
+		result = io.wait(request);
+	}
+	else if (!io.done(request, result)) {
+		return;
+	}
+	request = 0;
+	if (result == (long) slot_bytes) {
+		saved++;
+	}
+	else {
+		failed++;
+	}
+}
+
+bool CheckpointWriter::save(const float* cells, uint64_t step) {
+	reap(false);
+	if (!is_open() || request != 0) {
+		skipped++;
+		return false;
+	}
+
+	int slot = sequence % 2;
+	char* buffer = &storage[slot * slot_bytes];
+	size_t cell_bytes = (size_t) height * width * sizeof(float);
+	CheckpointHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.height = height;
+	header.width = width;
+	header.sequence = ++sequence;
+	header.step = step;
+	memcpy(buffer + sizeof(header), cells, cell_bytes);
+	header.checksum = checkpoint_checksum(buffer + sizeof(header), cell_bytes);
+	memcpy(buffer, &header, sizeof(header));
+
+#ifdef LOCALIZER_HAS_POSIX_IO
+	request = io.write(fd, buffer, slot_bytes, (off_t) slot * slot_bytes, slot, sync);
+#else
+	stream.seekp((streamoff) slot * slot_bytes);
+	stream.write(buffer, slot_bytes);
+	stream.flush();
+	if (stream) {
+		saved++;
+	}
+	else {
+		stream.clear();
+		failed++;
+	}
+#endif
+	return true;
+}
+
+bool CheckpointWriter::flush() {
+	long failures = failed;
+	reap(true);
+	return failed == failures;
+}
+
+/**
+    Reads the slot at offset into cells. The header is untrusted: its
+    dimensions are checked against the file_bytes the file holds
+    before anything is allocated for them.
+
+    @return - false when it is not a whole, valid checkpoint.
+*/
+bool read_checkpoint_slot(ifstream& infile, size_t file_bytes, size_t offset, CheckpointHeader& header,
+	vector <float>& cells)
+{
+	infile.clear();
+	infile.seekg(offset);
+	if (!infile.read((char*) &header, sizeof(header))
+		|| memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0
+		|| header.version != CHECKPOINT_VERSION || header.height <= 0 || header.width <= 0
+		|| (size_t) header.height > file_bytes / sizeof(float) / (size_t) header.width)
+	{
+		return false;
+	}
+	size_t slot_bytes = checkpoint_slot_bytes(header.height, header.width);
+	if (offset + slot_bytes > file_bytes || (offset != 0 && slot_bytes != offset)) {
+		return false;
+	}
+	cells.resize((size_t) header.height * header.width);
+	size_t cell_bytes = cells.size() * sizeof(float);
+	return (bool) infile.read((char*) &cells[0], cell_bytes)
+		&& checkpoint_checksum((const char*) &cells[0], cell_bytes) == header.checksum;
+}
+
+/**
+    Reads the newest valid checkpoint. Slot 1 starts one slot size
+    in; when slot 0 is damaged that size is taken from the file
+    length, which is exactly two slots once slot 1 was written.
+*/
+bool read_checkpoint(string file_name, vector <float>& cells, int& height, int& width, uint64_t& step) {
+	ifstream infile(file_name, ios::binary | ios::ate);
+	if (!infile.is_open()) {
+		return false;
+	}
+	size_t file_bytes = infile.tellg();
+
+	CheckpointHeader first, second;
+	vector <float> first_cells, second_cells;
+	bool first_valid = read_checkpoint_slot(infile, file_bytes, 0, first, first_cells);
+	size_t slot_bytes = first_valid ? checkpoint_slot_bytes(first.height, first.width) : file_bytes / 2;
+	bool second_valid = slot_bytes > 0 && slot_bytes % 4096 == 0
+		&& read_checkpoint_slot(infile, file_bytes, slot_bytes, second, second_cells);
+
+	if (!first_valid && !second_valid) {
+		return false;
+	}
+	bool use_second = second_valid && (!first_valid || second.sequence > first.sequence);
+	CheckpointHeader& header = use_second ? second : first;
+	cells.swap(use_second ? second_cells : first_cells);
+	height = header.height;
+	width = header.width;
+	step = header.step;
+	return true;
+}
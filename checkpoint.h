@@ -0,0 +1,76 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <stdint.h>
+#include "async_io.h"
+
+/**
+	Header of one checkpoint slot. A checkpoint file has two slots
+	that are written in turn, so a crash while one is written leaves
+	the other intact; readers take the valid slot with the higher
+	sequence number. The beliefs (height * width floats) follow.
+*/
+struct CheckpointHeader {
+	char magic[8];
+	uint32_t version;
+	int32_t height;
+	int32_t width;
+	uint32_t reserved;
+	uint64_t sequence;
+	uint64_t step;
+	uint64_t checksum;
+};
+
+/**
+	Writes belief checkpoints without blocking the filter thread:
+	save() copies the beliefs into a registered buffer and submits
+	the write (and an fdatasync) through AsyncFileIO. When the
+	previous checkpoint is still being written, the new one is
+	skipped instead of waited for.
+*/
+class CheckpointWriter {
+public:
+	CheckpointWriter(std::string file_name, int height, int width, bool sync = true,
+		bool try_uring = true);
+	~CheckpointWriter();
+
+	bool is_open() const;
+
+	/**
+	    Starts writing a checkpoint of height * width cells taken at
+	    step. Returns false when it was skipped.
+	*/
+	bool save(const float* cells, uint64_t step);
+
+	// Waits for the checkpoint in flight. Returns false if it failed.
+	bool flush();
+
+	long saved, skipped, failed;
+
+private:
+	AsyncFileIO io;
+	int fd;
+	int height, width;
+	bool sync;
+	size_t slot_bytes;
+	std::vector <char> storage;
+	long request;
+	uint64_t sequence;
+#ifndef LOCALIZER_HAS_POSIX_IO
+	std::fstream stream;
+#endif
+
+	void reap(bool block);
+};
+
+/**
+    Reads the newest valid checkpoint of a file. Returns false when
+    neither slot holds one.
+*/
+bool read_checkpoint(std::string file_name, std::vector <float>& cells, int& height, int& width,
+	uint64_t& step);
+
+#endif /* CHECKPOINT_H */
@@ -0,0 +1,228 @@
+/**
+	clustering.cpp
+
+	Purpose: multi-hypothesis summaries of the posterior (mass,
+	centroid and extent of every mode) without a flood fill over
+	the whole grid.
+*/
+
+#include <vector>
+#include <algorithm>
+#include "clustering.h"
+#include "kernels.h"
+#include "simd.h"
+
+using namespace std;
+
+// Blocks of cells are scaled, checked and collected while they are in L1.
+float normalize_and_collect(float* cells, int count, float threshold, vector <int>& active,
+	HealthCounts* health, float floor)
+{
+	const int BLOCK = 4096;
+	float total = grid_sum(cells, count);
+	float factor = total != 0.0 ? 1.0f / total : 1.0f;
+
+	for (int begin = 0; begin < count; begin += BLOCK) {
+		int length = min(BLOCK, count - begin);
+		float* block = cells + begin;
+		scale_kernel(block, length, factor);
+		if (health != NULL) {
+			scan_and_floor(block, length, floor, *health);
+		}
+		for (int k = 0; k < length; k++) {
+			if (block[k] > threshold) {
+				active.push_back(begin + k);
+			}
+		}
+	}
+	return total;
+}
+
+HypothesisTracker::HypothesisTracker() : height(0), width(0), generation(0) {}
+
+void HypothesisTracker::resize(int height, int width) {
+	this->height = height;
+	this->width = width;
+	active.clear();
+
+	// the lookup tables are sized on first use, so filters that never cluster do not pay for them
+	vector <unsigned> ().swap(stamp);
+	vector <int> ().swap(slot);
+	generation = 0;
+}
+
+size_t HypothesisTracker::memory_bytes() const {
+	size_t ints = active.capacity() + slot.capacity() + parent.capacity() + size.capacity()
+		+ group.capacity() + group_start.capacity() + cursor.capacity() + ordered.capacity()
+		+ rows.capacity() + cols.capacity();
+	return ints * sizeof(int) + stamp.capacity() * sizeof(unsigned)
+		+ candidates.capacity() * sizeof(Hypothesis);
+}
+
+int HypothesisTracker::find(int a) {
+	while (parent[a] != a) {
+		parent[a] = parent[parent[a]];
+		a = parent[a];
+	}
+	return a;
+}
+
+void HypothesisTracker::unite(int a, int b) {
+	a = find(a);
+	b = find(b);
+	if (a == b) {
+		return;
+	}
+	if (size[a] < size[b]) {
+		swap(a, b);
+	}
+	parent[b] = a;
+	size[a] += size[b];
+}
+
+// Returns the position of a cell in the active set, or -1.
+int HypothesisTracker::lookup(int cell) const {
+	return stamp[cell] == generation ? slot[cell] : -1;
+}
+
+/**
+    Smallest cyclic interval holding a set of coordinates: the
+    complement of the largest gap between consecutive coordinates.
+
+    @param coords - sorted, distinct coordinates in [0, n).
+
+    @param n - the length of the cyclic axis.
+
+    @param start - receives the first coordinate of the interval.
+
+    @return - the length of the interval.
+*/
+int cyclic_extent(const vector <int>& coords, int n, int& start) {
+	int best_gap = coords[0] + n - coords.back();
+	start = coords[0];
+	for (size_t k = 1; k < coords.size(); k++) {
+		int gap = coords[k] - coords[k - 1];
+		if (gap > best_gap) {
+			best_gap = gap;
+			start = coords[k];
+		}
+	}
+	return n - best_gap + 1;
+}
+
+bool heavier(const Hypothesis& a, const Hypothesis& b) {
+	return a.mass > b.mass;
+}
+
+/**
+    Clusters the active set.
+
+    @param beliefs - the normalized beliefs the active set was
+    	   collected from.
+
+    @param max_count - how many hypotheses to return at most.
+
+    @return - the heaviest hypotheses, heaviest first. Centroids are
+    	   mass-weighted means measured from the start of each
+    	   cluster's extent, so clusters that wrap around an edge get
+    	   a centroid inside the cluster.
+*/
+vector <Hypothesis> HypothesisTracker::hypotheses(const float* beliefs, int max_count) {
+	int n = active.size();
+
+	if (stamp.size() != (size_t) height * width) {
+		stamp.assign((size_t) height * width, 0);
+		slot.assign((size_t) height * width, 0);
+		generation = 0;
+	}
+
+	// a fresh generation invalidates every old stamp at once
+	generation++;
+	if (generation == 0) {
+		fill(stamp.begin(), stamp.end(), 0);
+		generation = 1;
+	}
+	parent.resize(n);
+	size.assign(n, 1);
+	for (int a = 0; a < n; a++) {
+		stamp[active[a]] = generation;
+		slot[active[a]] = a;
+		parent[a] = a;
+	}
+
+	// join each active cell with its active neighbors
+	for (int a = 0; a < n; a++) {
+		int i = active[a] / width;
+		int j = active[a] % width;
+		for (int di = -1; di <= 1; di++) {
+			for (int dj = -1; dj <= 1; dj++) {
+				int ni = (i + di + height) % height;
+				int nj = (j + dj + width) % width;
+				int b = lookup(ni * width + nj);
+				if (b >= 0) {
+					unite(a, b);
+				}
+			}
+		}
+	}
+
+	// number the components, then lay out their members contiguously (a counting sort)
+	int groups = 0;
+	group.assign(n, -1);
+	for (int a = 0; a < n; a++) {
+		int root = find(a);
+		if (group[root] < 0) {
+			group[root] = groups++;
+		}
+	}
+	group_start.assign(groups + 1, 0);
+	for (int a = 0; a < n; a++) {
+		group_start[group[find(a)] + 1]++;
+	}
+	for (int g = 0; g < groups; g++) {
+		group_start[g + 1] += group_start[g];
+	}
+	cursor.assign(group_start.begin(), group_start.end() - 1);
+	ordered.resize(n);
+	for (int a = 0; a < n; a++) {
+		ordered[cursor[group[find(a)]]++] = active[a];
+	}
+
+	candidates.clear();
+	for (int g = 0; g < groups; g++) {
+		const int* members = n > 0 ? &ordered[group_start[g]] : NULL;
+		int count = group_start[g + 1] - group_start[g];
+		rows.clear();
+		cols.clear();
+		for (int m = 0; m < count; m++) {
+			rows.push_back(members[m] / width);
+			cols.push_back(members[m] % width);
+		}
+		sort(rows.begin(), rows.end());
+		rows.erase(unique(rows.begin(), rows.end()), rows.end());
+		sort(cols.begin(), cols.end());
+		cols.erase(unique(cols.begin(), cols.end()), cols.end());
+
+		Hypothesis h;
+		h.rows = cyclic_extent(rows, height, h.top);
+		h.cols = cyclic_extent(cols, width, h.left);
+		h.cells = count;
+
+		double mass = 0.0, row_moment = 0.0, col_moment = 0.0;
+		for (int m = 0; m < count; m++) {
+			int cell = members[m];
+			double p = beliefs[cell];
+			mass += p;
+			row_moment += p * ((cell / width - h.top + height) % height);
+			col_moment += p * ((cell % width - h.left + width) % width);
+		}
+		h.mass = mass;
+		h.row = mass > 0.0 ? fmod(h.top + row_moment / mass, (double) height) : h.top;
+		h.col = mass > 0.0 ? fmod(h.left + col_moment / mass, (double) width) : h.left;
+		candidates.push_back(h);
+	}
+
+	sort(candidates.begin(), candidates.end(), heavier);
+	int kept = max(0, min((int) candidates.size(), max_count));
+	return vector <Hypothesis> (candidates.begin(), candidates.begin() + kept);
+}
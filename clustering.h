@@ -0,0 +1,78 @@
+#ifndef CLUSTERING_H
+#define CLUSTERING_H
+
+#include <vector>
+#include "numeric_health.h"
+
+// One mode of the posterior: a connected group of above-threshold cells.
+struct Hypothesis {
+	// total probability of the cells
+	double mass;
+
+	// mass-weighted mean position, in [0, height) x [0, width)
+	double row, col;
+
+	// smallest cyclic rectangle holding every cell; may wrap
+	int top, left, rows, cols;
+
+	int cells;
+};
+
+/**
+	Clusters the active set (cells above a threshold) of a cyclic
+	grid into 8-connected components with union-find, from scratch
+	on every call. Lookups go through a stamp array that is never
+	cleared, so the work per call is proportional to the number of
+	active cells, not to the grid size. The working buffers are
+	members and keep their capacity, so once they have grown a call
+	allocates only the vector it returns.
+*/
+class HypothesisTracker {
+public:
+	int height, width;
+
+	// Cell indices above the threshold, in row-major order.
+	std::vector <int> active;
+
+	HypothesisTracker();
+
+	// Sets the grid dimensions; forgets the previous active set.
+	void resize(int height, int width);
+
+	// Clusters the active set and returns the max_count heaviest modes.
+	std::vector <Hypothesis> hypotheses(const float* beliefs, int max_count);
+
+	// Bytes held by the active set and the lookup tables.
+	size_t memory_bytes() const;
+
+private:
+	std::vector <unsigned> stamp;
+	std::vector <int> slot;
+	unsigned generation;
+	std::vector <int> parent;
+	std::vector <int> size;
+	// component number of each root, and the members of component g
+	// at ordered[group_start[g]] to ordered[group_start[g + 1] - 1]
+	std::vector <int> group;
+	std::vector <int> group_start;
+	std::vector <int> cursor;
+	std::vector <int> ordered;
+	std::vector <int> rows, cols;
+	std::vector <Hypothesis> candidates;
+
+	int find(int a);
+	void unite(int a, int b);
+	int lookup(int cell) const;
+};
+
+/**
+    Normalizes count cells in place and appends the index of every
+    cell whose normalized value exceeds threshold to active, in the
+    same pass. When health is given the cells are also checked and
+    floored before they are collected (see scan_and_floor). Returns
+    the total before normalizing.
+*/
+float normalize_and_collect(float* cells, int count, float threshold, std::vector <int>& active,
+	HealthCounts* health = NULL, float floor = 0.0);
+
+#endif /* CLUSTERING_H */
@@ -0,0 +1,126 @@
+/**
+	compiled_map.cpp
+
+	Purpose: turns a grid map (vector of vectors of chars) into
+	the flat palette / per-color plane form used by the kernels,
+	so that sensing becomes a multiply-add with no char compares.
+*/
+
+#include <vector>
+#include <algorithm>
+#include "compiled_map.h"
+
+using namespace std;
+
+int CompiledMap::color_index(char color) const {
+	for (int k = 0; k < (int) palette.size(); k++) {
+		if (palette[k] == color) {
+			return k;
+		}
+	}
+	return -1;
+}
+
+const float* CompiledMap::plane(int index) const {
+	const float* base = shared_planes ? shared_planes.get() : &planes[0];
+	return base + (size_t) index * height * width;
+}
+
+/**
+    Repaints cells in place, in time proportional to the number of
+    edits. Colors that no longer appear keep their palette entry and
+    an all-zero plane, which senses exactly like a color off the map.
+    Shared planes (registry or embedded maps) are read only, so the
+    first edit of such a map copies them into private planes.
+
+    @param edits - the cells to repaint, applied in order; a cell
+    	   edited twice ends with its last color.
+
+    @return - false when an edit is off the map or the palette would
+    	   exceed 256 colors; the map is then unchanged.
+*/
+bool CompiledMap::apply_edits(const vector <MapEdit>& edits) {
+	vector <char> added;
+	for (size_t e = 0; e < edits.size(); e++) {
+		const MapEdit& edit = edits[e];
+		if (edit.row < 0 || edit.row >= height || edit.col < 0 || edit.col >= width) {
+			return false;
+		}
+		if (color_index(edit.color) < 0 && find(added.begin(), added.end(), edit.color) == added.end()) {
+			added.push_back(edit.color);
+		}
+	}
+	if (palette.size() + added.size() > 256) {
+		return false;
+	}
+
+	size_t area = (size_t) height * width;
+	if (shared_planes) {
+		planes.assign(shared_planes.get(), shared_planes.get() + palette.size() * area);
+		shared_planes.reset();
+	}
+	for (size_t k = 0; k < added.size(); k++) {
+		palette.push_back(added[k]);
+	}
+	planes.resize(palette.size() * area, 0.0f);
+
+	for (size_t e = 0; e < edits.size(); e++) {
+		size_t cell = (size_t) edits[e].row * width + edits[e].col;
+		int index = color_index(edits[e].color);
+		planes[colors[cell] * area + cell] = 0.0f;
+		planes[index * area + cell] = 1.0f;
+		colors[cell] = (unsigned char) index;
+	}
+	return true;
+}
+
+// Builds a compiled map from any source of cells; cell(i, j) returns a color.
+template <typename Cell>
+CompiledMap compile_cells(int height, int width, Cell cell) {
+	CompiledMap map;
+	map.height = height;
+	map.width = width;
+
+	int area = map.height * map.width;
+	map.colors.resize(area);
+
+	// intern every cell color into the palette
+	for (int i = 0; i < map.height; i++) {
+		for (int j = 0; j < map.width; j++) {
+			char color = cell(i, j);
+			int index = map.color_index(color);
+			if (index < 0) {
+				index = map.palette.size();
+				map.palette.push_back(color);
+			}
+			map.colors[i * map.width + j] = (unsigned char) index;
+		}
+	}
+
+	// one hit plane per palette color
+	map.planes.assign((size_t) map.palette.size() * area, 0.0);
+	for (int cell = 0; cell < area; cell++) {
+		map.planes[(size_t) map.colors[cell] * area + cell] = 1.0;
+	}
+
+	return map;
+}
+
+/**
+    Builds the palette and per-color planes of a grid map.
+
+    @param grid - a two dimensional grid map (vector of vectors
+    	   of chars) as returned by read_map.
+
+    @return - the compiled map. Palette indices are assigned in
+    	   order of first appearance (row-major).
+*/
+CompiledMap compile_map(const vector < vector <char> >& grid) {
+	int height = grid.size();
+	int width = height > 0 ? grid[0].size() : 0;
+	return compile_cells(height, width, [&](int i, int j) { return grid[i][j]; });
+}
+
+CompiledMap compile_map(const char* cells, int height, int width, int row_stride) {
+	return compile_cells(height, width, [&](int i, int j) { return cells[(size_t) i * row_stride + j]; });
+}
@@ -0,0 +1,60 @@
+#ifndef COMPILED_MAP_H
+#define COMPILED_MAP_H
+
+#include <vector>
+#include <memory>
+
+// One repainted cell of a map.
+struct MapEdit {
+	int row;
+	int col;
+	char color;
+};
+
+/**
+	A map preprocessed for the flat kernels: the distinct colors
+	(palette), the palette index of every cell, and one float
+	plane per palette color holding 1.0 where the cell has that
+	color and 0.0 elsewhere. Cells are stored row-major.
+
+	Optionally the map also carries a motion class per cell and the
+	blurring value of each class (see motion_noise.h); when
+	motion_classes is empty motion noise is uniform.
+
+	A map attached from a registry (see map_registry.h) leaves planes
+	empty and reads them from shared_planes, a read-only mapping
+	shared with other processes.
+*/
+struct CompiledMap {
+	int height;
+	int width;
+	std::vector <char> palette;
+	std::vector <unsigned char> colors;
+	std::vector <float> planes;
+	std::shared_ptr <const float> shared_planes;
+	std::vector <unsigned char> motion_classes;
+	std::vector <float> class_blurring;
+
+	// Returns the palette index of a color, or -1 if it is not on the map.
+	int color_index(char color) const;
+
+	// Returns the hit plane of a palette index.
+	const float* plane(int index) const;
+
+	/**
+	    Repaints cells in place. Only the edited cells of the color
+	    indices and of the old and new colors' planes are written,
+	    plus one new plane per color not yet in the palette. Returns
+	    false, changing nothing, when an edit lies off the map or the
+	    palette would outgrow 256 colors.
+	*/
+	bool apply_edits(const std::vector <MapEdit>& edits);
+};
+
+// Builds the palette and per-color planes of a grid map.
+CompiledMap compile_map(const std::vector < std::vector <char> >& grid);
+
+// Same, from height rows of width colors, row i starting at cells + i * row_stride.
+CompiledMap compile_map(const char* cells, int height, int width, int row_stride);
+
+#endif /* COMPILED_MAP_H */
@@ -0,0 +1,404 @@
+/**
+	differential.cpp
+
+	Purpose: randomized differential testing of the optimized
+	kernels against the reference vector-of-vectors functions.
+	Each variant is run on the same random cases as the reference
+	and the worst absolute, relative and ULP errors are recorded.
+	New fast paths are added to kernel_variants().
+*/
+
+#include <vector>
+#include <string>
+#include <random>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+#include "differential.h"
+#include "kernels.h"
+#include "compiled_map.h"
+#include "tiled_grid.h"
+#include "streaming.h"
+#include "batched_filter.h"
+#include "motion_noise.h"
+#include "parallel.h"
+#include "map_channels.h"
+
+using namespace std;
+
+/**
+    Draws a random case.
+
+    @param rng - the random number generator.
+
+    @param max_size - the largest height or width to draw.
+
+    @return - a case whose beliefs are normalized and span many
+    	   orders of magnitude, with some exact zeros.
+*/
+FuzzCase random_case(mt19937& rng, int max_size) {
+	const char colors[] = "rgbycmk";
+	uniform_int_distribution<int> size_dist (1, max_size);
+	uniform_int_distribution<int> palette_dist (1, 7);
+	uniform_real_distribution<float> unit (0.0f, 1.0f);
+	uniform_int_distribution<int> exponent (-30, 0);
+	int tiles[] = {1, 4, 16, 64};
+
+	FuzzCase c;
+	c.height = size_dist(rng);
+	c.width = size_dist(rng);
+	c.tile = tiles[rng() % 4];
+
+	int palette_size = palette_dist(rng);
+	c.map.assign(c.height, vector <char> (c.width));
+	c.beliefs.assign(c.height, vector <float> (c.width));
+	float total = 0.0;
+	for (int i = 0; i < c.height; i++) {
+		for (int j = 0; j < c.width; j++) {
+			c.map[i][j] = colors[rng() % palette_size];
+			float b = rng() % 8 == 0 ? 0.0f : unit(rng) * pow(10.0f, exponent(rng) / 3);
+			c.beliefs[i][j] = b;
+			total += b;
+		}
+	}
+
+	// keep at least one cell with mass, then normalize
+	if (total == 0.0) {
+		c.beliefs[0][0] = 1.0;
+		total = 1.0;
+	}
+	for (int i = 0; i < c.height; i++) {
+		for (int j = 0; j < c.width; j++) {
+			c.beliefs[i][j] /= total;
+		}
+	}
+
+	// one draw in eight senses a color that is not on the map
+	c.color = rng() % 8 == 0 ? 'z' : colors[rng() % palette_size];
+	c.p_hit = 0.05f + unit(rng) * 10.0f;
+	c.p_miss = 0.05f + unit(rng);
+	c.blurring = unit(rng);
+	c.dy = (int) (rng() % 21) - 10;
+	c.dx = (int) (rng() % 21) - 10;
+
+	// one to four channels; large palettes often exceed MAX_JOINT_CODES together
+	int channels = 1 + rng() % 4;
+	for (int k = 0; k < channels; k++) {
+		FuzzChannel channel;
+		channel.palette_size = 1 + rng() % (rng() % 2 ? 8 : 256);
+		channel.values.resize((size_t) c.height * c.width);
+		for (size_t cell = 0; cell < channel.values.size(); cell++) {
+			channel.values[cell] = rng() % channel.palette_size;
+		}
+		channel.reading = rng() % 8 == 0 ? -1 : (int) (rng() % channel.palette_size);
+		channel.p_hit = 0.05f + unit(rng) * 10.0f;
+		channel.p_miss = 0.05f + unit(rng);
+		c.channels.push_back(channel);
+	}
+	return c;
+}
+
+// Senses every channel of a case in turn with sense_kernel and its hit plane.
+vector <float> sense_channels_reference(const FuzzCase& c) {
+	vector <float> cells = flatten(c.beliefs);
+	vector <float> plane (cells.size());
+	for (size_t k = 0; k < c.channels.size(); k++) {
+		const FuzzChannel& channel = c.channels[k];
+		for (size_t cell = 0; cell < cells.size(); cell++) {
+			plane[cell] = channel.values[cell] == channel.reading ? 1.0f : 0.0f;
+		}
+		sense_kernel(&cells[0], channel.reading < 0 ? NULL : &plane[0], &cells[0], cells.size(),
+			channel.p_hit, channel.p_miss);
+	}
+	normalize_kernel(&cells[0], cells.size());
+	return cells;
+}
+
+vector <float> reference_step(const string& step, const FuzzCase& c) {
+	if (step == "sense") {
+		return flatten(sense(c.color, c.map, c.beliefs, c.p_hit, c.p_miss));
+	}
+	if (step == "move") {
+		return flatten(move(c.dy, c.dx, c.beliefs, c.blurring));
+	}
+	if (step == "blur") {
+		return flatten(blur(c.beliefs, c.blurring));
+	}
+	if (step == "channels") {
+		return sense_channels_reference(c);
+	}
+	return flatten(normalize(c.beliefs));
+}
+
+vector <float> sense_simd(const FuzzCase& c) {
+	CompiledMap map = compile_map(c.map);
+	vector <float> cells = flatten(c.beliefs);
+	int index = map.color_index(c.color);
+	sense_kernel(&cells[0], index < 0 ? NULL : map.plane(index), &cells[0], cells.size(), c.p_hit, c.p_miss);
+	normalize_kernel(&cells[0], cells.size());
+	return cells;
+}
+
+vector <float> sense_tiled_variant(const FuzzCase& c) {
+	CompiledMap map = compile_map(c.map);
+	vector <float> cells = flatten(c.beliefs);
+	vector <float> misses (cells.size(), 0.0f);
+	int index = map.color_index(c.color);
+	TiledGrid in = to_tiled(&cells[0], c.height, c.width, c.tile);
+	TiledGrid hits = to_tiled(index < 0 ? &misses[0] : map.plane(index), c.height, c.width, c.tile);
+	TiledGrid out (c.height, c.width, c.tile);
+	sense_tiled(in, hits, out, c.p_hit, c.p_miss);
+	normalize_tiled(out);
+	return to_row_major(out);
+}
+
+vector <float> blur_simd(const FuzzCase& c) {
+	vector <float> cells = flatten(c.beliefs);
+	vector <float> out (cells.size());
+	blur_kernel(&cells[0], &out[0], c.height, c.width, c.blurring);
+	normalize_kernel(&out[0], out.size());
+	return out;
+}
+
+vector <float> blur_tiled_variant(const FuzzCase& c) {
+	vector <float> cells = flatten(c.beliefs);
+	TiledGrid in = to_tiled(&cells[0], c.height, c.width, c.tile);
+	TiledGrid out (c.height, c.width, c.tile);
+	blur_tiled(in, out, c.blurring);
+	normalize_tiled(out);
+	return to_row_major(out);
+}
+
+// Motion classes with a single class must reproduce the uniform blur.
+vector <float> blur_classes_variant(const FuzzCase& c) {
+	vector <float> cells = flatten(c.beliefs);
+	vector <float> out (cells.size());
+	vector <unsigned char> classes (cells.size(), 0);
+	blur_classes_kernel(&cells[0], &out[0], c.height, c.width, &classes[0], &c.blurring);
+	normalize_kernel(&out[0], out.size());
+	return out;
+}
+
+vector <float> move_simd(const FuzzCase& c) {
+	vector <float> cells = flatten(c.beliefs);
+	vector <float> out (cells.size());
+	move_kernel(&cells[0], &out[0], c.height, c.width, c.dy, c.dx, c.blurring);
+	normalize_kernel(&out[0], out.size());
+	return out;
+}
+
+vector <float> move_streaming(const FuzzCase& c) {
+	StreamingConfig saved = streaming_config;
+	streaming_config.threshold_bytes = 0;
+	vector <float> out = move_simd(c);
+	streaming_config = saved;
+	return out;
+}
+
+// Runs a variant with every grid split across three threads.
+vector <float> threaded(vector <float> (*run)(const FuzzCase&), const FuzzCase& c) {
+	ParallelConfig saved = parallel_config;
+	parallel_config.threads = 3;
+	parallel_config.min_cells = 0;
+	vector <float> out = run(c);
+	parallel_config = saved;
+	return out;
+}
+
+vector <float> sense_threaded(const FuzzCase& c) {
+	return threaded(sense_simd, c);
+}
+
+vector <float> move_threaded(const FuzzCase& c) {
+	return threaded(move_simd, c);
+}
+
+// Loads a case into every lane of a batch.
+FilterBatch batch_of(const FuzzCase& c) {
+	FilterBatch batch (c.height, c.width);
+	for (int lane = 0; lane < BATCH_LANES; lane++) {
+		batch.set_map(lane, c.map);
+		for (int i = 0; i < c.height; i++) {
+			for (int j = 0; j < c.width; j++) {
+				batch.beliefs[((size_t) i * c.width + j) * BATCH_LANES + lane] = c.beliefs[i][j];
+			}
+		}
+	}
+	return batch;
+}
+
+vector <float> sense_batched(const FuzzCase& c) {
+	FilterBatch batch = batch_of(c);
+	char sensed[BATCH_LANES];
+	memset(sensed, c.color, sizeof(sensed));
+	batch.sense(sensed, c.p_hit, c.p_miss);
+	return flatten(batch.lane_beliefs(BATCH_LANES - 1));
+}
+
+vector <float> move_batched(const FuzzCase& c) {
+	FilterBatch batch = batch_of(c);
+	batch.move(c.dy, c.dx, c.blurring);
+	return flatten(batch.lane_beliefs(BATCH_LANES - 1));
+}
+
+// The weight of every palette entry of every channel, channel after channel.
+vector < vector <float> > channel_weight_tables(const FuzzCase& c) {
+	vector < vector <float> > tables;
+	for (size_t k = 0; k < c.channels.size(); k++) {
+		const FuzzChannel& channel = c.channels[k];
+		vector <float> weights (channel.palette_size);
+		for (int index = 0; index < channel.palette_size; index++) {
+			weights[index] = index == channel.reading ? channel.p_hit : channel.p_miss;
+		}
+		tables.push_back(weights);
+	}
+	return tables;
+}
+
+vector <float> channels_fused(const FuzzCase& c) {
+	vector <float> cells = flatten(c.beliefs);
+	vector < vector <float> > tables = channel_weight_tables(c);
+	vector <ChannelLikelihood> lookups;
+	for (size_t k = 0; k < c.channels.size(); k++) {
+		ChannelLikelihood lookup = {&c.channels[k].values[0], &tables[k][0]};
+		lookups.push_back(lookup);
+	}
+	fused_sense_kernel(&cells[0], &lookups[0], lookups.size(), &cells[0], cells.size());
+	normalize_kernel(&cells[0], cells.size());
+	return cells;
+}
+
+// Joint codes when the channels fit in MAX_JOINT_CODES, else the fused kernel, as the filter does.
+vector <float> channels_joint(const FuzzCase& c) {
+	vector <const unsigned char*> values;
+	vector <int> sizes;
+	for (size_t k = 0; k < c.channels.size(); k++) {
+		values.push_back(&c.channels[k].values[0]);
+		sizes.push_back(c.channels[k].palette_size);
+	}
+	JointCodes joint;
+	vector <float> cells = flatten(c.beliefs);
+	if (!build_joint_codes(values, sizes, cells.size(), joint)) {
+		return channels_fused(c);
+	}
+
+	vector < vector <float> > tables = channel_weight_tables(c);
+	vector <const float*> weights;
+	for (size_t k = 0; k < tables.size(); k++) {
+		weights.push_back(&tables[k][0]);
+	}
+	vector <float> table (joint.size);
+	joint_weights(joint, sizes, weights, &table[0]);
+	joint_sense_kernel(&cells[0], &joint.codes[0], &table[0], &cells[0], cells.size());
+	normalize_kernel(&cells[0], cells.size());
+	return cells;
+}
+
+vector <float> channels_threaded(const FuzzCase& c) {
+	return threaded(channels_joint, c);
+}
+
+vector <float> normalize_simd(const FuzzCase& c) {
+	vector <float> cells = flatten(c.beliefs);
+	normalize_kernel(&cells[0], cells.size());
+	return cells;
+}
+
+vector <KernelVariant> kernel_variants() {
+	KernelVariant variants[] = {
+		{"sense/simd", "sense", sense_simd},
+		{"sense/tiled", "sense", sense_tiled_variant},
+		{"sense/batched", "sense", sense_batched},
+		{"sense/threaded", "sense", sense_threaded},
+		{"blur/simd", "blur", blur_simd},
+		{"blur/tiled", "blur", blur_tiled_variant},
+		{"blur/classes", "blur", blur_classes_variant},
+		{"move/simd", "move", move_simd},
+		{"move/streaming", "move", move_streaming},
+		{"move/batched", "move", move_batched},
+		{"move/threaded", "move", move_threaded},
+		{"normalize/simd", "normalize", normalize_simd},
+		{"channels/fused", "channels", channels_fused},
+		{"channels/joint", "channels", channels_joint},
+		{"channels/threaded", "channels", channels_threaded},
+	};
+	return vector <KernelVariant> (variants, variants + sizeof(variants) / sizeof(variants[0]));
+}
+
+long long ulp_distance(float a, float b) {
+	if (a == b) {
+		return 0;
+	}
+	if (std::isnan(a) || std::isnan(b)) {
+		return 1LL << 32;
+	}
+
+	// map the float bit patterns onto a monotonic integer line
+	int32_t ia, ib;
+	memcpy(&ia, &a, sizeof(float));
+	memcpy(&ib, &b, sizeof(float));
+	long long la = ia < 0 ? (long long) INT32_MIN - ia : ia;
+	long long lb = ib < 0 ? (long long) INT32_MIN - ib : ib;
+	return la > lb ? la - lb : lb - la;
+}
+
+/**
+    Runs every variant against the reference.
+
+    @param cases - how many random cases to draw.
+
+    @param seed - the random seed; the same seed replays the same cases.
+
+    @param max_size - the largest height or width to draw.
+
+    @return - the worst errors of each variant. Relative errors are
+    	   only counted where the reference is at least 1e-30, so that
+    	   values that underflow do not dominate.
+*/
+vector <ErrorStats> run_differential(int cases, unsigned seed, int max_size) {
+	mt19937 rng (seed);
+	vector <KernelVariant> variants = kernel_variants();
+	vector <ErrorStats> report;
+	for (size_t v = 0; v < variants.size(); v++) {
+		ErrorStats stats = {variants[v].name, 0, 0.0, 0.0, 0};
+		report.push_back(stats);
+	}
+
+	for (int n = 0; n < cases; n++) {
+		FuzzCase c = random_case(rng, max_size);
+		for (size_t v = 0; v < variants.size(); v++) {
+			vector <float> expected = reference_step(variants[v].step, c);
+			vector <float> actual = variants[v].run(c);
+			ErrorStats& stats = report[v];
+			stats.cases++;
+
+			if (actual.size() != expected.size()) {
+				stats.max_abs = stats.max_rel = INFINITY;
+				stats.max_ulp = 1LL << 32;
+				continue;
+			}
+			for (size_t k = 0; k < expected.size(); k++) {
+				double abs_err = fabs((double) actual[k] - expected[k]);
+				if (std::isnan(actual[k]) != std::isnan(expected[k])) {
+					abs_err = INFINITY;
+				}
+				stats.max_abs = max(stats.max_abs, abs_err);
+				if (fabs(expected[k]) >= 1e-30) {
+					stats.max_rel = max(stats.max_rel, abs_err / fabs(expected[k]));
+				}
+				stats.max_ulp = max(stats.max_ulp, ulp_distance(actual[k], expected[k]));
+			}
+		}
+	}
+	return report;
+}
+
+void show_report(const vector <ErrorStats>& report) {
+	cout << "variant\tcases\tmax abs\tmax rel\tmax ulp" << endl;
+	for (size_t v = 0; v < report.size(); v++) {
+		cout << report[v].name << "\t" << report[v].cases << "\t"
+			<< report[v].max_abs << "\t" << report[v].max_rel << "\t"
+			<< report[v].max_ulp << endl;
+	}
+}
@@ -0,0 +1,76 @@
+#ifndef DIFFERENTIAL_H
+#define DIFFERENTIAL_H
+
+#include <vector>
+#include <string>
+#include <random>
+
+/**
+	One extra map channel of a case: the palette index of every
+	cell, and the palette index read (-1 for a value not on it)
+	with the channel's sensor model.
+*/
+struct FuzzChannel {
+	int palette_size;
+	std::vector <unsigned char> values;
+	int reading;
+	float p_hit, p_miss;
+};
+
+/**
+	One randomized filter step: a map drawn from a random palette,
+	random beliefs and random sense / motion parameters, and a few
+	extra channels for multi-channel sensing.
+*/
+struct FuzzCase {
+	int height, width, tile;
+	std::vector < std::vector <char> > map;
+	std::vector < std::vector <float> > beliefs;
+	char color;
+	float p_hit, p_miss, blurring;
+	int dy, dx;
+	std::vector <FuzzChannel> channels;
+};
+
+// An optimized implementation of one filter step.
+struct KernelVariant {
+	std::string name;
+
+	// "sense", "move", "blur", "normalize" or "channels" (sensing every channel of the case)
+	std::string step;
+
+	// Runs the step on a case and returns the flat normalized beliefs.
+	std::vector <float> (*run)(const FuzzCase&);
+};
+
+// Worst-case disagreement of one variant with the reference.
+struct ErrorStats {
+	std::string name;
+	int cases;
+	double max_abs;
+	double max_rel;
+	long long max_ulp;
+};
+
+// Draws a random case with dimensions up to max_size.
+FuzzCase random_case(std::mt19937& rng, int max_size);
+
+// Runs the reference implementation (helpers.cpp / localizer.cpp) of a step.
+std::vector <float> reference_step(const std::string& step, const FuzzCase& c);
+
+// Returns every optimized variant in the tree.
+std::vector <KernelVariant> kernel_variants();
+
+// Returns the distance in units in the last place between two floats.
+long long ulp_distance(float a, float b);
+
+/**
+    Runs every variant against the reference on random cases and
+    returns one ErrorStats per variant.
+*/
+std::vector <ErrorStats> run_differential(int cases, unsigned seed, int max_size);
+
+// Prints a table of ErrorStats.
+void show_report(const std::vector <ErrorStats>& report);
+
+#endif /* DIFFERENTIAL_H */
@@ -0,0 +1,80 @@
+/**
+	embed_map.cpp
+
+	Purpose: generates a header that compiles a map into the binary.
+
+		embed_map maps/m1.txt m1 > embedded_m1.h
+
+	The header defines the constexpr EmbeddedMap m1_embedded (see
+	embedded_map.h), with the palette, color indices and per-color
+	hit planes precomputed by compile_map. Regenerate it whenever
+	the map file changes.
+*/
+
+#include <iostream>
+#include <cstdio>
+#include <cctype>
+#include "localizer.cpp"
+
+using namespace std;
+
+// Prints count values as the body of a C array, 16 per line.
+template <typename T>
+void print_values(const T* values, size_t count) {
+	for (size_t k = 0; k < count; k++) {
+		cout << (k % 16 == 0 ? "\t" : " ") << (int) values[k] << ",";
+		if (k % 16 == 15 || k + 1 == count) {
+			cout << "\n";
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		cerr << "usage: embed_map <map file> <name>" << endl;
+		return 2;
+	}
+	string file_name = argv[1];
+	string name = argv[2];
+
+	uint64_t hash;
+	CompiledMap map = compile_map(read_map(file_name));
+	if (!file_content_hash(file_name, hash) || map.palette.empty()) {
+		cerr << "embed_map: cannot read a map from " << file_name << endl;
+		return 1;
+	}
+
+	string guard = "EMBEDDED_" + name + "_H";
+	for (size_t k = 0; k < guard.size(); k++) {
+		guard[k] = isalnum((unsigned char) guard[k]) ? toupper((unsigned char) guard[k]) : '_';
+	}
+	size_t area = (size_t) map.height * map.width;
+	char hash_text[32];
+	snprintf(hash_text, sizeof(hash_text), "0x%016llxULL", (unsigned long long) hash);
+
+	cout << "// Generated by embed_map from " << file_name << ". Do not edit.\n\n";
+	cout << "#ifndef " << guard << "\n#define " << guard << "\n\n";
+	cout << "#include \"embedded_map.h\"\n\n";
+
+	cout << "constexpr char " << name << "_palette[] = {";
+	for (size_t k = 0; k < map.palette.size(); k++) {
+		char color = map.palette[k];
+		cout << (k == 0 ? "" : ", ") << "'" << (color == '\'' || color == '\\' ? "\\" : "") << color << "'";
+	}
+	cout << "};\n\n";
+
+	cout << "constexpr unsigned char " << name << "_colors[] = {\n";
+	print_values(&map.colors[0], area);
+	cout << "};\n\n";
+
+	cout << "alignas(64) constexpr float " << name << "_planes[] = {\n";
+	print_values(map.plane(0), map.palette.size() * area);
+	cout << "};\n\n";
+
+	cout << "constexpr EmbeddedMap " << name << "_embedded = {\n\t"
+		<< map.height << ", " << map.width << ", " << map.palette.size() << ",\n\t"
+		<< name << "_palette, " << name << "_colors, " << name << "_planes,\n\t"
+		<< hash_text << "\n};\n\n";
+	cout << "#endif /* " << guard << " */\n";
+	return 0;
+}
@@ -0,0 +1,25 @@
+// Generated by embed_map from maps/m1.txt. Do not edit.
+
+#ifndef EMBEDDED_M1_H
+#define EMBEDDED_M1_H
+
+#include "embedded_map.h"
+
+constexpr char m1_palette[] = {'r', 'g'};
+
+constexpr unsigned char m1_colors[] = {
+	0, 0, 0, 0, 1, 0, 0, 0, 0,
+};
+
+alignas(64) constexpr float m1_planes[] = {
+	1, 1, 1, 1, 0, 1, 1, 1, 1, 0, 0, 0, 0, 1, 0, 0,
+	0, 0,
+};
+
+constexpr EmbeddedMap m1_embedded = {
+	3, 3, 2,
+	m1_palette, m1_colors, m1_planes,
+	0x79c45234f39674ccULL
+};
+
+#endif /* EMBEDDED_M1_H */
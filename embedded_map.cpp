@@ -0,0 +1,24 @@
+/**
+	embedded_map.cpp
+
+	Purpose: attaches maps compiled into the binary by embed_map,
+	for units that ship a fixed map and should start with no I/O
+	and no map preprocessing.
+*/
+
+#include <memory>
+#include "embedded_map.h"
+
+using namespace std;
+
+CompiledMap attach_embedded_map(const EmbeddedMap& embedded) {
+	CompiledMap map;
+	map.height = embedded.height;
+	map.width = embedded.width;
+	map.palette.assign(embedded.palette, embedded.palette + embedded.palette_size);
+	map.colors.assign(embedded.colors, embedded.colors + (size_t) embedded.height * embedded.width);
+
+	// the planes are static storage: share them without an owner
+	map.shared_planes = shared_ptr <const float> (shared_ptr <const float> (), embedded.planes);
+	return map;
+}
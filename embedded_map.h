@@ -0,0 +1,30 @@
+#ifndef EMBEDDED_MAP_H
+#define EMBEDDED_MAP_H
+
+#include <stdint.h>
+#include "compiled_map.h"
+
+/**
+	A compiled map baked into the binary by embed_map (see
+	embed_map.cpp): the same palette, color indices and row-major
+	hit planes as a CompiledMap, as constexpr arrays. source_hash is
+	the FNV-1a hash of the map file it was generated from, so a stale
+	header can be detected (see file_content_hash in map_cache.h).
+*/
+struct EmbeddedMap {
+	int height;
+	int width;
+	int palette_size;
+	const char* palette;
+	const unsigned char* colors;
+	const float* planes;
+	uint64_t source_hash;
+};
+
+/**
+    Returns a CompiledMap over an embedded map. The planes are used
+    in place, without copying or any file I/O.
+*/
+CompiledMap attach_embedded_map(const EmbeddedMap& embedded);
+
+#endif /* EMBEDDED_MAP_H */
@@ -0,0 +1,35 @@
+/**
+	fuzz.cpp
+
+	Purpose: command line driver for the differential harness.
+
+		fuzz [cases] [seed] [max size]
+
+	Prints the worst errors of every optimized variant against the
+	reference functions and exits with status 1 when any variant
+	exceeds the absolute tolerance used by close_enough.
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include "localizer.cpp"
+#include "differential.cpp"
+
+using namespace std;
+
+int main(int argc, char** argv) {
+	int cases = argc > 1 ? atoi(argv[1]) : 1000;
+	unsigned seed = argc > 2 ? (unsigned) atol(argv[2]) : 1;
+	int max_size = argc > 3 ? atoi(argv[3]) : 96;
+
+	vector <ErrorStats> report = run_differential(cases, seed, max_size);
+	show_report(report);
+
+	for (size_t v = 0; v < report.size(); v++) {
+		if (!(report[v].max_abs <= 0.0001)) {
+			cout << "X - " << report[v].name << " exceeds the tolerance" << endl;
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -47,7 +47,7 @@ vector< vector<float> > normalize(vector< vector <float> > grid) {
 	// populate the newGrid with the normalized values from grid
 	// by dividing the grid cells by the grid_total:
 	for (int row = 0; row < grid.size(); row++) {
-		for (int cell = 0; cell < grid.size(); cell++) {
+		for (int cell = 0; cell < grid[0].size(); cell++) {
 			newGrid[row][cell] = grid[row][cell] / grid_total;
 		}
 	}
@@ -215,6 +215,11 @@ vector <char> read_line(string s) {
 		row.push_back(cell);
 	}
 
+	// the last cell of a line need not be followed by a delimiter
+	if (!s.empty()) {
+		row.push_back(s.at(0));
+	}
+
 	return row;
 }
 
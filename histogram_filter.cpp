@@ -0,0 +1,749 @@
+/**
+	histogram_filter.cpp
+
+	Purpose: a stateful histogram filter over the flat kernels,
+	with an optional summed-area table for region queries,
+	optional multi-hypothesis tracking and hot map reload.
+*/
+
+#include <vector>
+#include <string>
+#include <string.h>
+#include <algorithm>
+#include "histogram_filter.h"
+#include "kernels.h"
+#include "helpers.h"
+
+using namespace std;
+
+HistogramFilter::HistogramFilter(const vector < vector <char> >& grid,
+	float p_hit, float p_miss, float blurring) :
+	p_hit(p_hit), p_miss(p_miss), blurring(blurring), keep_summed_area(false), hypothesis_threshold(0.0), publisher(NULL),
+	reloader(NULL), health_checks(false), health_floor(0.0), metrics(), joint(), joint_stale(true)
+{
+	map = compile_map(grid);
+	start_uniform();
+}
+
+HistogramFilter::HistogramFilter(const CompiledMap& compiled, float p_hit, float p_miss, float blurring) :
+	map(compiled), p_hit(p_hit), p_miss(p_miss), blurring(blurring), keep_summed_area(false), hypothesis_threshold(0.0),
+	publisher(NULL), reloader(NULL), health_checks(false), health_floor(0.0), metrics(), joint(), joint_stale(true)
+{
+	start_uniform();
+}
+
+HistogramFilter::HistogramFilter(string map_file_name, float p_hit, float p_miss, float blurring,
+	bool cached) :
+	p_hit(p_hit), p_miss(p_miss), blurring(blurring), keep_summed_area(false), hypothesis_threshold(0.0), publisher(NULL),
+	reloader(NULL), health_checks(false), health_floor(0.0), metrics(), joint(), joint_stale(true)
+{
+	map = cached ? load_compiled_map(map_file_name) : compile_map(read_map(map_file_name));
+	start_uniform();
+	zones = read_zones(zones_file_for(map_file_name));
+}
+
+// Starts from a uniform belief over the map.
+void HistogramFilter::start_uniform() {
+	int area = map.height * map.width;
+	current.assign(area, 1.0f / area);
+	scratch.assign(area, 0.0f);
+	parked_as = DENSE_BELIEFS;
+	parked_cutoff = 0.0;
+	vector <int> ().swap(parked_cells);
+	vector <float> ().swap(parked_values);
+	vector <unsigned short> ().swap(parked_compact);
+	tracker.resize(map.height, map.width);
+}
+
+/**
+    Returns the latest beliefs, which every step reads. Once published
+    they belong to an immutable version, so steps write to current
+    and never modify their input in place.
+*/
+const float* HistogramFilter::source() const {
+	if (publisher != NULL && publisher->latest() != NULL) {
+		return &publisher->latest()->cells[0];
+	}
+	restore();
+	return &current[0];
+}
+
+void HistogramFilter::sense(char color) {
+	poll_reloader();
+	if (steps_sparse() && sense_sparse(map.color_index(color))) {
+		return;
+	}
+	restore();
+	int index = map.color_index(color);
+	const float* plane = index < 0 ? NULL : map.plane(index);
+	sense_kernel(source(), plane, &current[0], current.size(), p_hit, p_miss);
+	finish_step();
+}
+
+// Lists the palette indices and palette size of every channel, the map's colors first.
+void HistogramFilter::describe_channels() {
+	channel_values.clear();
+	channel_sizes.clear();
+	channel_values.push_back(&map.colors[0]);
+	channel_sizes.push_back(map.palette.size());
+	for (size_t k = 0; k < channels.size(); k++) {
+		channel_values.push_back(&channels[k].values[0]);
+		channel_sizes.push_back(channels[k].palette.size());
+	}
+}
+
+/**
+    Senses several channels at once. Channel 0 is the map's colors
+    with the filter's p_hit and p_miss. Each channel gets one weight
+    per palette entry, the product of its readings (1 when it is not
+    read), and the cells are weighed through the joint codes of all
+    channels, built on first use. When the channels have too many
+    value combinations for joint codes, only the channels read are
+    looked up, by the fused kernel. The tables are kept between
+    steps, so later steps allocate nothing.
+
+    @param readings - the values seen, one per channel read; reading
+    	   a channel twice applies both readings.
+
+    @return - false when a reading's channel does not exist.
+*/
+bool HistogramFilter::sense(const vector <ChannelReading>& readings) {
+	poll_reloader();
+	for (size_t r = 0; r < readings.size(); r++) {
+		if (readings[r].channel < 0 || readings[r].channel > (int) channels.size()) {
+			return false;
+		}
+	}
+	restore();
+	describe_channels();
+
+	size_t table_size = 0;
+	for (size_t c = 0; c < channel_sizes.size(); c++) {
+		table_size += channel_sizes[c];
+	}
+	reading_weights.assign(table_size, 1.0f);
+	channel_weight_tables.resize(channel_sizes.size());
+	for (size_t c = 0, offset = 0; c < channel_sizes.size(); offset += channel_sizes[c], c++) {
+		channel_weight_tables[c] = &reading_weights[offset];
+	}
+	for (size_t r = 0; r < readings.size(); r++) {
+		int channel = readings[r].channel;
+		size_t offset = 0;
+		for (int c = 0; c < channel; c++) {
+			offset += channel_sizes[c];
+		}
+		float* weights = &reading_weights[offset];
+		if (channel == 0) {
+			channel_weights(map.palette, readings[r].value, p_hit, p_miss, weights);
+		}
+		else {
+			const MapChannel& layer = channels[channel - 1];
+			channel_weights(layer.palette, readings[r].value, layer.p_hit, layer.p_miss, weights);
+		}
+	}
+
+	if (joint_stale) {
+		joint.size = 0;
+		vector <unsigned short> ().swap(joint.codes);
+		build_joint_codes(channel_values, channel_sizes, current.size(), joint);
+		joint_stale = false;
+	}
+	if (joint.size > 0) {
+		joint_table.resize(joint.size);
+		joint_weights(joint, channel_sizes, channel_weight_tables, &joint_table[0]);
+		joint_sense_kernel(source(), &joint.codes[0], &joint_table[0], &current[0], current.size());
+	}
+	else {
+		lookups.clear();
+		for (size_t c = 0; c < channel_sizes.size(); c++) {
+			bool read = false;
+			for (size_t r = 0; r < readings.size(); r++) {
+				read = read || readings[r].channel == (int) c;
+			}
+			if (read) {
+				ChannelLikelihood lookup = {channel_values[c], channel_weight_tables[c]};
+				lookups.push_back(lookup);
+			}
+		}
+		fused_sense_kernel(source(), lookups.empty() ? NULL : &lookups[0], lookups.size(),
+			&current[0], current.size());
+	}
+	finish_step();
+	return true;
+}
+
+int HistogramFilter::add_channel(const MapChannel& channel) {
+	if (channel.height != map.height || channel.width != map.width) {
+		return -1;
+	}
+	channels.push_back(channel);
+	joint_stale = true;
+	return channels.size();
+}
+
+int HistogramFilter::channel_index(const string& name) const {
+	for (size_t k = 0; k < channels.size(); k++) {
+		if (channels[k].name == name) {
+			return k + 1;
+		}
+	}
+	return -1;
+}
+
+/**
+    Moves the beliefs. With motion classes on the map, the shifted
+    beliefs are blurred with the window of the cell they land on;
+    otherwise the uniform blurring value is used.
+*/
+void HistogramFilter::move(int dy, int dx) {
+	poll_reloader();
+	if (steps_sparse() && map.motion_classes.empty()) {
+		move_sparse(dy, dx);
+		return;
+	}
+	restore();
+	if (scratch.size() != current.size()) {
+		scratch.assign(current.size(), 0.0f);
+	}
+	if (!map.motion_classes.empty()) {
+		shift_kernel(source(), &scratch[0], map.height, map.width, dy, dx);
+		blur_classes_kernel(&scratch[0], &current[0], map.height, map.width,
+			&map.motion_classes[0], &map.class_blurring[0]);
+	}
+	else {
+		move_kernel(source(), &scratch[0], map.height, map.width, dy, dx, blurring);
+		current.swap(scratch);
+	}
+	finish_step();
+}
+
+/**
+    Normalizes the new beliefs in current. The summed-area table and
+    the active set for hypotheses are built in the same pass when
+    enabled. With a publisher the result is then published, and
+    current receives a recycled buffer for the next step.
+*/
+void HistogramFilter::finish_step() {
+	HealthCounts counts = HealthCounts();
+	HealthCounts* health = health_checks ? &counts : NULL;
+	vector <int>* active = NULL;
+	if (hypothesis_threshold > 0.0) {
+		tracker.active.clear();
+		active = &tracker.active;
+	}
+
+	// cells are floored within the pass, before they enter the table or the active set
+	if (keep_summed_area) {
+		normalize_with_summed_area(&current[0], map.height, map.width, summed_area,
+			active, hypothesis_threshold, health, health_floor);
+	}
+	else if (active != NULL) {
+		normalize_and_collect(&current[0], current.size(), hypothesis_threshold, *active,
+			health, health_floor);
+	}
+	else if (health_checks) {
+		normalize_and_scan(&current[0], current.size(), health_floor, counts);
+	}
+	else {
+		normalize_kernel(&current[0], current.size());
+	}
+
+	// lost beliefs restart from uniform, which is finished like any other step
+	if (health_checks && check_health(counts)) {
+		finish_step();
+		return;
+	}
+
+	if (publisher != NULL) {
+		publisher->publish(current, map.height, map.width);
+	}
+}
+
+/**
+    Records the health of the new beliefs and resets lost beliefs to
+    uniform. Cells below the floor were already raised to it by the
+    normalize pass (the mass this adds, at most area * floor, is far
+    below float resolution for the default floor).
+
+    @param counts - the counts taken during normalization.
+
+    @return - true when the beliefs were reset and must be finished
+    	   again.
+*/
+bool HistogramFilter::check_health(const HealthCounts& counts) {
+	int area = current.size();
+	metrics.passes++;
+	metrics.last = counts;
+	metrics.total.add(counts);
+
+	if (counts.nans > 0 || counts.infinities > 0 || counts.zeros == area) {
+		fill(current.begin(), current.end(), 1.0f / area);
+		metrics.resets++;
+		return true;
+	}
+	metrics.floored += counts.tiny;
+	return false;
+}
+
+void HistogramFilter::set_health_checks(bool enabled, float floor) {
+	health_checks = enabled;
+	health_floor = floor;
+}
+
+const HealthMetrics& HistogramFilter::health() const {
+	return metrics;
+}
+
+/**
+    Reruns finish_step on the latest beliefs after an option changed.
+    Published beliefs are immutable, so they are copied back first;
+    this happens on configuration calls only, never on a step.
+*/
+void HistogramFilter::refresh() {
+	const float* latest = source();
+	if (latest != &current[0]) {
+		memcpy(&current[0], latest, current.size() * sizeof(float));
+	}
+	finish_step();
+}
+
+bool HistogramFilter::set_beliefs(const float* cells, int height, int width) {
+	if (height != map.height || width != map.width) {
+		return false;
+	}
+	restore();
+	memcpy(&current[0], cells, current.size() * sizeof(float));
+	finish_step();
+	return true;
+}
+
+const float* HistogramFilter::beliefs() const {
+	return source();
+}
+
+vector < vector <float> > HistogramFilter::belief_grid() const {
+	const float* latest = source();
+	return unflatten(vector <float> (latest, latest + current.size()), map.height, map.width);
+}
+
+/**
+    Turns the summed-area table on or off. Turning it on builds the
+    table for the current beliefs right away.
+*/
+void HistogramFilter::set_summed_area(bool enabled) {
+	keep_summed_area = enabled;
+	if (enabled) {
+		refresh();
+	}
+	else {
+		summed_area.sums.clear();
+	}
+}
+
+/**
+    Mass of a cyclic rectangle of the current beliefs. O(1) with the
+    summed-area table on; otherwise the rectangle is scanned.
+*/
+// Both paths clamp the region to the map the same way (see clamp_region).
+double HistogramFilter::region_mass(int top, int left, int rows, int cols) const {
+	clamp_region(rows, cols, map.height, map.width);
+	if (keep_summed_area) {
+		return summed_area.region(top, left, rows, cols);
+	}
+
+	double mass = 0.0;
+	for (int r = 0; r < rows; r++) {
+		int i = (((top + r) % map.height) + map.height) % map.height;
+		for (int c = 0; c < cols; c++) {
+			int j = (((left + c) % map.width) + map.width) % map.width;
+			mass += source()[(size_t) i * map.width + j];
+		}
+	}
+	return mass;
+}
+
+double HistogramFilter::zone_mass(string name) const {
+	std::map <string, Zone>::const_iterator found = zones.find(name);
+	if (found == zones.end()) {
+		return -1.0;
+	}
+	const Zone& zone = found->second;
+	return region_mass(zone.top, zone.left, zone.rows, zone.cols);
+}
+
+/**
+    Sets the threshold for hypothesis tracking and collects the
+    active set of the current beliefs right away.
+
+    @param threshold - cells with a belief above this value take
+    	   part in clustering; 0 turns tracking off.
+*/
+void HistogramFilter::set_hypothesis_threshold(float threshold) {
+	hypothesis_threshold = threshold;
+	refresh();
+}
+
+/**
+    Clusters the active set collected by the last step.
+
+    @return - the heaviest modes, heaviest first; empty when
+    	   hypothesis tracking is off.
+*/
+vector <Hypothesis> HistogramFilter::hypotheses(int max_count) {
+	if (hypothesis_threshold <= 0.0) {
+		return vector <Hypothesis> ();
+	}
+	return tracker.hypotheses(source(), max_count);
+}
+
+vector <ActionScore> HistogramFilter::evaluate_actions(const vector <CandidateAction>& actions) const {
+	return ::evaluate_actions(source(), map, actions, p_hit, p_miss, blurring);
+}
+
+/**
+    Starts or stops publishing. The current beliefs are published
+    right away so readers never see an empty publisher.
+*/
+void HistogramFilter::set_publisher(SnapshotPublisher* publisher) {
+	restore();
+	if (publisher == NULL && this->publisher != NULL && this->publisher->latest() != NULL) {
+		memcpy(&current[0], source(), current.size() * sizeof(float));
+	}
+	this->publisher = publisher;
+	if (publisher != NULL) {
+		publisher->publish(current, map.height, map.width);
+	}
+}
+
+void HistogramFilter::set_reloader(MapReloader* reloader) {
+	this->reloader = reloader;
+}
+
+// Installs a map the reloader finished since the last step, if any.
+void HistogramFilter::poll_reloader() {
+	if (reloader == NULL) {
+		return;
+	}
+	CompiledMap* compiled = reloader->take();
+	if (compiled != NULL) {
+		install_map(*compiled);
+		delete compiled;
+	}
+}
+
+/**
+    Swaps in a new map between steps. The compiled map is moved
+    from, not copied.
+
+    @param compiled - the new map; left in a valid but unspecified
+    	   state.
+*/
+void HistogramFilter::install_map(CompiledMap& compiled) {
+	bool same_size = compiled.height == map.height && compiled.width == map.width;
+	joint_stale = true;
+	if (same_size && compiled.motion_classes.empty()) {
+		compiled.motion_classes.swap(map.motion_classes);
+		compiled.class_blurring.swap(map.class_blurring);
+	}
+	map = std::move(compiled);
+	if (same_size) {
+		return;
+	}
+
+	// a new shape: start over from uniform, publishing the new grid
+	channels.clear();
+	start_uniform();
+	finish_step();
+}
+
+/**
+    Repaints cells of the map. The joint codes of the edited cells
+    are recomputed in place unless a new color grew the palette,
+    which renumbers every code; they are then rebuilt on next use.
+*/
+bool HistogramFilter::edit_map(const vector <MapEdit>& edits) {
+	size_t palette_size = map.palette.size();
+	if (!map.apply_edits(edits)) {
+		return false;
+	}
+	if (joint.size == 0 || map.palette.size() != palette_size) {
+		joint_stale = true;
+		return true;
+	}
+	describe_channels();
+	for (size_t e = 0; e < edits.size(); e++) {
+		size_t cell = (size_t) edits[e].row * map.width + edits[e].col;
+		joint.codes[cell] = joint_code(joint, channel_values, cell);
+	}
+	return true;
+}
+
+RealtimeStatus HistogramFilter::enter_realtime(const RealtimeConfig& config) {
+	RealtimeStatus status = ::enter_realtime(config);
+	restore();
+	if (scratch.size() != current.size()) {
+		scratch.assign(current.size(), 0.0f);
+	}
+
+	// the warm-up move only writes scratch; it sizes the row buffers of the threads it uses
+	move_kernel(source(), &scratch[0], map.height, map.width, 0, 1, blurring);
+
+	size_t area = (size_t) map.height * map.width;
+	prefault(source(), area * sizeof(float));
+	prefault(&current[0], area * sizeof(float));
+	prefault(&scratch[0], area * sizeof(float));
+	prefault(map.plane(0), map.palette.size() * area * sizeof(float));
+	prefault(&map.colors[0], map.colors.size());
+	if (!map.motion_classes.empty()) {
+		prefault(&map.motion_classes[0], map.motion_classes.size());
+	}
+	if (!summed_area.sums.empty()) {
+		prefault(&summed_area.sums[0], summed_area.sums.size() * sizeof(double));
+	}
+	return status;
+}
+
+size_t FilterMemory::total() const {
+	return beliefs + scratch + map + tables;
+}
+
+FilterMemory HistogramFilter::memory_usage() const {
+	FilterMemory usage;
+	usage.beliefs = current.capacity() * sizeof(float) + parked_cells.capacity() * sizeof(int)
+		+ parked_values.capacity() * sizeof(float) + parked_compact.capacity() * sizeof(unsigned short);
+	usage.scratch = (scratch.capacity() + row_sums.capacity() + moved_values.capacity()) * sizeof(float)
+		+ (row_starts.capacity() + moved_cells.capacity()) * sizeof(int);
+	usage.map = map.planes.capacity() * sizeof(float) + map.colors.capacity() + map.palette.capacity()
+		+ map.motion_classes.capacity() + map.class_blurring.capacity() * sizeof(float);
+	for (size_t k = 0; k < channels.size(); k++) {
+		usage.map += channels[k].values.capacity() + channels[k].palette.capacity();
+	}
+	usage.map += joint.codes.capacity() * sizeof(unsigned short);
+	usage.tables = summed_area.sums.capacity() * sizeof(double) + tracker.memory_bytes()
+		+ (reading_weights.capacity() + joint_table.capacity()) * sizeof(float);
+	return usage;
+}
+
+void HistogramFilter::release_scratch() {
+	vector <float> ().swap(scratch);
+	vector <int> ().swap(row_starts);
+	vector <float> ().swap(row_sums);
+	vector <int> ().swap(moved_cells);
+	vector <float> ().swap(moved_values);
+}
+
+/**
+    Parks the beliefs sparsely. Converged filters hold nearly all of
+    their mass in a few cells, so this frees most of their memory for
+    a loss of at most the mass below cutoff.
+
+    @param cutoff - cells at or below this belief are dropped; they
+    	   come back as zero when the filter is next used.
+
+    @return - true when the beliefs are parked sparsely.
+*/
+bool HistogramFilter::park_sparse(float cutoff) {
+	if (parked_as != DENSE_BELIEFS) {
+		return parked_as == SPARSE_BELIEFS;
+	}
+	if (publisher != NULL) {
+		return false;
+	}
+
+	size_t kept = 0;
+	for (size_t k = 0; k < current.size(); k++) {
+		kept += current[k] > cutoff;
+	}
+	if (2 * kept * (sizeof(int) + sizeof(float)) > current.size() * sizeof(float)) {
+		return false;
+	}
+
+	parked_cells.reserve(kept);
+	parked_values.reserve(kept);
+	for (size_t k = 0; k < current.size(); k++) {
+		if (current[k] > cutoff) {
+			parked_cells.push_back(k);
+			parked_values.push_back(current[k]);
+		}
+	}
+	vector <float> ().swap(current);
+	parked_as = SPARSE_BELIEFS;
+	parked_cutoff = cutoff;
+	return true;
+}
+
+bool HistogramFilter::park_compact() {
+	if (parked_as != DENSE_BELIEFS) {
+		return parked_as == COMPACT_BELIEFS;
+	}
+	if (publisher != NULL) {
+		return false;
+	}
+
+	// round to nearest even on the upper 16 bits
+	parked_compact.resize(current.size());
+	for (size_t k = 0; k < current.size(); k++) {
+		uint32_t bits;
+		memcpy(&bits, &current[k], sizeof(bits));
+		parked_compact[k] = (unsigned short) ((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+	}
+	vector <float> ().swap(current);
+	parked_as = COMPACT_BELIEFS;
+	return true;
+}
+
+BeliefStorage HistogramFilter::storage() const {
+	return parked_as;
+}
+
+/**
+    True when a step can run on sparsely parked beliefs, i.e. nothing
+    that needs the dense grid after every step is enabled.
+*/
+bool HistogramFilter::steps_sparse() const {
+	return parked_as == SPARSE_BELIEFS && publisher == NULL && !keep_summed_area
+		&& hypothesis_threshold <= 0.0 && !health_checks;
+}
+
+// Drops parked cells at or below the cutoff, unless that would drop them all.
+void HistogramFilter::prune_sparse() {
+	size_t kept = 0;
+	for (size_t k = 0; k < parked_values.size(); k++) {
+		kept += parked_values[k] > parked_cutoff;
+	}
+	if (kept == 0 || kept == parked_values.size()) {
+		return;
+	}
+	kept = 0;
+	for (size_t k = 0; k < parked_values.size(); k++) {
+		if (parked_values[k] > parked_cutoff) {
+			parked_cells[kept] = parked_cells[k];
+			parked_values[kept] = parked_values[k];
+			kept++;
+		}
+	}
+	parked_cells.resize(kept);
+	parked_values.resize(kept);
+}
+
+/**
+    Sensing update of sparsely parked beliefs. Cells that are not
+    kept are zero and stay zero, so only the kept cells are weighed.
+
+    @param index - the palette index of the sensed color, or -1.
+
+    @return - false, changing nothing, when every kept cell would
+    	   become zero; the dense step then handles it.
+*/
+bool HistogramFilter::sense_sparse(int index) {
+	double total = 0.0;
+	for (size_t k = 0; k < parked_cells.size(); k++) {
+		total += parked_values[k] * (map.colors[parked_cells[k]] == index ? p_hit : p_miss);
+	}
+	if (total <= 0.0) {
+		return false;
+	}
+	float scale = 1.0 / total;
+	for (size_t k = 0; k < parked_cells.size(); k++) {
+		parked_values[k] *= (map.colors[parked_cells[k]] == index ? p_hit : p_miss) * scale;
+	}
+	prune_sparse();
+	return true;
+}
+
+/**
+    Motion update of sparsely parked beliefs. The kept cells are in
+    row-major order, so each output row is summed in a one-row buffer
+    from the (at most three) input rows its blur window reaches, and
+    rows no kept cell reaches are skipped. When the support grows
+    past what parking saves, the result becomes the dense grid again.
+*/
+void HistogramFilter::move_sparse(int dy, int dx) {
+	BlurWeights w = blur_weights(blurring);
+	int height = map.height, width = map.width;
+
+	row_starts.assign(height + 1, 0);
+	for (size_t k = 0; k < parked_cells.size(); k++) {
+		row_starts[parked_cells[k] / width + 1]++;
+	}
+	for (int i = 0; i < height; i++) {
+		row_starts[i + 1] += row_starts[i];
+	}
+	row_sums.assign(width, 0.0f);
+	moved_cells.clear();
+	moved_values.clear();
+
+	double total = 0.0;
+	for (int r = 0; r < height; r++) {
+		bool reached = false;
+		for (int e = -1; e <= 1; e++) {
+			// input row i lands on row i + dy, whose window reaches r when |r - (i + dy)| <= 1
+			int i = (((r - dy + e) % height) + height) % height;
+			float middle = e == 0 ? w.center : w.adjacent;
+			float side = e == 0 ? w.adjacent : w.corner;
+			for (int k = row_starts[i]; k < row_starts[i + 1]; k++) {
+				int j = ((parked_cells[k] % width + dx) % width + width) % width;
+				float value = parked_values[k];
+				row_sums[(j - 1 + width) % width] += value * side;
+				row_sums[j] += value * middle;
+				row_sums[(j + 1) % width] += value * side;
+				reached = true;
+			}
+		}
+		if (!reached) {
+			continue;
+		}
+		for (int j = 0; j < width; j++) {
+			if (row_sums[j] != 0.0f) {
+				moved_cells.push_back(r * width + j);
+				moved_values.push_back(row_sums[j]);
+				total += row_sums[j];
+				row_sums[j] = 0.0f;
+			}
+		}
+	}
+	parked_cells.swap(moved_cells);
+	parked_values.swap(moved_values);
+
+	size_t area = (size_t) height * width;
+	if (2 * parked_cells.size() * (sizeof(int) + sizeof(float)) > area * sizeof(float)) {
+		restore();
+		finish_step();
+		return;
+	}
+	if (total > 0.0) {
+		float scale = 1.0 / total;
+		for (size_t k = 0; k < parked_values.size(); k++) {
+			parked_values[k] *= scale;
+		}
+	}
+	prune_sparse();
+}
+
+/**
+    Brings parked beliefs back into a dense grid and renormalizes
+    them, which returns the mass lost to parking to the cells kept.
+*/
+void HistogramFilter::restore() const {
+	if (parked_as == DENSE_BELIEFS) {
+		return;
+	}
+	size_t area = (size_t) map.height * map.width;
+	current.assign(area, 0.0f);
+	if (parked_as == SPARSE_BELIEFS) {
+		for (size_t k = 0; k < parked_cells.size(); k++) {
+			current[parked_cells[k]] = parked_values[k];
+		}
+	}
+	else {
+		for (size_t k = 0; k < area; k++) {
+			uint32_t bits = (uint32_t) parked_compact[k] << 16;
+			memcpy(&current[k], &bits, sizeof(bits));
+		}
+	}
+	vector <int> ().swap(parked_cells);
+	vector <float> ().swap(parked_values);
+	vector <unsigned short> ().swap(parked_compact);
+	parked_as = DENSE_BELIEFS;
+	normalize_kernel(&current[0], area);
+}
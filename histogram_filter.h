@@ -0,0 +1,257 @@
+#ifndef HISTOGRAM_FILTER_H
+#define HISTOGRAM_FILTER_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include "compiled_map.h"
+#include "summed_area.h"
+#include "clustering.h"
+#include "active_localization.h"
+#include "motion_noise.h"
+#include "belief_snapshot.h"
+#include "map_reload.h"
+#include "map_registry.h"
+#include "map_cache.h"
+#include "embedded_map.h"
+#include "tuning.h"
+#include "realtime.h"
+#include "numeric_health.h"
+#include "map_channels.h"
+
+// Bytes a filter holds, by use.
+struct FilterMemory {
+	// the beliefs, dense or parked
+	size_t beliefs;
+	// the scratch grid for moves
+	size_t scratch;
+	// the map's private planes, colors, motion classes and channels (shared planes are not counted)
+	size_t map;
+	// the summed-area table, the hypothesis tracker and the sensing tables
+	size_t tables;
+
+	size_t total() const;
+};
+
+// How a filter currently keeps its beliefs.
+enum BeliefStorage {
+	DENSE_BELIEFS,
+	// only the cells above a cutoff, as (index, value) pairs
+	SPARSE_BELIEFS,
+	// every cell rounded to 16 bits (the top half of the float)
+	COMPACT_BELIEFS
+};
+
+/**
+	A stateful 2D histogram filter built on the flat kernels. It owns
+	the compiled map, the current beliefs and one scratch grid, so a
+	step allocates nothing. Creating a filter does no file I/O
+	beyond reading the map it is given and never changes the kernel
+	settings; the machine's tuning profile is applied explicitly
+	(see load_default_tuning in tuning.h).
+*/
+class HistogramFilter {
+public:
+	CompiledMap map;
+	float p_hit, p_miss, blurring;
+
+	// Named rectangles of the map, queried with zone_mass().
+	std::map <std::string, Zone> zones;
+
+	// Extra map layers for multi-modal sensing (see add_channel); channels[k] is channel k + 1.
+	std::vector <MapChannel> channels;
+
+	HistogramFilter(const std::vector < std::vector <char> >& grid,
+		float p_hit, float p_miss, float blurring);
+
+	// Uses an already compiled map, e.g. one attached from a MapRegistry.
+	HistogramFilter(const CompiledMap& compiled, float p_hit, float p_miss, float blurring);
+
+	/**
+	    Reads a map file and, when present, the zones file next to it.
+	    With cached, the map is loaded through its compiled cache
+	    (see map_cache.h).
+	*/
+	HistogramFilter(std::string map_file_name, float p_hit, float p_miss, float blurring,
+		bool cached = false);
+
+	// Updates the beliefs for a sensed color.
+	void sense(char color);
+
+	/**
+	    Updates the beliefs for readings taken at once on several
+	    channels, in one fused pass over the grid (see map_channels.h).
+	    Returns false, changing nothing, when a reading names a
+	    channel the filter does not have.
+	*/
+	bool sense(const std::vector <ChannelReading>& readings);
+
+	/**
+	    Adds a map channel. Returns the channel number to use in
+	    readings, or -1 when its dimensions differ from the map's.
+	    Channels are dropped when a map of another size is installed.
+	*/
+	int add_channel(const MapChannel& channel);
+
+	// Returns the channel number of a named channel, or -1.
+	int channel_index(const std::string& name) const;
+
+	// Updates the beliefs for an intended motion.
+	void move(int dy, int dx);
+
+	// Returns the current beliefs, height * width floats row-major.
+	const float* beliefs() const;
+
+	/**
+	    Replaces the beliefs, e.g. from a checkpoint (see checkpoint.h).
+	    Returns false when the dimensions differ from the map's.
+	*/
+	bool set_beliefs(const float* cells, int height, int width);
+
+	// Returns a copy of the current beliefs as a grid.
+	std::vector < std::vector <float> > belief_grid() const;
+
+	// Keeps a summed-area table up to date after every step.
+	void set_summed_area(bool enabled);
+
+	// Mass of a cyclic rectangle (see SummedAreaTable::region).
+	double region_mass(int top, int left, int rows, int cols) const;
+
+	// Mass of a named zone, or -1.0 when there is no such zone.
+	double zone_mass(std::string name) const;
+
+	/**
+	    Collects the cells above threshold during every normalization
+	    so that hypotheses() does not rescan the grid. 0 turns it off.
+	*/
+	void set_hypothesis_threshold(float threshold);
+
+	// Returns the max_count heaviest modes of the current beliefs.
+	std::vector <Hypothesis> hypotheses(int max_count);
+
+	// Scores candidate motions by expected information gain under the motion model move() uses.
+	std::vector <ActionScore> evaluate_actions(const std::vector <CandidateAction>& actions) const;
+
+	/**
+	    Publishes every new posterior to publisher for concurrent
+	    readers (see belief_snapshot.h); NULL stops publishing. The
+	    filter must then be the publisher's only writer.
+	*/
+	void set_publisher(SnapshotPublisher* publisher);
+
+	/**
+	    Installs maps finished by reloader at the start of the next
+	    step (see map_reload.h); NULL stops polling.
+	*/
+	void set_reloader(MapReloader* reloader);
+
+	/**
+	    Swaps in a new map. Beliefs carry over when the dimensions
+	    are unchanged (as do the motion classes, unless the new map
+	    has its own); otherwise they restart from uniform.
+	*/
+	void install_map(CompiledMap& compiled);
+
+	/**
+	    Repaints cells of the map between steps (see
+	    CompiledMap::apply_edits); the beliefs are kept.
+	*/
+	bool edit_map(const std::vector <MapEdit>& edits);
+
+	/**
+	    Switches the calling thread, which must be the one that steps
+	    the filter, to real-time mode (see realtime.h), and touches the
+	    map and belief buffers and runs one warm-up move so the first
+	    real step takes no page faults or allocations.
+	*/
+	RealtimeStatus enter_realtime(const RealtimeConfig& config);
+
+	// Bytes held by the filter right now.
+	FilterMemory memory_usage() const;
+
+	// Frees the scratch grid; the next move allocates it again.
+	void release_scratch();
+
+	/**
+	    Parks converged beliefs: keeps the cells above cutoff as
+	    (index, value) pairs and frees the dense grid. Returns false,
+	    changing nothing, when that would not halve the beliefs' size
+	    or while a publisher is set.
+
+	    A sparse filter keeps stepping sparsely: sense(char) and
+	    move() update the kept cells and drop those that fall to the
+	    cutoff, until the support grows past half the dense size.
+	    Anything that needs the dense grid restores it first: reading
+	    the beliefs, multi-channel sensing, motion classes, and the
+	    summed-area table, hypotheses or health checks being enabled.
+	*/
+	bool park_sparse(float cutoff = 1e-6);
+
+	/**
+	    Parks the beliefs at 16-bit precision (about three significant
+	    digits) and frees the dense grid. Returns false while a
+	    publisher is set. Unlike sparse parking this holds only while
+	    the filter is idle: its next step or read restores the dense
+	    grid.
+	*/
+	bool park_compact();
+
+	BeliefStorage storage() const;
+
+	/**
+	    Checks the beliefs after every step: counts zero, denormal, NaN
+	    and infinite cells (see health()), raises cells below floor to
+	    floor, and restarts from uniform when the beliefs are lost
+	    (NaN, infinite or all zero). A floor of 0 only counts.
+	*/
+	void set_health_checks(bool enabled, float floor = DEFAULT_BELIEF_FLOOR);
+
+	const HealthMetrics& health() const;
+
+private:
+	// parked beliefs are restored on first use, from const accessors too
+	mutable std::vector <float> current;
+	mutable std::vector <float> scratch;
+	mutable BeliefStorage parked_as;
+	mutable std::vector <int> parked_cells;
+	mutable std::vector <float> parked_values;
+	mutable std::vector <unsigned short> parked_compact;
+	float parked_cutoff;
+	// working buffers of a sparse move
+	std::vector <int> row_starts;
+	std::vector <float> row_sums;
+	std::vector <int> moved_cells;
+	std::vector <float> moved_values;
+	bool keep_summed_area;
+	SummedAreaTable summed_area;
+	float hypothesis_threshold;
+	HypothesisTracker tracker;
+	SnapshotPublisher* publisher;
+	MapReloader* reloader;
+	bool health_checks;
+	float health_floor;
+	HealthMetrics metrics;
+	JointCodes joint;
+	bool joint_stale;
+	std::vector <const unsigned char*> channel_values;
+	std::vector <int> channel_sizes;
+	std::vector <const float*> channel_weight_tables;
+	std::vector <float> reading_weights;
+	std::vector <float> joint_table;
+	std::vector <ChannelLikelihood> lookups;
+
+	void start_uniform();
+	void finish_step();
+	void describe_channels();
+	void refresh();
+	void poll_reloader();
+	bool check_health(const HealthCounts& counts);
+	void restore() const;
+	bool steps_sparse() const;
+	bool sense_sparse(int index);
+	void move_sparse(int dy, int dx);
+	void prune_sparse();
+	const float* source() const;
+};
+
+#endif /* HISTOGRAM_FILTER_H */
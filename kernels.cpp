@@ -0,0 +1,331 @@
+/**
+	kernels.cpp
+
+	Purpose: flat SIMD kernels for sense, move, blur and normalize,
+	written once against the portable layer in simd.h.
+*/
+
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include "simd.h"
+#include "kernels.h"
+#include "streaming.h"
+#include "parallel.h"
+
+using namespace std;
+
+/**
+    Builds the blur window weights for a blurring value.
+
+    @param blurring - how much probability spills over to the
+    	   neighbors (see blur in helpers.cpp).
+
+    @return - the center, adjacent and corner weights.
+*/
+BlurWeights blur_weights(float blurring) {
+	BlurWeights w;
+	w.center = 1.0 - blurring;
+	w.adjacent = blurring / 6.0;
+	w.corner = blurring / 12.0;
+	return w;
+}
+
+float grid_sum(const float* cells, int count) {
+	simd_float acc(0.0f);
+	int k = 0;
+	for (; k + SIMD_WIDTH <= count; k += SIMD_WIDTH) {
+		acc += simd_load(cells + k);
+	}
+	float total = simd_reduce(acc);
+	for (; k < count; k++) {
+		total += cells[k];
+	}
+	return total;
+}
+
+float dot_kernel(const float* a, const float* b, int count) {
+	simd_float acc(0.0f);
+	int k = 0;
+	for (; k + SIMD_WIDTH <= count; k += SIMD_WIDTH) {
+		acc += simd_load(a + k) * simd_load(b + k);
+	}
+	float total = simd_reduce(acc);
+	for (; k < count; k++) {
+		total += a[k] * b[k];
+	}
+	return total;
+}
+
+void axpy_kernel(float* y, const float* x, float factor, int count) {
+	simd_float f(factor);
+	int k = 0;
+	for (; k + SIMD_WIDTH <= count; k += SIMD_WIDTH) {
+		simd_store(simd_load(y + k) + f * simd_load(x + k), y + k);
+	}
+	for (; k < count; k++) {
+		y[k] += factor * x[k];
+	}
+}
+
+void scale_kernel(float* cells, int count, float factor) {
+	simd_float f(factor);
+	int k = 0;
+	for (; k + SIMD_WIDTH <= count; k += SIMD_WIDTH) {
+		simd_store(simd_load(cells + k) * f, cells + k);
+	}
+	for (; k < count; k++) {
+		cells[k] *= factor;
+	}
+}
+
+/**
+    Normalizes a flat grid in place.
+
+    @param cells - count unnormalized probabilities.
+
+    @param count - the number of cells.
+
+    @return - the total before normalizing. When it is zero the
+    	   cells are left untouched.
+*/
+float normalize_kernel(float* cells, int count) {
+	float total = grid_sum(cells, count);
+	if (total != 0.0) {
+		scale_kernel(cells, count, 1.0f / total);
+	}
+	return total;
+}
+
+// Sensing update of count cells starting at beliefs (see sense_kernel).
+void sense_range(const float* beliefs, const float* hit_plane, float* out,
+	int count, float p_hit, float p_miss)
+{
+	if (hit_plane == NULL) {
+		for (int k = 0; k < count; k++) {
+			out[k] = beliefs[k] * p_miss;
+		}
+		return;
+	}
+
+	// weight = p_miss + (p_hit - p_miss) * plane
+	simd_float miss(p_miss);
+	simd_float delta(p_hit - p_miss);
+	int k = 0;
+	for (; k + SIMD_WIDTH <= count; k += SIMD_WIDTH) {
+		simd_float weight = miss + delta * simd_load(hit_plane + k);
+		simd_store(simd_load(beliefs + k) * weight, out + k);
+	}
+	for (; k < count; k++) {
+		out[k] = beliefs[k] * (p_miss + (p_hit - p_miss) * hit_plane[k]);
+	}
+}
+
+/**
+    Sensing update without normalization. Large grids are split into
+    chunks across parallel_config.threads threads.
+
+    @param beliefs - count beliefs before sensing.
+
+    @param hit_plane - the plane of the sensed color (1.0 where the
+    	   map has that color), or NULL when the color is not on the
+    	   map and every cell is a miss.
+
+    @param out - count floats receiving the unnormalized beliefs.
+    	   May alias beliefs.
+*/
+void sense_kernel(const float* beliefs, const float* hit_plane, float* out,
+	int count, float p_hit, float p_miss)
+{
+	int chunks = parallel_tasks(count);
+	if (chunks <= 1) {
+		sense_range(beliefs, hit_plane, out, count, p_hit, p_miss);
+		return;
+	}
+
+	// chunk bounds stay multiples of the SIMD width
+	int step = (count / chunks + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+	parallel_for(chunks, count, [&](int chunk) {
+		int begin = min(count, chunk * step);
+		int end = chunk == chunks - 1 ? count : min(count, begin + step);
+		sense_range(beliefs + begin, hit_plane == NULL ? NULL : hit_plane + begin,
+			out + begin, end - begin, p_hit, p_miss);
+	});
+}
+
+void blur_row(const float* up, const float* mid, const float* down,
+	float* out, int begin, int end, BlurWeights w)
+{
+	simd_float center(w.center);
+	simd_float adjacent(w.adjacent);
+	simd_float corner(w.corner);
+
+	int j = begin;
+	for (; j + SIMD_WIDTH <= end; j += SIMD_WIDTH) {
+		simd_float sides = simd_load(up + j) + simd_load(down + j)
+			+ simd_load(mid + j - 1) + simd_load(mid + j + 1);
+		simd_float corners = simd_load(up + j - 1) + simd_load(up + j + 1)
+			+ simd_load(down + j - 1) + simd_load(down + j + 1);
+		simd_store(center * simd_load(mid + j) + adjacent * sides + corner * corners, out + j);
+	}
+	for (; j < end; j++) {
+		out[j] = w.center * mid[j]
+			+ w.adjacent * (up[j] + down[j] + mid[j - 1] + mid[j + 1])
+			+ w.corner * (up[j - 1] + up[j + 1] + down[j - 1] + down[j + 1]);
+	}
+}
+
+float blur_cell(const float* up, const float* mid, const float* down,
+	int j, int width, BlurWeights w)
+{
+	int l = (j - 1 + width) % width;
+	int r = (j + 1) % width;
+	return w.center * mid[j]
+		+ w.adjacent * (up[j] + down[j] + mid[l] + mid[r])
+		+ w.corner * (up[l] + up[r] + down[l] + down[r]);
+}
+
+/**
+    Blurs a cyclic grid. Because the blur window is symmetric the
+    scatter in blur() is computed here as a gather, which lets each
+    output row be written once with vector loads of three input rows.
+
+    @param in - height * width beliefs.
+
+    @param out - height * width floats receiving the blurred,
+    	   unnormalized beliefs.
+*/
+void blur_kernel(const float* in, float* out, int height, int width, float blurring) {
+	move_kernel(in, out, height, width, 0, 0, blurring);
+}
+
+// Blurs row i of in into row, wrapping rows and columns cyclically.
+void blur_grid_row(const float* in, float* row, int i, int height, int width, BlurWeights w) {
+	const float* up = in + (size_t) ((i - 1 + height) % height) * width;
+	const float* mid = in + (size_t) i * width;
+	const float* down = in + (size_t) ((i + 1) % height) * width;
+
+	if (width < 3) {
+		for (int j = 0; j < width; j++) {
+			row[j] = blur_cell(up, mid, down, j, width, w);
+		}
+		return;
+	}
+
+	row[0] = blur_cell(up, mid, down, 0, width, w);
+	blur_row(up, mid, down, row, 1, width - 1, w);
+	row[width - 1] = blur_cell(up, mid, down, width - 1, width, w);
+}
+
+/**
+    Moves rows [begin, end) of the input (see move_kernel). Rotated
+    rows (and all rows in streaming mode) go through a small row
+    buffer that stays in L1 and are then copied out in two pieces.
+    The buffer is kept per thread, so steps do not allocate once
+    each thread has seen the widest grid.
+*/
+void move_rows(const float* in, float* out, int height, int width, int dy, int shift,
+	BlurWeights w, bool streaming, int begin, int end)
+{
+	static thread_local vector <float> buffer;
+	bool buffered = streaming || shift != 0;
+	if (buffered && (int) buffer.size() < width) {
+		buffer.resize(width);
+	}
+
+	for (int i = begin; i < end; i++) {
+		float* dst = out + (size_t) ((((i + dy) % height) + height) % height) * width;
+
+		if (!buffered) {
+			blur_grid_row(in, dst, i, height, width, w);
+			continue;
+		}
+
+		if (streaming) {
+			int ahead = (i + 1 + streaming_config.prefetch_rows) % height;
+			prefetch_floats(in + (size_t) ahead * width, width);
+		}
+
+		blur_grid_row(in, &buffer[0], i, height, width, w);
+
+		// buffer[j] belongs at column (j + shift) % width
+		if (streaming) {
+			stream_copy(dst + shift, &buffer[0], width - shift);
+			stream_copy(dst, &buffer[width - shift], shift);
+		}
+		else {
+			memcpy(dst + shift, &buffer[0], (width - shift) * sizeof(float));
+			memcpy(dst, &buffer[width - shift], shift * sizeof(float));
+		}
+	}
+
+	// streaming stores are only ordered for the thread that made them
+	if (streaming) {
+		stream_fence();
+	}
+}
+
+/**
+    Implements robot motion on a flat grid. Blurring commutes with a
+    cyclic shift, so row i of the input is blurred and written to row
+    i + dy of the output, rotated by dx columns. Large grids are split
+    into bands of rows across parallel_config.threads threads; every
+    output row is computed the same way either way.
+
+    @param in - height * width beliefs before moving.
+
+    @param out - height * width floats receiving the moved and
+    	   blurred, unnormalized beliefs.
+
+    @param dy - the intended change in y position of the robot.
+
+    @param dx - the intended change in x position of the robot.
+
+    @param blurring - how noisy robot motion is.
+*/
+void move_kernel(const float* in, float* out, int height, int width,
+	int dy, int dx, float blurring)
+{
+	BlurWeights w = blur_weights(blurring);
+	size_t bytes = 2 * (size_t) height * width * sizeof(float);
+	bool streaming = use_streaming(bytes);
+	int shift = ((dx % width) + width) % width;
+
+	int bands = min(parallel_tasks((size_t) height * width), height);
+	if (bands <= 1) {
+		move_rows(in, out, height, width, dy, shift, w, streaming, 0, height);
+		return;
+	}
+	parallel_for(bands, (size_t) height * width, [&](int band) {
+		move_rows(in, out, height, width, dy, shift, w, streaming,
+			(int) ((long long) height * band / bands), (int) ((long long) height * (band + 1) / bands));
+	});
+}
+
+void shift_kernel(const float* in, float* out, int height, int width, int dy, int dx) {
+	int shift = ((dx % width) + width) % width;
+	for (int i = 0; i < height; i++) {
+		const float* src = in + (size_t) i * width;
+		float* dst = out + (size_t) ((((i + dy) % height) + height) % height) * width;
+		memcpy(dst + shift, src, (width - shift) * sizeof(float));
+		memcpy(dst, src + width - shift, shift * sizeof(float));
+	}
+}
+
+vector <float> flatten(const vector < vector <float> >& grid) {
+	vector <float> cells;
+	for (size_t i = 0; i < grid.size(); i++) {
+		cells.insert(cells.end(), grid[i].begin(), grid[i].end());
+	}
+	return cells;
+}
+
+vector < vector <float> > unflatten(const vector <float>& cells, int height, int width) {
+	vector < vector <float> > grid (height, vector <float> (width));
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			grid[i][j] = cells[(size_t) i * width + j];
+		}
+	}
+	return grid;
+}
@@ -0,0 +1,81 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <vector>
+
+/**
+	Flat, allocation-free versions of the histogram filter steps.
+	Grids are contiguous row-major arrays of height * width floats.
+	The vector-of-vectors functions in helpers.h and localizer.h
+	remain the scalar reference implementation.
+*/
+
+// The three distinct weights of the 3x3 blur window.
+struct BlurWeights {
+	float center;
+	float adjacent;
+	float corner;
+};
+
+// Builds the blur window weights for a blurring value.
+BlurWeights blur_weights(float blurring);
+
+// Sums count floats.
+float grid_sum(const float* cells, int count);
+
+// Returns the dot product of two arrays of count floats.
+float dot_kernel(const float* a, const float* b, int count);
+
+// Adds factor * x to y, count floats.
+void axpy_kernel(float* y, const float* x, float factor, int count);
+
+// Multiplies count floats by factor in place.
+void scale_kernel(float* cells, int count, float factor);
+
+// Normalizes count floats in place. Returns the total before normalizing.
+float normalize_kernel(float* cells, int count);
+
+/**
+    Multiplies beliefs by p_hit where hit_plane is 1.0 and by
+    p_miss where it is 0.0. Does not normalize.
+*/
+void sense_kernel(const float* beliefs, const float* hit_plane, float* out,
+	int count, float p_hit, float p_miss);
+
+/**
+    Applies the 3x3 blur window to columns [begin, end) of one row.
+    up, mid and down point at the rows above, at and below the row
+    being written; columns begin - 1 and end must be readable.
+*/
+void blur_row(const float* up, const float* mid, const float* down,
+	float* out, int begin, int end, BlurWeights w);
+
+// Blurs one cell of a row, wrapping columns cyclically.
+float blur_cell(const float* up, const float* mid, const float* down,
+	int j, int width, BlurWeights w);
+
+/**
+    Blurs a cyclic grid into out (which must not alias in).
+    Does not normalize.
+*/
+void blur_kernel(const float* in, float* out, int height, int width, float blurring);
+
+/**
+    Shifts a cyclic grid by (dy, dx) and blurs it in one pass, writing
+    into out (which must not alias in). Does not normalize. Grids
+    larger than streaming_config.threshold_bytes are written with
+    non-temporal stores.
+*/
+void move_kernel(const float* in, float* out, int height, int width,
+	int dy, int dx, float blurring);
+
+// Shifts a cyclic grid by (dy, dx) into out without blurring.
+void shift_kernel(const float* in, float* out, int height, int width, int dy, int dx);
+
+// Copies a grid of floats into a flat row-major vector.
+std::vector <float> flatten(const std::vector < std::vector <float> >& grid);
+
+// Copies a flat row-major vector back into a grid of floats.
+std::vector < std::vector <float> > unflatten(const std::vector <float>& cells, int height, int width);
+
+#endif /* KERNELS_H */
@@ -0,0 +1,171 @@
+/**
+	localization_service.cpp
+
+	Purpose: runs the localization service (see service.h) and a
+	local load generator for it.
+
+		localization_service serve <socket> <map file> ...
+		localization_service load <socket> <map name> [robots] [requests] [window]
+
+	serve makes each map available under its file name without
+	directory or extension (maps/m1.txt is "m1") and runs until
+	killed. load connects robots clients, each keeping up to window
+	requests in flight until it has sent requests of them, and
+	reports the throughput and the request latency percentiles.
+	On SIGINT or SIGTERM serve prints how many robots each sweep
+	advanced on average.
+*/
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <deque>
+#include <random>
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include "localizer.cpp"
+
+using namespace std;
+
+LocalizationService* running_service = NULL;
+
+void stop_service(int) {
+	if (running_service != NULL) {
+		running_service->stop();
+	}
+}
+
+// maps/m1.txt -> m1
+string map_name(const string& file_name) {
+	size_t slash = file_name.find_last_of('/');
+	string name = slash == string::npos ? file_name : file_name.substr(slash + 1);
+	size_t dot = name.find('.');
+	return dot == string::npos ? name : name.substr(0, dot);
+}
+
+int serve(const string& socket_path, char** files, int count) {
+	load_default_tuning();
+	LocalizationService service (3.0, 1.0, 0.1);
+	for (int f = 0; f < count; f++) {
+		vector < vector <char> > grid = read_map(files[f]);
+		if (grid.empty()) {
+			cerr << "localization_service: cannot read a map from " << files[f] << endl;
+			return 1;
+		}
+		service.add_map(map_name(files[f]), grid);
+	}
+	if (!service.listen(socket_path)) {
+		cerr << "localization_service: cannot listen on " << socket_path << endl;
+		return 1;
+	}
+
+	running_service = &service;
+	signal(SIGINT, stop_service);
+	signal(SIGTERM, stop_service);
+	service.run();
+
+	const ServiceStats& stats = service.stats;
+	cout << "clients " << stats.clients << ", requests " << stats.requests
+		<< ", sweeps " << stats.sweeps << ", robots per sweep "
+		<< (stats.sweeps > 0 ? (double) stats.lanes_swept / stats.sweeps : 0.0) << endl;
+	return 0;
+}
+
+/**
+    Drives one robot: keeps up to window requests in flight and
+    records the latency of each, from sending to its reply.
+
+    @return - false when the connection failed.
+*/
+bool drive_robot(const string& socket_path, const string& map, int requests, int window,
+	unsigned seed, vector <double>& latencies_us)
+{
+	ServiceConnection connection;
+	string reply;
+	if (!connection.connect(socket_path) || !connection.request("MAP " + map, reply)
+		|| reply.compare(0, 2, "OK") != 0)
+	{
+		return false;
+	}
+
+	mt19937 rng (seed);
+	deque <chrono::steady_clock::time_point> sent;
+	int received = 0;
+	while (received < requests) {
+		while ((int) sent.size() < window && received + (int) sent.size() < requests) {
+			string line;
+			if (rng() % 2 == 0) {
+				line = string("S ") + "rgb"[rng() % 3];
+			}
+			else {
+				line = "M " + to_string((int) (rng() % 3) - 1) + " " + to_string((int) (rng() % 3) - 1);
+			}
+			if (!connection.send(line)) {
+				return false;
+			}
+			sent.push_back(chrono::steady_clock::now());
+		}
+		if (!connection.receive(reply)) {
+			return false;
+		}
+		chrono::duration<double, micro> latency = chrono::steady_clock::now() - sent.front();
+		latencies_us.push_back(latency.count());
+		sent.pop_front();
+		received++;
+	}
+	return true;
+}
+
+int load(const string& socket_path, const string& map, int robots, int requests, int window) {
+	vector < vector <double> > latencies (robots);
+	vector <char> ok (robots, 0);
+	vector <thread> threads;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int r = 0; r < robots; r++) {
+		threads.push_back(thread([&, r]() {
+			ok[r] = drive_robot(socket_path, map, requests, window, 1000 + r, latencies[r]);
+		}));
+	}
+	for (int r = 0; r < robots; r++) {
+		threads[r].join();
+	}
+	double seconds = chrono::duration<double> (chrono::steady_clock::now() - start).count();
+
+	vector <double> all;
+	for (int r = 0; r < robots; r++) {
+		if (!ok[r]) {
+			cerr << "localization_service: robot " << r << " lost its connection" << endl;
+			return 1;
+		}
+		all.insert(all.end(), latencies[r].begin(), latencies[r].end());
+	}
+	sort(all.begin(), all.end());
+	size_t n = all.size();
+
+	cout << robots << " robots x " << requests << " requests, window " << window << endl;
+	cout << "throughput\t" << (long) (n / seconds) << " requests/s" << endl;
+	cout << "latency p50\t" << all[n / 2] << " us" << endl;
+	cout << "latency p99\t" << all[min(n - 1, n * 99 / 100)] << " us" << endl;
+	cout << "latency p99.9\t" << all[min(n - 1, n * 999 / 1000)] << " us" << endl;
+	cout << "latency max\t" << all[n - 1] << " us" << endl;
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	string mode = argc > 1 ? argv[1] : "";
+	if (mode == "serve" && argc > 3) {
+		return serve(argv[2], argv + 3, argc - 3);
+	}
+	if (mode == "load" && argc > 3) {
+		int robots = argc > 4 ? atoi(argv[4]) : 32;
+		int requests = argc > 5 ? atoi(argv[5]) : 10000;
+		int window = argc > 6 ? atoi(argv[6]) : 1;
+		if (robots > 0 && requests > 0 && window > 0) {
+			return load(argv[2], argv[3], robots, requests, window);
+		}
+	}
+	cerr << "usage: localization_service serve <socket> <map file> ..." << endl;
+	cerr << "       localization_service load <socket> <map name> [robots] [requests] [window]" << endl;
+	return 2;
+}
@@ -13,6 +13,33 @@
 
 #include "localizer.h"
 #include "helpers.cpp"
+#include "compiled_map.cpp"
+#include "map_registry.cpp"
+#include "map_cache.cpp"
+#include "embedded_map.cpp"
+#include "streaming.cpp"
+#include "numeric_health.cpp"
+#include "parallel.cpp"
+#include "realtime.cpp"
+#include "kernels.cpp"
+#include "tuning.cpp"
+#include "tiled_grid.cpp"
+#include "batched_filter.cpp"
+#include "summed_area.cpp"
+#include "clustering.cpp"
+#include "active_localization.cpp"
+#include "motion_noise.cpp"
+#include "map_channels.cpp"
+#include "belief_snapshot.cpp"
+#include "map_reload.cpp"
+#include "histogram_filter.cpp"
+#include "memory_governor.cpp"
+#include "calibration.cpp"
+#include "replay.cpp"
+#include "async_io.cpp"
+#include "checkpoint.cpp"
+#include "localizer_c.cpp"
+#include "service.cpp"
 #include <stdlib.h>
 #include "debugging_helpers.cpp"
 
@@ -0,0 +1,206 @@
+/**
+	localizer_c.cpp
+
+	Purpose: the C interface of localizer_c.h. A filter keeps its
+	beliefs in two grids of the (possibly caller-owned) storage and
+	moves ping-pong between them, so steps run the flat kernels
+	directly on that storage with no copies and no allocations.
+	No C++ exception crosses the interface: every entry point that
+	runs library code catches them and returns an error code.
+*/
+
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+#include "localizer_c.h"
+#include "compiled_map.h"
+#include "kernels.h"
+#include "tuning.h"
+
+const size_t LOCALIZER_STORAGE_ALIGNMENT = 64;
+
+struct localizer_filter {
+	CompiledMap map;
+	float p_hit, p_miss, blurring;
+	float* storage;
+	bool owns_storage;
+	float* beliefs;
+	float* scratch;
+};
+
+int localizer_abi_version(void) {
+	return LOCALIZER_ABI_VERSION;
+}
+
+size_t localizer_storage_alignment(void) {
+	return LOCALIZER_STORAGE_ALIGNMENT;
+}
+
+// Each grid is rounded up to the alignment, so the second one is aligned too.
+size_t localizer_grid_bytes(int height, int width) {
+	size_t bytes = (size_t) height * width * sizeof(float);
+	return (bytes + LOCALIZER_STORAGE_ALIGNMENT - 1) / LOCALIZER_STORAGE_ALIGNMENT * LOCALIZER_STORAGE_ALIGNMENT;
+}
+
+// Returns bytes of storage aligned for the kernels, or NULL.
+void* localizer_aligned_alloc(size_t bytes) {
+#if defined(_WIN32)
+	return _aligned_malloc(bytes, LOCALIZER_STORAGE_ALIGNMENT);
+#else
+	void* allocated = NULL;
+	return posix_memalign(&allocated, LOCALIZER_STORAGE_ALIGNMENT, bytes) == 0 ? allocated : NULL;
+#endif
+}
+
+void localizer_aligned_free(void* storage) {
+#if defined(_WIN32)
+	_aligned_free(storage);
+#else
+	free(storage);
+#endif
+}
+
+// Runs the body of an entry point, turning exceptions into error codes.
+template <typename Body>
+int localizer_guarded(Body body) {
+	try {
+		return body();
+	}
+	catch (const std::bad_alloc&) {
+		return LOCALIZER_ENOMEM;
+	}
+	catch (...) {
+		return LOCALIZER_EINTERNAL;
+	}
+}
+
+int localizer_load_tuning(void) {
+	return localizer_guarded([]() {
+		return load_default_tuning() ? LOCALIZER_OK : LOCALIZER_EINVAL;
+	});
+}
+
+size_t localizer_storage_bytes(int height, int width) {
+	if (height <= 0 || width <= 0) {
+		return 0;
+	}
+	return 2 * localizer_grid_bytes(height, width);
+}
+
+localizer_filter* localizer_create(const char* map, int height, int width, int row_stride,
+	float p_hit, float p_miss, float blurring, float* storage, size_t storage_bytes)
+{
+	size_t needed = localizer_storage_bytes(height, width);
+	if (map == NULL || needed == 0 || row_stride < width) {
+		return NULL;
+	}
+	if (storage != NULL && (storage_bytes < needed
+		|| (uintptr_t) storage % LOCALIZER_STORAGE_ALIGNMENT != 0))
+	{
+		return NULL;
+	}
+
+	localizer_filter* filter = NULL;
+	try {
+		filter = new localizer_filter();
+		filter->map = compile_map(map, height, width, row_stride);
+	}
+	catch (...) {
+		delete filter;
+		return NULL;
+	}
+
+	filter->p_hit = p_hit;
+	filter->p_miss = p_miss;
+	filter->blurring = blurring;
+	filter->owns_storage = storage == NULL;
+	if (storage == NULL) {
+		storage = (float*) localizer_aligned_alloc(needed);
+		if (storage == NULL) {
+			delete filter;
+			return NULL;
+		}
+	}
+	filter->storage = storage;
+	filter->beliefs = storage;
+	filter->scratch = (float*) ((char*) storage + localizer_grid_bytes(height, width));
+
+	int area = height * width;
+	for (int k = 0; k < area; k++) {
+		filter->beliefs[k] = 1.0f / area;
+	}
+	return filter;
+}
+
+void localizer_destroy(localizer_filter* filter) {
+	if (filter == NULL) {
+		return;
+	}
+	if (filter->owns_storage) {
+		localizer_aligned_free(filter->storage);
+	}
+	delete filter;
+}
+
+int localizer_sense(localizer_filter* filter, char color) {
+	if (filter == NULL) {
+		return LOCALIZER_EINVAL;
+	}
+	return localizer_guarded([&]() {
+		int count = filter->map.height * filter->map.width;
+		int index = filter->map.color_index(color);
+		sense_kernel(filter->beliefs, index < 0 ? NULL : filter->map.plane(index), filter->beliefs,
+			count, filter->p_hit, filter->p_miss);
+		normalize_kernel(filter->beliefs, count);
+		return LOCALIZER_OK;
+	});
+}
+
+int localizer_move(localizer_filter* filter, int dy, int dx) {
+	if (filter == NULL) {
+		return LOCALIZER_EINVAL;
+	}
+	// the beliefs only switch grids once the move is complete
+	return localizer_guarded([&]() {
+		move_kernel(filter->beliefs, filter->scratch, filter->map.height, filter->map.width,
+			dy, dx, filter->blurring);
+		float* moved = filter->scratch;
+		filter->scratch = filter->beliefs;
+		filter->beliefs = moved;
+		normalize_kernel(filter->beliefs, filter->map.height * filter->map.width);
+		return LOCALIZER_OK;
+	});
+}
+
+int localizer_step(localizer_filter* filter, int dy, int dx, char color) {
+	int status = localizer_move(filter, dy, dx);
+	return status == LOCALIZER_OK ? localizer_sense(filter, color) : status;
+}
+
+const float* localizer_beliefs(const localizer_filter* filter) {
+	return filter == NULL ? NULL : filter->beliefs;
+}
+
+int localizer_set_beliefs(localizer_filter* filter, const float* cells) {
+	if (filter == NULL || cells == NULL) {
+		return LOCALIZER_EINVAL;
+	}
+	return localizer_guarded([&]() {
+		int count = filter->map.height * filter->map.width;
+		memmove(filter->beliefs, cells, count * sizeof(float));
+		normalize_kernel(filter->beliefs, count);
+		return LOCALIZER_OK;
+	});
+}
+
+int localizer_height(const localizer_filter* filter) {
+	return filter == NULL ? 0 : filter->map.height;
+}
+
+int localizer_width(const localizer_filter* filter) {
+	return filter == NULL ? 0 : filter->map.width;
+}
@@ -0,0 +1,100 @@
+#ifndef LOCALIZER_C_H
+#define LOCALIZER_C_H
+
+/*
+	A stable C interface to the histogram filter, for host
+	applications. Maps are passed as a char buffer, beliefs are
+	read through a const pointer, and the caller may provide the
+	belief storage, so a step copies nothing across the boundary
+	and allocates nothing.
+
+	The layout of localizer_filter is private; only the functions
+	below may be used on it. Functions returning int return
+	LOCALIZER_OK or a negative LOCALIZER_E* code.
+*/
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#define LOCALIZER_API __declspec(dllexport)
+#elif defined(__GNUC__)
+#define LOCALIZER_API __attribute__((visibility("default")))
+#else
+#define LOCALIZER_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bumped when a function changes incompatibly. */
+#define LOCALIZER_ABI_VERSION 1
+
+#define LOCALIZER_OK 0
+#define LOCALIZER_EINVAL -1
+#define LOCALIZER_ENOMEM -2
+/* Any other failure inside the library, e.g. worker threads could not start. */
+#define LOCALIZER_EINTERNAL -3
+
+typedef struct localizer_filter localizer_filter;
+
+LOCALIZER_API int localizer_abi_version(void);
+
+/*
+	Applies the machine's kernel tuning profile, $LOCALIZER_TUNING or
+	else localizer.tuning in the working directory, as the C++
+	load_default_tuning() does. Filters never load it themselves.
+	Returns LOCALIZER_EINVAL when there is no usable profile.
+*/
+LOCALIZER_API int localizer_load_tuning(void);
+
+/* The alignment, in bytes, caller-provided storage must have. */
+LOCALIZER_API size_t localizer_storage_alignment(void);
+
+/* The bytes of storage a filter of height x width cells needs (two grids). */
+LOCALIZER_API size_t localizer_storage_bytes(int height, int width);
+
+/*
+	Creates a filter with a uniform belief.
+
+	map - height rows of width colors, row i starting at
+		map + i * row_stride; it is compiled and not kept.
+	storage - localizer_storage_bytes(height, width) bytes aligned
+		to localizer_storage_alignment(), owned by the caller and
+		used by the filter until it is destroyed; or NULL to have
+		the filter allocate it.
+
+	Returns NULL when an argument is invalid or memory runs out.
+*/
+LOCALIZER_API localizer_filter* localizer_create(const char* map, int height, int width, int row_stride,
+	float p_hit, float p_miss, float blurring, float* storage, size_t storage_bytes);
+
+LOCALIZER_API void localizer_destroy(localizer_filter* filter);
+
+/* Updates the beliefs for a sensed color. */
+LOCALIZER_API int localizer_sense(localizer_filter* filter, char color);
+
+/* Updates the beliefs for an intended motion. */
+LOCALIZER_API int localizer_move(localizer_filter* filter, int dy, int dx);
+
+/* One control cycle: move by (dy, dx), then sense color. */
+LOCALIZER_API int localizer_step(localizer_filter* filter, int dy, int dx, char color);
+
+/*
+	The current beliefs, height * width floats row-major. The pointer
+	lies inside the filter's storage and stays valid until the next
+	call that changes the beliefs.
+*/
+LOCALIZER_API const float* localizer_beliefs(const localizer_filter* filter);
+
+/* Copies height * width cells in as the new beliefs and normalizes them. */
+LOCALIZER_API int localizer_set_beliefs(localizer_filter* filter, const float* cells);
+
+LOCALIZER_API int localizer_height(const localizer_filter* filter);
+LOCALIZER_API int localizer_width(const localizer_filter* filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOCALIZER_C_H */
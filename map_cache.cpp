@@ -0,0 +1,84 @@
+/**
+	map_cache.cpp
+
+	Purpose: a persistent cache of compiled maps next to the source
+	map files, in the compiled map file format of map_registry.h.
+	The cache is keyed by a hash of the source file's raw bytes, so
+	a warm start reads the source once to hash it and never parses
+	or compiles it.
+*/
+
+#include <string>
+#include <fstream>
+#include <stdint.h>
+#include "map_cache.h"
+#include "map_registry.h"
+#include "helpers.h"
+
+using namespace std;
+
+bool file_content_hash(string file_name, uint64_t& hash) {
+	ifstream infile (file_name, ios::binary);
+	if (!infile.is_open()) {
+		return false;
+	}
+
+	hash = 14695981039346656037ULL;
+	char chunk[65536];
+	while (infile.read(chunk, sizeof(chunk)) || infile.gcount() > 0) {
+		streamsize count = infile.gcount();
+		for (streamsize k = 0; k < count; k++) {
+			hash = (hash ^ (unsigned char) chunk[k]) * 1099511628211ULL;
+		}
+	}
+	return true;
+}
+
+string compiled_file_for(string map_file_name) {
+	size_t dot = map_file_name.rfind('.');
+	size_t slash = map_file_name.find_last_of("/\\");
+	if (dot == string::npos || (slash != string::npos && dot < slash)) {
+		return map_file_name + ".compiled";
+	}
+	return map_file_name.substr(0, dot) + ".compiled";
+}
+
+/**
+    Loads a map through the cache. A cache that cannot be written
+    (e.g. a read-only maps directory) only costs the compile.
+
+    @param map_file_name - the source map file.
+
+    @param hit - set to true when the cache was valid and mapped.
+
+    @return - the compiled map; its planes live in the mapped cache
+    	   file whenever the cache could be used or written.
+*/
+CompiledMap load_compiled_map(string map_file_name, bool* hit) {
+	CompiledMap map;
+	if (hit != NULL) {
+		*hit = false;
+	}
+
+	uint64_t hash;
+	if (!file_content_hash(map_file_name, hash)) {
+		return compile_map(read_map(map_file_name));
+	}
+	string cache = compiled_file_for(map_file_name);
+	if (map_compiled_file(cache, hash, map)) {
+		if (hit != NULL) {
+			*hit = true;
+		}
+		return map;
+	}
+
+	map = compile_map(read_map(map_file_name));
+	if (map.palette.empty() || !write_compiled_map(map, hash, cache)) {
+		return map;
+	}
+	CompiledMap cached;
+	if (map_compiled_file(cache, hash, cached)) {
+		return cached;
+	}
+	return map;
+}
@@ -0,0 +1,23 @@
+#ifndef MAP_CACHE_H
+#define MAP_CACHE_H
+
+#include <string>
+#include <stdint.h>
+#include "compiled_map.h"
+
+// FNV-1a hash of a file's bytes. Returns false when it cannot be read.
+bool file_content_hash(std::string file_name, uint64_t& hash);
+
+// Returns the cache file that goes with a map file (maps/m1.txt -> maps/m1.compiled).
+std::string compiled_file_for(std::string map_file_name);
+
+/**
+    Loads a map file through its on-disk compiled cache. A cache
+    written for the same source bytes and format version is mapped
+    directly, skipping read_map and compile_map; otherwise the map is
+    compiled and the cache (re)written. hit is set to whether the
+    cache was used.
+*/
+CompiledMap load_compiled_map(std::string map_file_name, bool* hit = NULL);
+
+#endif /* MAP_CACHE_H */
@@ -0,0 +1,262 @@
+/**
+	map_channels.cpp
+
+	Purpose: multi-channel maps. Besides its colors a cell may carry
+	other observable properties (texture class, fiducial presence,
+	...), each kept as a channel with its own palette, one packed
+	byte per cell, and its own p_hit and p_miss.
+
+	A multi-modal sense multiplies the beliefs by one likelihood per
+	channel. Doing that as one sense per channel would read and write
+	the whole grid once per channel. Instead the channels of a map
+	are folded into one joint code per cell, and a sense builds the
+	weight of every code (the product over the channels) in a small
+	table, then weighs each cell with a single lookup in one pass.
+	Channels with too many value combinations for a table use the
+	fused kernel, which multiplies the per-channel lookups of a block
+	of cells in an L1 buffer before the single pass over the beliefs.
+*/
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <string.h>
+#include "map_channels.h"
+#include "simd.h"
+#include "parallel.h"
+#include "helpers.h"
+
+using namespace std;
+
+int MapChannel::value_index(char value) const {
+	for (int k = 0; k < (int) palette.size(); k++) {
+		if (palette[k] == value) {
+			return k;
+		}
+	}
+	return -1;
+}
+
+/**
+    Builds a channel from a grid of values.
+
+    @param channel - receives the channel; unchanged on failure.
+
+    @param grid - one value per cell, e.g. as returned by read_map.
+    	   Palette indices are assigned in order of first appearance.
+
+    @return - false when the rows differ in length or there are more
+    	   than 256 distinct values.
+*/
+bool compile_channel(MapChannel& channel, const string& name,
+	const vector < vector <char> >& grid, float p_hit, float p_miss)
+{
+	MapChannel built;
+	built.name = name;
+	built.p_hit = p_hit;
+	built.p_miss = p_miss;
+	built.height = grid.size();
+	built.width = grid.empty() ? 0 : grid[0].size();
+	built.values.resize((size_t) built.height * built.width);
+
+	for (int i = 0; i < built.height; i++) {
+		if ((int) grid[i].size() != built.width) {
+			return false;
+		}
+		for (int j = 0; j < built.width; j++) {
+			int index = built.value_index(grid[i][j]);
+			if (index < 0) {
+				if (built.palette.size() == 256) {
+					return false;
+				}
+				index = built.palette.size();
+				built.palette.push_back(grid[i][j]);
+			}
+			built.values[(size_t) i * built.width + j] = (unsigned char) index;
+		}
+	}
+
+	channel = built;
+	return true;
+}
+
+bool read_channel(MapChannel& channel, const string& name, string file_name,
+	float p_hit, float p_miss)
+{
+	vector < vector <char> > grid = read_map(file_name);
+	return !grid.empty() && compile_channel(channel, name, grid, p_hit, p_miss);
+}
+
+void channel_weights(const vector <char>& palette, char value,
+	float p_hit, float p_miss, float* weights)
+{
+	for (size_t k = 0; k < palette.size(); k++) {
+		weights[k] *= palette[k] == value ? p_hit : p_miss;
+	}
+}
+
+// Fused sensing update of cells [first, last) (see fused_sense_kernel).
+void fused_sense_range(const float* beliefs, const ChannelLikelihood* channels, int channel_count,
+	float* out, int first, int last)
+{
+	const int BLOCK = 256;
+	float weight[BLOCK];
+
+	for (int begin = first; begin < last; begin += BLOCK) {
+		int length = min(BLOCK, last - begin);
+
+		const unsigned char* values = channels[0].values + begin;
+		const float* weights = channels[0].weights;
+		for (int k = 0; k < length; k++) {
+			weight[k] = weights[values[k]];
+		}
+		for (int c = 1; c < channel_count; c++) {
+			values = channels[c].values + begin;
+			weights = channels[c].weights;
+			for (int k = 0; k < length; k++) {
+				weight[k] *= weights[values[k]];
+			}
+		}
+
+		const float* in = beliefs + begin;
+		float* to = out + begin;
+		int k = 0;
+		for (; k + SIMD_WIDTH <= length; k += SIMD_WIDTH) {
+			simd_store(simd_load(in + k) * simd_load(weight + k), to + k);
+		}
+		for (; k < length; k++) {
+			to[k] = in[k] * weight[k];
+		}
+	}
+}
+
+/**
+    Multi-modal sensing update without normalization. Large grids are
+    split into chunks across parallel_config.threads threads.
+
+    @param beliefs - count beliefs before sensing.
+
+    @param channels - one lookup per reading: the packed values of
+    	   the channel and the weight of each of its palette entries
+    	   (see channel_weights).
+
+    @param out - count floats receiving the unnormalized beliefs.
+    	   May alias beliefs.
+*/
+void fused_sense_kernel(const float* beliefs, const ChannelLikelihood* channels, int channel_count,
+	float* out, int count)
+{
+	if (channel_count == 0) {
+		if (out != beliefs) {
+			memcpy(out, beliefs, count * sizeof(float));
+		}
+		return;
+	}
+
+	int chunks = parallel_tasks(count);
+	if (chunks <= 1) {
+		fused_sense_range(beliefs, channels, channel_count, out, 0, count);
+		return;
+	}
+
+	// chunk bounds stay multiples of the SIMD width
+	int step = (count / chunks + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+	parallel_for(chunks, count, [&](int chunk) {
+		int begin = min(count, chunk * step);
+		int end = chunk == chunks - 1 ? count : min(count, begin + step);
+		fused_sense_range(beliefs, channels, channel_count, out, begin, end);
+	});
+}
+
+bool build_joint_codes(const vector <const unsigned char*>& values, const vector <int>& sizes,
+	int count, JointCodes& joint)
+{
+	vector <int> strides (sizes.size());
+	int size = 1;
+	for (size_t c = 0; c < sizes.size(); c++) {
+		strides[c] = size;
+		if ((long) size * sizes[c] > MAX_JOINT_CODES) {
+			return false;
+		}
+		size *= sizes[c];
+	}
+
+	joint.strides = strides;
+	joint.size = size;
+	joint.codes.assign(count, 0);
+	for (size_t c = 0; c < values.size(); c++) {
+		unsigned short stride = strides[c];
+		for (int k = 0; k < count; k++) {
+			joint.codes[k] += values[c][k] * stride;
+		}
+	}
+	return true;
+}
+
+unsigned short joint_code(const JointCodes& joint, const vector <const unsigned char*>& values,
+	size_t cell)
+{
+	int code = 0;
+	for (size_t c = 0; c < values.size(); c++) {
+		code += values[c][cell] * joint.strides[c];
+	}
+	return code;
+}
+
+/**
+    Builds the weight of every joint code channel by channel: after
+    channel c the first stride(c + 1) entries hold the products over
+    channels 0 to c. Entries are filled from the highest palette
+    index down, so the prefix they read is still unscaled.
+*/
+void joint_weights(const JointCodes& joint, const vector <int>& sizes,
+	const vector <const float*>& weights, float* table)
+{
+	table[0] = 1.0f;
+	for (size_t c = 0; c < sizes.size(); c++) {
+		int stride = joint.strides[c];
+		for (int index = sizes[c] - 1; index >= 0; index--) {
+			float weight = weights[c][index];
+			for (int r = 0; r < stride; r++) {
+				table[index * stride + r] = table[r] * weight;
+			}
+		}
+	}
+}
+
+void joint_sense_range(const float* beliefs, const unsigned short* codes, const float* table,
+	float* out, int count)
+{
+	for (int k = 0; k < count; k++) {
+		out[k] = beliefs[k] * table[codes[k]];
+	}
+}
+
+/**
+    Multi-modal sensing update over joint codes, without
+    normalization. Large grids are split into chunks across
+    parallel_config.threads threads.
+
+    @param codes - the joint code of each cell (see JointCodes).
+
+    @param table - the weight of each code (see joint_weights).
+
+    @param out - count floats receiving the unnormalized beliefs.
+    	   May alias beliefs.
+*/
+void joint_sense_kernel(const float* beliefs, const unsigned short* codes, const float* table,
+	float* out, int count)
+{
+	int chunks = parallel_tasks(count);
+	if (chunks <= 1) {
+		joint_sense_range(beliefs, codes, table, out, count);
+		return;
+	}
+
+	int step = (count + chunks - 1) / chunks;
+	parallel_for(chunks, count, [&](int chunk) {
+		int begin = min(count, chunk * step);
+		int end = min(count, begin + step);
+		joint_sense_range(beliefs + begin, codes + begin, table, out + begin, end - begin);
+	});
+}
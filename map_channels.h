@@ -0,0 +1,110 @@
+#ifndef MAP_CHANNELS_H
+#define MAP_CHANNELS_H
+
+#include <vector>
+#include <string>
+
+/**
+	One extra layer of a map, e.g. floor texture class or fiducial
+	presence, with its own sensor model. Like a CompiledMap it keeps
+	a palette and the palette index of every cell, packed one byte
+	per cell, but no float planes: the fused sense looks the weight
+	of each cell up by its index instead.
+*/
+struct MapChannel {
+	std::string name;
+	float p_hit;
+	float p_miss;
+	int height;
+	int width;
+	std::vector <char> palette;
+	std::vector <unsigned char> values;
+
+	// Returns the palette index of a value, or -1 if it is not on the channel.
+	int value_index(char value) const;
+};
+
+/**
+	A value seen by one sensor. Channel 0 is the filter's color map;
+	channel k > 0 is the k-th channel added to the filter.
+*/
+struct ChannelReading {
+	int channel;
+	char value;
+};
+
+/**
+	The per-cell lookup of one channel in a fused sense: cell k is
+	weighted by weights[values[k]].
+*/
+struct ChannelLikelihood {
+	const unsigned char* values;
+	const float* weights;
+};
+
+// Most codes JointCodes may use; their weight table (16 KB) stays in L1.
+const int MAX_JOINT_CODES = 4096;
+
+/**
+	Several channels folded into one code per cell, the sum over the
+	channels of the cell's palette index times the channel's stride.
+	A sense then weighs each cell with a single lookup in a table of
+	size entries, however many channels were read.
+*/
+struct JointCodes {
+	std::vector <int> strides;
+	int size;
+	std::vector <unsigned short> codes;
+};
+
+/**
+    Builds a channel from a grid of values (same layout as a map).
+    Returns false when the grid is ragged or has more than 256
+    distinct values.
+*/
+bool compile_channel(MapChannel& channel, const std::string& name,
+	const std::vector < std::vector <char> >& grid, float p_hit, float p_miss);
+
+// Reads a channel file (same layout as a map file). Returns false when it is missing or invalid.
+bool read_channel(MapChannel& channel, const std::string& name, std::string file_name,
+	float p_hit, float p_miss);
+
+/**
+    Multiplies weights, one per palette entry, by the likelihood of
+    seeing value in a cell of each palette value, so that several
+    readings of a channel combine.
+*/
+void channel_weights(const std::vector <char>& palette, char value,
+	float p_hit, float p_miss, float* weights);
+
+/**
+    Multiplies beliefs by the product of every channel's weight in
+    one pass over the grid. Does not normalize; out may alias beliefs.
+*/
+void fused_sense_kernel(const float* beliefs, const ChannelLikelihood* channels, int channel_count,
+	float* out, int count);
+
+/**
+    Folds channels, given as count palette indices each and their
+    palette sizes, into joint codes. Returns false, leaving joint
+    unchanged, when there would be more than MAX_JOINT_CODES codes.
+*/
+bool build_joint_codes(const std::vector <const unsigned char*>& values, const std::vector <int>& sizes,
+	int count, JointCodes& joint);
+
+// Returns the joint code of one cell (see build_joint_codes).
+unsigned short joint_code(const JointCodes& joint, const std::vector <const unsigned char*>& values,
+	size_t cell);
+
+/**
+    Fills the table of joint.size weights, the product of the weight
+    of each channel's palette entry (weights[c] has one per entry).
+*/
+void joint_weights(const JointCodes& joint, const std::vector <int>& sizes,
+	const std::vector <const float*>& weights, float* table);
+
+// Multiplies cell k of beliefs by table[codes[k]]. Does not normalize; out may alias beliefs.
+void joint_sense_kernel(const float* beliefs, const unsigned short* codes, const float* table,
+	float* out, int count);
+
+#endif /* MAP_CHANNELS_H */
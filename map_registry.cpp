@@ -0,0 +1,266 @@
+/**
+	map_registry.cpp
+
+	Purpose: a host-wide registry of compiled maps in mmapped
+	files, so that many localizer processes on the same maps share
+	one physical copy of the planes instead of compiling their own.
+
+	The planes are 4 bytes per cell per palette color and make up
+	nearly all of a compiled map; they stay in the mapping. The
+	palette and the one-byte color indices are copied out, which
+	also checks that the file holds the requested grid.
+*/
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <string.h>
+#include <stdint.h>
+#include "map_registry.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define LOCALIZER_HAS_MMAP 1
+#endif
+
+using namespace std;
+
+uint64_t map_content_hash(const vector < vector <char> >& grid) {
+	uint64_t hash = 14695981039346656037ULL;
+	int32_t dims[2] = {(int32_t) grid.size(), grid.empty() ? 0 : (int32_t) grid[0].size()};
+	const unsigned char* bytes = (const unsigned char*) dims;
+	for (size_t k = 0; k < sizeof(dims); k++) {
+		hash = (hash ^ bytes[k]) * 1099511628211ULL;
+	}
+	for (size_t i = 0; i < grid.size(); i++) {
+		for (size_t j = 0; j < grid[i].size(); j++) {
+			hash = (hash ^ (unsigned char) grid[i][j]) * 1099511628211ULL;
+		}
+	}
+	return hash;
+}
+
+// Distinguishes the temporary files of concurrent writers.
+long process_id() {
+#ifdef LOCALIZER_HAS_MMAP
+	return (long) getpid();
+#else
+	return 0;
+#endif
+}
+
+// Fills in the header of a compiled map, including where the planes go.
+CompiledMapHeader compiled_map_header(const CompiledMap& map, uint64_t content_hash) {
+	CompiledMapHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, COMPILED_MAP_MAGIC, sizeof(header.magic));
+	header.version = COMPILED_MAP_VERSION;
+	header.palette_size = map.palette.size();
+	header.content_hash = content_hash;
+	header.height = map.height;
+	header.width = map.width;
+
+	size_t area = (size_t) map.height * map.width;
+	header.planes_offset = (sizeof(header) + map.palette.size() + area + 63) / 64 * 64;
+	header.file_bytes = header.planes_offset + map.palette.size() * area * sizeof(float);
+	return header;
+}
+
+bool write_compiled_map(const CompiledMap& map, uint64_t content_hash, string file_name) {
+	CompiledMapHeader header = compiled_map_header(map, content_hash);
+	size_t area = (size_t) map.height * map.width;
+	vector <char> head (header.planes_offset, 0);
+	memcpy(&head[0], &header, sizeof(header));
+	memcpy(&head[sizeof(header)], &map.palette[0], map.palette.size());
+	memcpy(&head[sizeof(header) + map.palette.size()], &map.colors[0], area);
+
+	// a private temporary name, renamed over the final one when complete
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%ld.%p", (long) process_id(), (const void*) &map);
+	string temporary = file_name + suffix;
+	FILE* file = fopen(temporary.c_str(), "wb");
+	if (file == NULL) {
+		return false;
+	}
+	bool written = fwrite(&head[0], 1, head.size(), file) == head.size();
+	written = written && fwrite(map.plane(0), sizeof(float), map.palette.size() * area, file)
+		== map.palette.size() * area;
+	written = fclose(file) == 0 && written;
+	if (!written || rename(temporary.c_str(), file_name.c_str()) != 0) {
+		remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+/**
+    Checks a mapped file and copies its palette and color indices
+    into out.
+
+    @param content_hash - the hash the file must have been written with.
+
+    @param grid - the grid the file must hold, or NULL to trust the
+    	   hash and only check that the color indices are in range.
+*/
+bool read_compiled_map(const char* bytes, size_t size, uint64_t content_hash,
+	const vector < vector <char> >* grid, CompiledMap& out)
+{
+	if (size < sizeof(CompiledMapHeader)) {
+		return false;
+	}
+	CompiledMapHeader header;
+	memcpy(&header, bytes, sizeof(header));
+	if (memcmp(header.magic, COMPILED_MAP_MAGIC, sizeof(header.magic)) != 0
+		|| header.version != COMPILED_MAP_VERSION || header.file_bytes != size
+		|| header.content_hash != content_hash || header.palette_size == 0
+		|| header.height <= 0 || header.width <= 0)
+	{
+		return false;
+	}
+	if (grid != NULL && (header.height != (int32_t) grid->size()
+		|| header.width != (int32_t) (*grid)[0].size()))
+	{
+		return false;
+	}
+
+	out.height = header.height;
+	out.width = header.width;
+	size_t area = (size_t) out.height * out.width;
+	if (header.planes_offset % 64 != 0
+		|| header.planes_offset < sizeof(header) + header.palette_size + area
+		|| header.planes_offset + header.palette_size * area * sizeof(float) != size)
+	{
+		return false;
+	}
+
+	const char* palette = bytes + sizeof(header);
+	const unsigned char* colors = (const unsigned char*) palette + header.palette_size;
+	for (int i = 0; i < out.height; i++) {
+		for (int j = 0; j < out.width; j++) {
+			unsigned char index = colors[(size_t) i * out.width + j];
+			if (index >= header.palette_size) {
+				return false;
+			}
+			if (grid != NULL && ((*grid)[i].size() != (size_t) out.width
+				|| palette[index] != (*grid)[i][j]))
+			{
+				return false;
+			}
+		}
+	}
+
+	out.palette.assign(palette, palette + header.palette_size);
+	out.colors.assign(colors, colors + area);
+	out.planes.clear();
+	return true;
+}
+
+// Maps a compiled map file and attaches it to out when it checks out.
+bool map_compiled_file(string file_name, uint64_t content_hash,
+	const vector < vector <char> >* grid, CompiledMap& out)
+{
+#ifdef LOCALIZER_HAS_MMAP
+	int fd = open(file_name.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat info;
+	void* bytes = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size > 0) {
+		bytes = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (bytes == MAP_FAILED) {
+		return false;
+	}
+
+	size_t size = info.st_size;
+	shared_ptr <const char> mapping ((const char*) bytes, [size](const char* p) {
+		munmap((void*) p, size);
+	});
+	if (!read_compiled_map(mapping.get(), size, content_hash, grid, out)) {
+		return false;
+	}
+
+	CompiledMapHeader header;
+	memcpy(&header, mapping.get(), sizeof(header));
+	out.shared_planes = shared_ptr <const float> (mapping,
+		(const float*) (mapping.get() + header.planes_offset));
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool map_compiled_file(string file_name, const vector < vector <char> >& grid, CompiledMap& out) {
+	if (grid.empty()) {
+		return false;
+	}
+	return map_compiled_file(file_name, map_content_hash(grid), &grid, out);
+}
+
+bool map_compiled_file(string file_name, uint64_t content_hash, CompiledMap& out) {
+	return map_compiled_file(file_name, content_hash, NULL, out);
+}
+
+string default_registry_directory() {
+	const char* configured = getenv("LOCALIZER_MAP_REGISTRY");
+	if (configured != NULL && configured[0] != '\0') {
+		return configured;
+	}
+#ifdef LOCALIZER_HAS_MMAP
+	if (access("/dev/shm", W_OK) == 0) {
+		return "/dev/shm";
+	}
+#endif
+	return "/tmp";
+}
+
+MapRegistry::MapRegistry() : directory(default_registry_directory()) {
+}
+
+MapRegistry::MapRegistry(string directory) : directory(directory) {
+}
+
+string MapRegistry::path_for(uint64_t content_hash) const {
+	char name[64];
+	snprintf(name, sizeof(name), "/localizer-map-%016llx.bin", (unsigned long long) content_hash);
+	return directory + name;
+}
+
+/**
+    Attaches to or creates the registry entry of a grid. A file that
+    is stale or damaged is replaced; if the registry cannot be written
+    the map is compiled privately, so attach always succeeds.
+*/
+CompiledMap MapRegistry::attach(const vector < vector <char> >& grid, bool* created) {
+	uint64_t hash = map_content_hash(grid);
+	string path = path_for(hash);
+	CompiledMap map;
+	if (created != NULL) {
+		*created = false;
+	}
+	if (map_compiled_file(path, grid, map)) {
+		return map;
+	}
+
+	map = compile_map(grid);
+	if (created != NULL) {
+		*created = true;
+	}
+	if (map.palette.empty() || !write_compiled_map(map, hash, path)) {
+		return map;
+	}
+
+	// switch to the shared pages so this process holds no private copy
+	CompiledMap shared;
+	if (map_compiled_file(path, grid, shared)) {
+		return shared;
+	}
+	return map;
+}
@@ -0,0 +1,81 @@
+#ifndef MAP_REGISTRY_H
+#define MAP_REGISTRY_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include "compiled_map.h"
+
+// Identifies compiled map files and the layout version they use.
+const char COMPILED_MAP_MAGIC[8] = {'L', 'O', 'C', 'M', 'A', 'P', '\0', '\0'};
+const uint32_t COMPILED_MAP_VERSION = 1;
+
+/**
+	Header of a compiled map file. The palette (palette_size bytes)
+	and the color index of every cell (height * width bytes) follow
+	it; the float planes start at planes_offset, 64-byte aligned.
+*/
+struct CompiledMapHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t palette_size;
+	uint64_t content_hash;
+	int32_t height;
+	int32_t width;
+	uint64_t planes_offset;
+	uint64_t file_bytes;
+};
+
+// FNV-1a hash of a grid map's dimensions and cells.
+uint64_t map_content_hash(const std::vector < std::vector <char> >& grid);
+
+/**
+    Writes a compiled map file. It is written under a temporary name
+    and renamed into place, so readers never see a partial file.
+    Returns false when the file could not be written.
+*/
+bool write_compiled_map(const CompiledMap& map, uint64_t content_hash, std::string file_name);
+
+/**
+    Maps a compiled map file read-only and attaches its planes to out.
+    Returns false when the file is missing, truncated, of another
+    version, or does not hold exactly grid.
+*/
+bool map_compiled_file(std::string file_name, const std::vector < std::vector <char> >& grid,
+	CompiledMap& out);
+
+/**
+    Maps a compiled map file written with content_hash without the
+    source grid at hand. Returns false as above, or when the hash
+    differs.
+*/
+bool map_compiled_file(std::string file_name, uint64_t content_hash, CompiledMap& out);
+
+/**
+	Compiled maps shared between processes. Each map is stored once
+	per host in directory, named by its content hash; the first
+	process to ask for a map compiles and writes it, and every other
+	process maps the same pages read-only.
+*/
+class MapRegistry {
+public:
+	// Uses $LOCALIZER_MAP_REGISTRY, else /dev/shm, else /tmp.
+	MapRegistry();
+	MapRegistry(std::string directory);
+
+	/**
+	    Returns the compiled grid, attached from the registry when it
+	    is there and compiled (and added) otherwise. created is set to
+	    whether this call compiled it. Without mmap the map is always
+	    compiled privately.
+	*/
+	CompiledMap attach(const std::vector < std::vector <char> >& grid, bool* created = NULL);
+
+	// The file that holds the map with a given content hash.
+	std::string path_for(uint64_t content_hash) const;
+
+private:
+	std::string directory;
+};
+
+#endif /* MAP_REGISTRY_H */
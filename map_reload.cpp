@@ -0,0 +1,116 @@
+/**
+	map_reload.cpp
+
+	Purpose: hot map reload. A new map is compiled on a worker
+	thread and handed over through a single atomic pointer, which
+	the filter exchanges for NULL at the start of its next step.
+	Requests made while the worker is busy wait in a single slot,
+	so a burst of updates compiles at most the one in flight and
+	the newest.
+*/
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include "map_reload.h"
+#include "helpers.h"
+
+using namespace std;
+
+MapReloader::MapReloader() : failures(0), pending(NULL), busy(false), queued(false), queued_from_file(false) {
+}
+
+MapReloader::~MapReloader() {
+	wait();
+	delete pending.exchange(NULL);
+}
+
+void MapReloader::request(const vector < vector <char> >& grid) {
+	lock_guard <mutex> guard (lock);
+	queued = true;
+	queued_from_file = false;
+	queued_grid = grid;
+	queued_file.clear();
+	start();
+}
+
+void MapReloader::request(string map_file_name) {
+	lock_guard <mutex> guard (lock);
+	queued = true;
+	queued_from_file = true;
+	queued_file = map_file_name;
+	queued_grid.clear();
+	start();
+}
+
+/**
+    Starts a worker for the queued request unless one is running; a
+    running worker picks the request up when it finishes. Called
+    with lock held. A worker that cleared busy has nothing left to
+    do but return, so joining it does not wait for a compile.
+*/
+void MapReloader::start() {
+	if (busy) {
+		return;
+	}
+	if (worker.joinable()) {
+		worker.join();
+	}
+	busy = true;
+	worker = thread(&MapReloader::run, this);
+}
+
+// Worker body: compiles queued requests until there are none left.
+void MapReloader::run() {
+	while (true) {
+		bool from_file;
+		string file_name;
+		vector < vector <char> > grid;
+		{
+			lock_guard <mutex> guard (lock);
+			if (!queued) {
+				busy = false;
+				return;
+			}
+			queued = false;
+			from_file = queued_from_file;
+			file_name.swap(queued_file);
+			grid.swap(queued_grid);
+		}
+		compile(from_file ? read_map(file_name) : grid);
+	}
+}
+
+void MapReloader::wait() {
+	if (worker.joinable()) {
+		worker.join();
+	}
+}
+
+CompiledMap* MapReloader::take() {
+	if (pending.load(memory_order_relaxed) == NULL) {
+		return NULL;
+	}
+	return pending.exchange(NULL);
+}
+
+/**
+    Compiles one request. Maps the kernels cannot use are counted and
+    dropped; a compiled map that was never taken is replaced by the
+    newer one.
+*/
+void MapReloader::compile(vector < vector <char> > grid) {
+	bool rectangular = !grid.empty() && !grid[0].empty();
+	for (size_t i = 0; i < grid.size() && rectangular; i++) {
+		rectangular = grid[i].size() == grid[0].size();
+	}
+	if (!rectangular) {
+		failures++;
+		return;
+	}
+
+	CompiledMap* compiled = new CompiledMap(compile_map(grid));
+	delete pending.exchange(compiled);
+}
@@ -0,0 +1,61 @@
+#ifndef MAP_RELOAD_H
+#define MAP_RELOAD_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include "compiled_map.h"
+
+/**
+	Compiles map updates on a background thread. The filter picks
+	up a finished map between steps with take(), so a map update
+	never stalls a step on read_map or compile_map.
+
+	request() never waits for a compile: while one is in flight the
+	request is queued, replacing any older queued one, and the worker
+	starts it when it finishes. request() may be called from any one
+	controlling thread; take() is called by the filter thread.
+*/
+class MapReloader {
+public:
+	MapReloader();
+	~MapReloader();
+
+	// Compiles a grid. A newer request replaces an older one that has not started.
+	void request(const std::vector < std::vector <char> >& grid);
+
+	// Reads and compiles a map file.
+	void request(std::string map_file_name);
+
+	// Waits for the compile in flight and the queued one, if any.
+	void wait();
+
+	/**
+	    Returns the newest compiled map that has not been taken yet,
+	    or NULL. The caller owns the result.
+	*/
+	CompiledMap* take();
+
+	// Requests dropped because the map was empty or not rectangular.
+	std::atomic <int> failures;
+
+private:
+	std::thread worker;
+	std::atomic <CompiledMap*> pending;
+
+	// the request waiting for the worker, guarded by lock
+	std::mutex lock;
+	bool busy;
+	bool queued;
+	bool queued_from_file;
+	std::string queued_file;
+	std::vector < std::vector <char> > queued_grid;
+
+	void start();
+	void run();
+	void compile(std::vector < std::vector <char> > grid);
+};
+
+#endif /* MAP_RELOAD_H */
@@ -0,0 +1,106 @@
+/**
+	memory_governor.cpp
+
+	Purpose: a memory budget across many filters, enforced by
+	releasing scratch grids and parking beliefs in smaller forms.
+*/
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "memory_governor.h"
+
+using namespace std;
+
+MemoryGovernor::MemoryGovernor(size_t budget_bytes) : budget_bytes(budget_bytes), sparse_cutoff(1e-6) {
+}
+
+void MemoryGovernor::add(HistogramFilter* filter, const string& name) {
+	filters.push_back(filter);
+	names.push_back(name);
+}
+
+void MemoryGovernor::remove(HistogramFilter* filter) {
+	for (size_t f = 0; f < filters.size(); f++) {
+		if (filters[f] == filter) {
+			filters.erase(filters.begin() + f);
+			names.erase(names.begin() + f);
+			return;
+		}
+	}
+}
+
+FilterMemory MemoryGovernor::usage() const {
+	FilterMemory total = {0, 0, 0, 0};
+	for (size_t f = 0; f < filters.size(); f++) {
+		FilterMemory used = filters[f]->memory_usage();
+		total.beliefs += used.beliefs;
+		total.scratch += used.scratch;
+		total.map += used.map;
+		total.tables += used.tables;
+	}
+	return total;
+}
+
+// Largest belief of a filter; the closer to 1, the more converged.
+float peak_belief(const HistogramFilter& filter) {
+	const float* beliefs = filter.beliefs();
+	return *max_element(beliefs, beliefs + filter.map.height * filter.map.width);
+}
+
+/**
+    Enforces the budget. Each pass tries one kind of degradation on
+    every filter that can still take it, and stops as soon as the
+    fleet fits; sparse parking goes to the most converged filters
+    first, since they lose the least.
+
+    @return - every filter degraded, with the action and the bytes
+    	   it freed.
+*/
+vector <DegradedFilter> MemoryGovernor::enforce() {
+	vector <DegradedFilter> report;
+	size_t used = usage().total();
+
+	vector <size_t> order;
+	for (int pass = RELEASED_SCRATCH; pass <= PARKED_COMPACT && used > budget_bytes; pass++) {
+		order.clear();
+		vector < pair <float, size_t> > by_peak;
+		for (size_t f = 0; f < filters.size(); f++) {
+			bool dense = filters[f]->storage() == DENSE_BELIEFS;
+			if (pass == RELEASED_SCRATCH && filters[f]->memory_usage().scratch > 0) {
+				order.push_back(f);
+			}
+			else if (pass != RELEASED_SCRATCH && dense) {
+				by_peak.push_back(make_pair(pass == PARKED_SPARSE ? -peak_belief(*filters[f]) : 0.0f, f));
+			}
+		}
+		stable_sort(by_peak.begin(), by_peak.end());
+		for (size_t k = 0; k < by_peak.size(); k++) {
+			order.push_back(by_peak[k].second);
+		}
+
+		for (size_t k = 0; k < order.size() && used > budget_bytes; k++) {
+			HistogramFilter* filter = filters[order[k]];
+			size_t before = filter->memory_usage().total();
+			bool done;
+			if (pass == RELEASED_SCRATCH) {
+				filter->release_scratch();
+				done = true;
+			}
+			else if (pass == PARKED_SPARSE) {
+				done = filter->park_sparse(sparse_cutoff);
+			}
+			else {
+				done = filter->park_compact();
+			}
+
+			size_t after = filter->memory_usage().total();
+			if (done && after < before) {
+				DegradedFilter degraded = {names[order[k]], filter, (Degradation) pass, before - after};
+				report.push_back(degraded);
+				used -= before - after;
+			}
+		}
+	}
+	return report;
+}
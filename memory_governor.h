@@ -0,0 +1,69 @@
+#ifndef MEMORY_GOVERNOR_H
+#define MEMORY_GOVERNOR_H
+
+#include <vector>
+#include <string>
+#include "histogram_filter.h"
+
+// What the governor did to a filter to save memory, from mildest to most lossy.
+enum Degradation {
+	// freed the scratch grid; lossless, the next dense move reallocates it
+	RELEASED_SCRATCH,
+	// parked converged beliefs sparsely; loses the mass below the cutoff
+	PARKED_SPARSE,
+	// parked the beliefs at 16-bit precision
+	PARKED_COMPACT
+};
+
+// One action of MemoryGovernor::enforce.
+struct DegradedFilter {
+	std::string name;
+	HistogramFilter* filter;
+	Degradation action;
+	size_t bytes_freed;
+};
+
+/**
+	Keeps the filters of a fleet within a memory budget. Filters are
+	registered by name; enforce() measures them all and, while over
+	budget, degrades them one step at a time, mildest step first:
+	scratch grids of every filter, then sparse parking of the most
+	converged filters, then 16-bit parking of the rest.
+
+	Sparsely parked filters keep stepping sparsely (see park_sparse),
+	so their savings hold while the fleet runs. The other savings
+	hold only for idle filters: a step allocates the scratch grid
+	again, and a 16-bit filter becomes dense on its next step or
+	read. enforce() is therefore meant to be called periodically,
+	e.g. once per service round, and the budget caps an actively
+	stepping fleet only as far as its filters are sparse. It must
+	run on the thread that steps the filters.
+*/
+class MemoryGovernor {
+public:
+	size_t budget_bytes;
+
+	// Cells at or below this belief are dropped by sparse parking.
+	float sparse_cutoff;
+
+	MemoryGovernor(size_t budget_bytes);
+
+	void add(HistogramFilter* filter, const std::string& name);
+	void remove(HistogramFilter* filter);
+
+	// Memory of all registered filters, by use.
+	FilterMemory usage() const;
+
+	/**
+	    Degrades filters until the fleet fits the budget or nothing is
+	    left to degrade. Returns what was done, in order; the fleet may
+	    still be over budget when the maps alone exceed it.
+	*/
+	std::vector <DegradedFilter> enforce();
+
+private:
+	std::vector <HistogramFilter*> filters;
+	std::vector <std::string> names;
+};
+
+#endif /* MEMORY_GOVERNOR_H */
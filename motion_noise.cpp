@@ -0,0 +1,125 @@
+/**
+	motion_noise.cpp
+
+	Purpose: spatially varying motion noise. Each cell of the map
+	belongs to a motion class with its own blurring value (e.g. a
+	slippery zone), stored as a one-byte class plane next to the
+	color planes.
+
+	Unlike the uniform blur, a per-source window is not symmetric
+	across cells, so the blur is done in scatter form, as in blur().
+	To stay vectorizable each row is cut into runs of same-class
+	cells, and every run scatters into the three output rows with
+	uniform weights using vector multiply-adds.
+*/
+
+#include <vector>
+#include <string>
+#include "motion_noise.h"
+#include "kernels.h"
+#include "helpers.h"
+
+using namespace std;
+
+bool set_motion_classes(CompiledMap& map, const vector < vector <char> >& classes,
+	const vector <float>& class_blurring)
+{
+	// every class id indexes class_blurring in the blur kernel, so all are checked first
+	if ((int) classes.size() != map.height) {
+		return false;
+	}
+	for (int i = 0; i < map.height; i++) {
+		if ((int) classes[i].size() != map.width) {
+			return false;
+		}
+		for (int j = 0; j < map.width; j++) {
+			int id = classes[i][j] - '0';
+			if (id < 0 || id > 9 || id >= (int) class_blurring.size()) {
+				return false;
+			}
+		}
+	}
+
+	map.motion_classes.resize((size_t) map.height * map.width);
+	for (int i = 0; i < map.height; i++) {
+		for (int j = 0; j < map.width; j++) {
+			map.motion_classes[(size_t) i * map.width + j] = (unsigned char) (classes[i][j] - '0');
+		}
+	}
+	map.class_blurring = class_blurring;
+	return true;
+}
+
+bool read_motion_classes(CompiledMap& map, string file_name, const vector <float>& class_blurring) {
+	return set_motion_classes(map, read_map(file_name), class_blurring);
+}
+
+/**
+    Scatters the cells [begin, end) of one input row into one output
+    row: on_cell times each value lands on the same column, and
+    to_sides times it lands on the columns to its left and right,
+    wrapping cyclically.
+*/
+void scatter_run(float* out, const float* in, int begin, int end, int width,
+	float on_cell, float to_sides)
+{
+	axpy_kernel(out + begin, in + begin, on_cell, end - begin);
+
+	// to the left: column j - 1
+	int first = begin > 0 ? begin : 1;
+	if (end > first) {
+		axpy_kernel(out + first - 1, in + first, to_sides, end - first);
+	}
+	if (begin == 0) {
+		out[width - 1] += to_sides * in[0];
+	}
+
+	// to the right: column j + 1
+	int last = end < width - 1 ? end : width - 1;
+	if (last > begin) {
+		axpy_kernel(out + begin + 1, in + begin, to_sides, last - begin);
+	}
+	if (end == width) {
+		out[0] += to_sides * in[width - 1];
+	}
+}
+
+/**
+    Blurs with per-cell motion classes.
+
+    @param in - height * width beliefs.
+
+    @param out - height * width floats receiving the blurred,
+    	   unnormalized beliefs.
+
+    @param classes - the motion class of every cell.
+
+    @param class_blurring - the blurring value of every class.
+*/
+void blur_classes_kernel(const float* in, float* out, int height, int width,
+	const unsigned char* classes, const float* class_blurring)
+{
+	memset(out, 0, (size_t) height * width * sizeof(float));
+
+	for (int i = 0; i < height; i++) {
+		const float* row = in + (size_t) i * width;
+		const unsigned char* row_classes = classes + (size_t) i * width;
+		float* up = out + (size_t) ((i - 1 + height) % height) * width;
+		float* mid = out + (size_t) i * width;
+		float* down = out + (size_t) ((i + 1) % height) * width;
+
+		int begin = 0;
+		while (begin < width) {
+			int end = begin + 1;
+			while (end < width && row_classes[end] == row_classes[begin]) {
+				end++;
+			}
+
+			BlurWeights w = blur_weights(class_blurring[row_classes[begin]]);
+			scatter_run(up, row, begin, end, width, w.adjacent, w.corner);
+			scatter_run(mid, row, begin, end, width, w.center, w.adjacent);
+			scatter_run(down, row, begin, end, width, w.adjacent, w.corner);
+			begin = end;
+		}
+	}
+}
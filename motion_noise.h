@@ -0,0 +1,34 @@
+#ifndef MOTION_NOISE_H
+#define MOTION_NOISE_H
+
+#include <vector>
+#include <string>
+#include "compiled_map.h"
+
+/**
+    Gives a compiled map per-cell motion noise: classes holds one
+    class digit ('0' to '9') per cell, and class_blurring the blurring
+    value of each class. Returns false, leaving the map unchanged,
+    when the dimensions differ from the map's or a cell is not the
+    digit of a class in class_blurring.
+*/
+bool set_motion_classes(CompiledMap& map, const std::vector < std::vector <char> >& classes,
+	const std::vector <float>& class_blurring);
+
+/**
+    Reads a motion class file (same layout as a map file, one digit
+    per cell) and attaches it to a compiled map. Returns false when
+    the file is missing or set_motion_classes rejects it.
+*/
+bool read_motion_classes(CompiledMap& map, std::string file_name,
+	const std::vector <float>& class_blurring);
+
+/**
+    Blurs a cyclic grid where every cell spreads its probability with
+    the window of its own motion class. Does not normalize; out must
+    not alias in.
+*/
+void blur_classes_kernel(const float* in, float* out, int height, int width,
+	const unsigned char* classes, const float* class_blurring);
+
+#endif /* MOTION_NOISE_H */
@@ -0,0 +1,201 @@
+/**
+	numeric_health.cpp
+
+	Purpose: cheap checks for denormal, zero and non-finite belief
+	cells, and control of denormal flushing. Cells are classified by
+	vector compares, so a check costs about as much as one extra
+	read of the grid.
+*/
+
+#include <string>
+#include <iostream>
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+#include "numeric_health.h"
+#include "kernels.h"
+#include "simd.h"
+
+#ifdef LOCALIZER_HAS_MXCSR
+#include <xmmintrin.h>
+#endif
+
+using namespace std;
+
+void HealthCounts::add(const HealthCounts& other) {
+	zeros += other.zeros;
+	denormals += other.denormals;
+	nans += other.nans;
+	infinities += other.infinities;
+	tiny += other.tiny;
+}
+
+// Classifies cells one by one from their bits; used when some are not finite.
+void classify_bits(const float* cells, int count, float floor, HealthCounts& counts) {
+	for (int k = 0; k < count; k++) {
+		uint32_t bits;
+		memcpy(&bits, &cells[k], sizeof(bits));
+		uint32_t exponent = bits & 0x7f800000u;
+		uint32_t mantissa = bits & 0x007fffffu;
+		counts.zeros += exponent == 0 && mantissa == 0;
+		counts.denormals += exponent == 0 && mantissa != 0;
+		counts.infinities += exponent == 0x7f800000u && mantissa == 0;
+		counts.nans += exponent == 0x7f800000u && mantissa != 0;
+		counts.tiny += cells[k] > 0.0f && cells[k] < floor;
+	}
+}
+
+/**
+    Adds the classes of count cells to the counts. Beliefs are never
+    negative, so three vector compares per cell give every class of
+    finite cells: positive, below FLT_MIN (zero or denormal) and below
+    the floor. A running sum of v * 0 turns NaN when a cell is not
+    finite, and only then are the cells classified from their bits.
+    Lane counts are floats, exact up to 2^24, so grids are counted in
+    blocks. Under DAZ denormal cells count as zeros.
+*/
+void classify(const float* cells, int count, float floor, HealthCounts& counts) {
+	const int BLOCK = 1 << 22;
+	simd_float zero(0.0f), normal(FLT_MIN), low(floor);
+	for (int begin = 0; begin < count; begin += BLOCK) {
+		int end = count - begin < BLOCK ? count : begin + BLOCK;
+		simd_float positive(0.0f), subnormal(0.0f), below(0.0f), poison(0.0f);
+		int k = begin;
+		for (; k + SIMD_WIDTH <= end; k += SIMD_WIDTH) {
+			simd_float v = simd_load(cells + k);
+			positive += simd_below(zero, v);
+			subnormal += simd_below(v, normal);
+			below += simd_below(v, low);
+			poison += v * zero;
+		}
+		long positives = simd_reduce(positive), subnormals = simd_reduce(subnormal);
+		long belows = simd_reduce(below);
+		float poisoned = simd_reduce(poison);
+		for (; k < end; k++) {
+			positives += cells[k] > 0.0f;
+			subnormals += cells[k] < FLT_MIN;
+			belows += cells[k] < floor;
+			poisoned += cells[k] * 0.0f;
+		}
+
+		if (poisoned != 0.0f) {
+			classify_bits(cells + begin, end - begin, floor, counts);
+			continue;
+		}
+		long zeros = (end - begin) - positives;
+		counts.zeros += zeros;
+		counts.denormals += subnormals - zeros;
+		counts.tiny += floor > 0.0f ? belows - zeros : 0;
+	}
+}
+
+HealthCounts scan_health(const float* cells, int count, float floor) {
+	HealthCounts counts = {0, 0, 0, 0, 0};
+	classify(cells, count, floor, counts);
+	return counts;
+}
+
+float normalize_and_scan(float* cells, int count, float floor, HealthCounts& counts) {
+	// blocks stay in cache between scaling, classifying and flooring
+	const int BLOCK = 4096;
+	float total = grid_sum(cells, count);
+	float factor = total != 0.0 ? 1.0f / total : 1.0f;
+	counts = HealthCounts();
+	for (int begin = 0; begin < count; begin += BLOCK) {
+		int length = count - begin < BLOCK ? count - begin : BLOCK;
+		scale_kernel(cells + begin, length, factor);
+		scan_and_floor(cells + begin, length, floor, counts);
+	}
+	return total;
+}
+
+long floor_cells(float* cells, int count, float floor) {
+	long raised = 0;
+	for (int k = 0; k < count; k++) {
+		if (cells[k] > 0.0f && cells[k] < floor) {
+			cells[k] = floor;
+			raised++;
+		}
+	}
+	return raised;
+}
+
+void scan_and_floor(float* cells, int count, float floor, HealthCounts& counts) {
+	long tiny = counts.tiny;
+	classify(cells, count, floor, counts);
+	if (counts.tiny > tiny) {
+		floor_cells(cells, count, floor);
+	}
+}
+
+void write_health_metrics(ostream& out, const HealthMetrics& metrics, const string& name) {
+	string label = "{filter=\"" + name + "\"}";
+	out << "localizer_health_passes_total" << label << ' ' << metrics.passes << '\n';
+	out << "localizer_zero_cells" << label << ' ' << metrics.last.zeros << '\n';
+	out << "localizer_denormal_cells" << label << ' ' << metrics.last.denormals << '\n';
+	out << "localizer_nan_cells" << label << ' ' << metrics.last.nans << '\n';
+	out << "localizer_infinite_cells" << label << ' ' << metrics.last.infinities << '\n';
+	out << "localizer_denormal_cells_total" << label << ' ' << metrics.total.denormals << '\n';
+	out << "localizer_nan_cells_total" << label << ' ' << metrics.total.nans << '\n';
+	out << "localizer_infinite_cells_total" << label << ' ' << metrics.total.infinities << '\n';
+	out << "localizer_floored_cells_total" << label << ' ' << metrics.floored << '\n';
+	out << "localizer_belief_resets_total" << label << ' ' << metrics.resets << '\n';
+}
+
+#if defined(LOCALIZER_HAS_MXCSR)
+
+// flush to zero (FTZ) and denormals are zero (DAZ)
+const unsigned FLUSH_DENORMAL_BITS = 0x8040;
+
+unsigned float_mode() {
+	return _mm_getcsr();
+}
+
+void set_float_mode(unsigned mode) {
+	_mm_setcsr(mode);
+}
+
+#elif defined(LOCALIZER_HAS_FPCR)
+
+// FZ, which on AArch64 flushes both denormal inputs and results
+const unsigned FLUSH_DENORMAL_BITS = 1u << 24;
+
+unsigned float_mode() {
+	uint64_t fpcr;
+	__asm__ __volatile__ ("mrs %0, fpcr" : "=r" (fpcr));
+	return (unsigned) fpcr;
+}
+
+void set_float_mode(unsigned mode) {
+	uint64_t fpcr = mode;
+	__asm__ __volatile__ ("msr fpcr, %0" : : "r" (fpcr));
+}
+
+#else
+
+const unsigned FLUSH_DENORMAL_BITS = 0;
+
+unsigned float_mode() {
+	return 0;
+}
+
+void set_float_mode(unsigned) {
+}
+
+#endif
+
+bool flush_denormals_supported() {
+	return FLUSH_DENORMAL_BITS != 0;
+}
+
+FlushDenormals::FlushDenormals(bool enabled) : saved(float_mode()) {
+	if (enabled && flush_denormals_supported()) {
+		set_float_mode(saved | FLUSH_DENORMAL_BITS);
+	}
+}
+
+FlushDenormals::~FlushDenormals() {
+	if (flush_denormals_supported()) {
+		set_float_mode(saved);
+	}
+}
@@ -0,0 +1,96 @@
+#ifndef NUMERIC_HEALTH_H
+#define NUMERIC_HEALTH_H
+
+#include <string>
+#include <iostream>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define LOCALIZER_HAS_MXCSR 1
+#elif defined(__aarch64__)
+#define LOCALIZER_HAS_FPCR 1
+#endif
+
+// Default floor for belief cells: far above the denormal range (below 1.2e-38).
+const float DEFAULT_BELIEF_FLOOR = 1e-30f;
+
+// How many cells of a grid fell in each class.
+struct HealthCounts {
+	long zeros;
+	long denormals;
+	long nans;
+	long infinities;
+	// positive cells below the floor, denormals included
+	long tiny;
+
+	void add(const HealthCounts& other);
+};
+
+// Health of a filter's beliefs over its life.
+struct HealthMetrics {
+	// steps checked
+	long passes;
+	// counts of the last step, and summed over all steps
+	HealthCounts last;
+	HealthCounts total;
+	// cells raised to the floor
+	long floored;
+	// times the beliefs were lost (NaN, infinite or all zero) and restarted from uniform
+	long resets;
+};
+
+// Classifies count cells by their bits; tiny counts the cells in (0, floor).
+HealthCounts scan_health(const float* cells, int count, float floor);
+
+/**
+    Normalizes count cells, classifying each block into counts and
+    raising its cells in (0, floor) to floor while it is still in
+    cache, so the grid is read once for the total and once for the
+    rest. Returns the total before normalizing.
+*/
+float normalize_and_scan(float* cells, int count, float floor, HealthCounts& counts);
+
+// Raises the cells in (0, floor) to floor. Returns how many there were.
+long floor_cells(float* cells, int count, float floor);
+
+/**
+    Adds the classes of count cells to counts, then raises the cells
+    in (0, floor) to floor, counts.tiny of them. The normalize passes
+    that build summed-area tables or active sets call it on each
+    block before using it, so those see the floored cells.
+*/
+void scan_and_floor(float* cells, int count, float floor, HealthCounts& counts);
+
+/**
+    Writes metrics in the Prometheus text format, one line per
+    counter, labelled filter="name".
+*/
+void write_health_metrics(std::ostream& out, const HealthMetrics& metrics, const std::string& name);
+
+// The calling thread's floating-point control word (MXCSR or FPCR), or 0 where unknown.
+unsigned float_mode();
+
+// Restores a control word returned by float_mode.
+void set_float_mode(unsigned mode);
+
+// True when this target can flush denormals to zero.
+bool flush_denormals_supported();
+
+/**
+	Flushes denormal results to zero and treats denormal inputs as
+	zero (FTZ / DAZ) on the calling thread for the lifetime of the
+	object, then restores the previous mode. Kernel workers (see
+	parallel.h) take on the mode of the thread that starts each job,
+	so a guard on the filter thread covers its threaded steps too.
+*/
+class FlushDenormals {
+public:
+	explicit FlushDenormals(bool enabled = true);
+	~FlushDenormals();
+
+private:
+	unsigned saved;
+	FlushDenormals(const FlushDenormals&);
+	FlushDenormals& operator=(const FlushDenormals&);
+};
+
+#endif /* NUMERIC_HEALTH_H */
@@ -0,0 +1,160 @@
+/**
+	parallel.cpp
+
+	Purpose: a small persistent worker pool for the row-parallel
+	kernels. Threads are started once and woken per job, so a step
+	pays a wake-up, not a thread creation.
+*/
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include "parallel.h"
+#include "realtime.h"
+#include "numeric_health.h"
+
+using namespace std;
+
+ParallelConfig default_parallel_config() {
+	ParallelConfig config;
+	config.threads = 1;
+	config.min_cells = 1 << 18;
+	config.fifo_priority = 0;
+	return config;
+}
+
+ParallelConfig parallel_config = default_parallel_config();
+
+WorkerPool::WorkerPool(int threads, const vector <int>& cores, int fifo_priority) :
+	cores(cores), fifo_priority(fifo_priority), job(NULL), job_tasks(0), job_float_mode(0), next_task(0), running(0),
+	generation(0), stopping(false)
+{
+	for (int t = 1; t < threads; t++) {
+		workers.push_back(thread(&WorkerPool::work, this, t));
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		lock_guard <mutex> guard (lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t t = 0; t < workers.size(); t++) {
+		workers[t].join();
+	}
+}
+
+int WorkerPool::size() const {
+	return workers.size() + 1;
+}
+
+bool WorkerPool::matches(const ParallelConfig& config) const {
+	return size() == config.threads && cores == config.cores && fifo_priority == config.fifo_priority;
+}
+
+void WorkerPool::drain() {
+	for (int k = next_task++; k < job_tasks; k = next_task++) {
+		(*job)(k);
+	}
+}
+
+void WorkerPool::work(int index) {
+	if (!cores.empty()) {
+		pin_thread(cores[index % cores.size()]);
+	}
+	if (fifo_priority > 0) {
+		set_fifo_priority(fifo_priority);
+	}
+
+	unsigned long seen = 0;
+	unsigned mode = float_mode();
+	while (true) {
+		unsigned job_mode;
+		{
+			unique_lock <mutex> guard (lock);
+			wake.wait(guard, [&]() { return stopping || generation != seen; });
+			if (stopping) {
+				return;
+			}
+			seen = generation;
+			job_mode = job_float_mode;
+		}
+		if (job_mode != mode) {
+			set_float_mode(job_mode);
+			mode = job_mode;
+		}
+		drain();
+		{
+			lock_guard <mutex> guard (lock);
+			if (--running == 0) {
+				done.notify_one();
+			}
+		}
+	}
+}
+
+void WorkerPool::run(int tasks, const function <void(int)>& task) {
+	unique_lock <mutex> exclusive (busy, try_to_lock);
+	if (!exclusive.owns_lock() || workers.empty()) {
+		for (int k = 0; k < tasks; k++) {
+			task(k);
+		}
+		return;
+	}
+
+	{
+		lock_guard <mutex> guard (lock);
+		job = &task;
+		job_tasks = tasks;
+		job_float_mode = float_mode();
+		next_task = 0;
+		running = workers.size();
+		generation++;
+	}
+	wake.notify_all();
+	drain();
+
+	unique_lock <mutex> guard (lock);
+	done.wait(guard, [&]() { return running == 0; });
+	job = NULL;
+}
+
+int parallel_tasks(size_t cells) {
+	if (parallel_config.threads <= 1 || cells < parallel_config.min_cells) {
+		return 1;
+	}
+	return parallel_config.threads;
+}
+
+/**
+    Runs a job on the shared kernel pool, which is rebuilt when
+    parallel_config changes. Jobs still running on the old
+    pool keep it alive until they finish.
+*/
+void parallel_for(int tasks, size_t cells, const function <void(int)>& task) {
+	static shared_ptr <WorkerPool> pool;
+	static mutex rebuild;
+
+	if (parallel_tasks(cells) == 1 || tasks <= 1) {
+		for (int k = 0; k < tasks; k++) {
+			task(k);
+		}
+		return;
+	}
+
+	shared_ptr <WorkerPool> current;
+	{
+		lock_guard <mutex> guard (rebuild);
+		if (!pool || !pool->matches(parallel_config)) {
+			pool = make_shared <WorkerPool> (parallel_config.threads, parallel_config.cores,
+				parallel_config.fifo_priority);
+		}
+		current = pool;
+	}
+	current->run(tasks, task);
+}
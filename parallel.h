@@ -0,0 +1,84 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+/**
+	Settings for splitting move, blur and sense across threads.
+	Grids smaller than min_cells always run on the calling thread.
+	Worker w (the caller is worker 0) is pinned to core
+	cores[w % cores.size()] and, when fifo_priority is above 0, runs
+	under SCHED_FIFO (see realtime.h).
+*/
+struct ParallelConfig {
+	int threads;
+	size_t min_cells;
+	std::vector <int> cores;
+	int fifo_priority;
+};
+
+// Single-threaded defaults; a tuning profile (see tuning.h) may raise them.
+ParallelConfig default_parallel_config();
+
+// The settings used by the kernels; may be replaced at startup.
+extern ParallelConfig parallel_config;
+
+/**
+	A fixed set of threads that run the tasks of one job at a time.
+	The calling thread works on the job too, so a pool of size n
+	starts n - 1 threads.
+*/
+class WorkerPool {
+public:
+	WorkerPool(int threads, const std::vector <int>& cores = std::vector <int> (), int fifo_priority = 0);
+	~WorkerPool();
+
+	int size() const;
+
+	// True when the pool was built for these settings.
+	bool matches(const ParallelConfig& config) const;
+
+	/**
+	    Runs task(0) ... task(tasks - 1) and returns when all are done.
+	    If another job is running, the tasks run on the calling thread.
+	    Workers run the tasks in the caller's floating-point mode (see
+	    FlushDenormals in numeric_health.h).
+	*/
+	void run(int tasks, const std::function <void(int)>& task);
+
+private:
+	std::vector <std::thread> workers;
+	std::vector <int> cores;
+	int fifo_priority;
+	std::mutex busy;
+	std::mutex lock;
+	std::condition_variable wake, done;
+	const std::function <void(int)>* job;
+	int job_tasks;
+	unsigned job_float_mode;
+	std::atomic <int> next_task;
+	int running;
+	unsigned long generation;
+	bool stopping;
+
+	void work(int index);
+	void drain();
+};
+
+/**
+    Calls task(k) for k in [0, tasks) on up to parallel_config.threads
+    threads when cells reaches parallel_config.min_cells, else in order
+    on the calling thread.
+*/
+void parallel_for(int tasks, size_t cells, const std::function <void(int)>& task);
+
+// How many tasks parallel_for would run at once for this many cells.
+int parallel_tasks(size_t cells);
+
+#endif /* PARALLEL_H */
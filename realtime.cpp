@@ -0,0 +1,92 @@
+/**
+	realtime.cpp
+
+	Purpose: real-time execution mode for the filter thread. On
+	Linux, pinning uses sched_setaffinity, SCHED_FIFO uses
+	sched_setscheduler and memory locking uses mlockall; elsewhere
+	every call reports failure and the filter runs normally.
+*/
+
+#include <vector>
+#include <stddef.h>
+#include "realtime.h"
+#include "parallel.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#define LOCALIZER_HAS_REALTIME 1
+#endif
+
+using namespace std;
+
+RealtimeConfig default_realtime_config() {
+	RealtimeConfig config;
+	config.fifo_priority = 0;
+	config.lock_memory = false;
+	return config;
+}
+
+bool pin_thread(int core) {
+#ifdef LOCALIZER_HAS_REALTIME
+	if (core < 0 || core >= CPU_SETSIZE) {
+		return false;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+bool set_fifo_priority(int priority) {
+#ifdef LOCALIZER_HAS_REALTIME
+	struct sched_param param;
+	param.sched_priority = priority;
+	return sched_setscheduler(0, SCHED_FIFO, &param) == 0;
+#else
+	return false;
+#endif
+}
+
+bool lock_memory() {
+#ifdef LOCALIZER_HAS_REALTIME
+	return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+#else
+	return false;
+#endif
+}
+
+void prefault(const void* data, size_t bytes) {
+	if (data == NULL || bytes == 0) {
+		return;
+	}
+	size_t page = 4096;
+#ifdef LOCALIZER_HAS_REALTIME
+	page = sysconf(_SC_PAGESIZE);
+#endif
+
+	// a read is enough: written buffers are already private pages
+	const volatile char* p = (const volatile char*) data;
+	char sink = 0;
+	for (size_t offset = 0; offset < bytes; offset += page) {
+		sink ^= p[offset];
+	}
+	sink ^= p[bytes - 1];
+	(void) sink;
+}
+
+RealtimeStatus enter_realtime(const RealtimeConfig& config) {
+	RealtimeStatus status;
+	status.pinned = config.cores.empty() || pin_thread(config.cores[0]);
+	status.fifo = config.fifo_priority <= 0 || set_fifo_priority(config.fifo_priority);
+	status.locked = !config.lock_memory || lock_memory();
+
+	// workers take the remaining cores and the same priority when the pool is rebuilt
+	parallel_config.cores = config.cores;
+	parallel_config.fifo_priority = config.fifo_priority;
+	return status;
+}
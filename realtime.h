@@ -0,0 +1,51 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <vector>
+#include <stddef.h>
+
+/**
+	Settings for running the filter thread (and the kernel workers,
+	see parallel.h) with bounded step latency: pin them to cores so
+	they never migrate, optionally run them under SCHED_FIFO, and
+	lock all memory so that no step takes a page fault.
+*/
+struct RealtimeConfig {
+	// Cores the filter thread and workers are pinned to, round-robin; empty leaves them free.
+	std::vector <int> cores;
+	// SCHED_FIFO priority (1 to 99), or 0 to keep the normal scheduler.
+	int fifo_priority;
+	// Lock current and future memory with mlockall.
+	bool lock_memory;
+};
+
+// No pinning, normal scheduling, memory not locked.
+RealtimeConfig default_realtime_config();
+
+// Which parts of a RealtimeConfig took effect; each can fail without privileges.
+struct RealtimeStatus {
+	bool pinned;
+	bool fifo;
+	bool locked;
+};
+
+// Pins the calling thread to one core. Returns false when not supported or refused.
+bool pin_thread(int core);
+
+// Runs the calling thread under SCHED_FIFO. Returns false when not supported or refused.
+bool set_fifo_priority(int priority);
+
+// Locks current and future pages of the process. Returns false when refused.
+bool lock_memory();
+
+// Touches every page of a buffer so it is resident before the first step.
+void prefault(const void* data, size_t bytes);
+
+/**
+    Applies a config to the calling thread (pinned to cores[0]) and,
+    through parallel_config, to the kernel workers (pinned to
+    cores[1], cores[2], ...).
+*/
+RealtimeStatus enter_realtime(const RealtimeConfig& config);
+
+#endif /* REALTIME_H */
@@ -0,0 +1,418 @@
+/**
+	replay.cpp
+
+	Purpose: offline replay of event logs through a filter. The
+	pipelined replay runs decoding, filter steps and result encoding
+	as three C++20 coroutines on a small thread executor. Stages hand
+	batches of events to each other through bounded channels: a stage
+	that gets ahead suspends on a full channel instead of blocking a
+	thread, so replay runs at the speed of the slowest stage rather
+	than the sum of all three.
+*/
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <chrono>
+#include "replay.h"
+
+#ifdef LOCALIZER_HAS_COROUTINES
+#include <coroutine>
+#include <optional>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#endif
+
+using namespace std;
+
+bool parse_replay_event(const string& line, ReplayEvent& event) {
+	istringstream fields(line);
+	string kind;
+	if (!(fields >> kind) || kind[0] == '#') {
+		return false;
+	}
+	event.kind = kind[0];
+	event.color = 0;
+	event.dy = event.dx = 0;
+	if (kind == "S") {
+		return (bool) (fields >> event.color);
+	}
+	if (kind == "M") {
+		return (bool) (fields >> event.dy >> event.dx);
+	}
+	return false;
+}
+
+ReplayResult apply_replay_event(HistogramFilter& filter, const ReplayEvent& event, long index) {
+	if (event.kind == 'S') {
+		filter.sense(event.color);
+	}
+	else {
+		filter.move(event.dy, event.dx);
+	}
+
+	const float* beliefs = filter.beliefs();
+	int area = filter.map.height * filter.map.width;
+	int best = 0;
+	for (int k = 1; k < area; k++) {
+		if (beliefs[k] > beliefs[best]) {
+			best = k;
+		}
+	}
+	ReplayResult result = {index, best / filter.map.width, best % filter.map.width, beliefs[best]};
+	return result;
+}
+
+void write_replay_result(ostream& out, const ReplayResult& result) {
+	out << result.index << ' ' << result.row << ' ' << result.col << ' ' << result.belief << '\n';
+}
+
+double seconds_since(chrono::steady_clock::time_point start) {
+	return chrono::duration<double> (chrono::steady_clock::now() - start).count();
+}
+
+ReplayReport replay_sequential(istream& log, HistogramFilter& filter, ostream& out) {
+	StageStats decode = {"decode", 0, 0.0};
+	StageStats step = {"filter", 0, 0.0};
+	StageStats encode = {"encode", 0, 0.0};
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	string line;
+	while (true) {
+		chrono::steady_clock::time_point t = chrono::steady_clock::now();
+		ReplayEvent event;
+		bool more = false;
+		while (getline(log, line)) {
+			if (parse_replay_event(line, event)) {
+				more = true;
+				break;
+			}
+		}
+		decode.busy_seconds += seconds_since(t);
+		if (!more) {
+			break;
+		}
+		decode.items++;
+
+		t = chrono::steady_clock::now();
+		ReplayResult result = apply_replay_event(filter, event, step.items);
+		step.items++;
+		step.busy_seconds += seconds_since(t);
+
+		t = chrono::steady_clock::now();
+		write_replay_result(out, result);
+		encode.items++;
+		encode.busy_seconds += seconds_since(t);
+	}
+
+	ReplayReport report;
+	report.events = step.items;
+	report.seconds = seconds_since(start);
+	report.stages.push_back(decode);
+	report.stages.push_back(step);
+	report.stages.push_back(encode);
+	return report;
+}
+
+#ifdef LOCALIZER_HAS_COROUTINES
+
+// Resumes coroutines on a fixed set of threads.
+class ReplayExecutor {
+public:
+	ReplayExecutor(int threads) : stopping(false) {
+		for (int t = 0; t < threads; t++) {
+			workers.push_back(thread(&ReplayExecutor::work, this));
+		}
+	}
+
+	~ReplayExecutor() {
+		{
+			lock_guard <mutex> guard (lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (size_t t = 0; t < workers.size(); t++) {
+			workers[t].join();
+		}
+	}
+
+	void schedule(coroutine_handle <> handle) {
+		{
+			lock_guard <mutex> guard (lock);
+			ready.push_back(handle);
+		}
+		wake.notify_one();
+	}
+
+private:
+	vector <thread> workers;
+	mutex lock;
+	condition_variable wake;
+	deque < coroutine_handle <> > ready;
+	bool stopping;
+
+	void work() {
+		while (true) {
+			coroutine_handle <> handle;
+			{
+				unique_lock <mutex> guard (lock);
+				wake.wait(guard, [&]() { return stopping || !ready.empty(); });
+				if (ready.empty()) {
+					return;
+				}
+				handle = ready.front();
+				ready.pop_front();
+			}
+			handle.resume();
+		}
+	}
+};
+
+// A fire-and-forget coroutine; it starts once scheduled and frees itself when done.
+struct StageTask {
+	struct promise_type {
+		StageTask get_return_object() {
+			return StageTask {coroutine_handle <promise_type>::from_promise(*this)};
+		}
+		suspend_always initial_suspend() noexcept { return {}; }
+		suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { terminate(); }
+	};
+	coroutine_handle <promise_type> handle;
+};
+
+// Counts finished stages; the replay returns when all are done.
+class StageLatch {
+public:
+	StageLatch(int count) : remaining(count) {}
+
+	// notifies under the lock, so the waiter cannot free the latch too early
+	void count_down() {
+		lock_guard <mutex> guard (lock);
+		if (--remaining == 0) {
+			done.notify_all();
+		}
+	}
+
+	void wait() {
+		unique_lock <mutex> guard (lock);
+		done.wait(guard, [&]() { return remaining == 0; });
+	}
+
+private:
+	mutex lock;
+	condition_variable done;
+	int remaining;
+};
+
+/**
+	A bounded channel between two stages. push() suspends the
+	producer while capacity items are queued and pop() suspends the
+	consumer while none are; the suspended side is resumed on the
+	executor by the other side. One producer and one consumer.
+*/
+template <typename T>
+class ReplayChannel {
+public:
+	ReplayChannel(size_t capacity, ReplayExecutor& executor) :
+		executor(executor), capacity(capacity), closed(false), pending_push(NULL), pending_pop(NULL) {}
+
+	struct PushAwaiter {
+		ReplayChannel& channel;
+		T value;
+
+		bool await_ready() { return false; }
+		bool await_suspend(coroutine_handle <> handle) { return channel.suspend_push(handle, value); }
+		void await_resume() {}
+	};
+
+	struct PopAwaiter {
+		ReplayChannel& channel;
+		optional <T> value;
+
+		bool await_ready() { return false; }
+		bool await_suspend(coroutine_handle <> handle) { return channel.suspend_pop(handle, value); }
+		optional <T> await_resume() { return std::move(value); }
+	};
+
+	PushAwaiter push(T value) {
+		return PushAwaiter {*this, std::move(value)};
+	}
+
+	// Resumes with no value once the channel is closed and drained.
+	PopAwaiter pop() {
+		return PopAwaiter {*this, optional <T> ()};
+	}
+
+	void close() {
+		coroutine_handle <> popper;
+		{
+			lock_guard <mutex> guard (lock);
+			closed = true;
+			popper = waiting_popper;
+			waiting_popper = nullptr;
+		}
+		if (popper) {
+			executor.schedule(popper);
+		}
+	}
+
+private:
+	ReplayExecutor& executor;
+	mutex lock;
+	deque <T> items;
+	size_t capacity;
+	bool closed;
+	coroutine_handle <> waiting_pusher, waiting_popper;
+	T* pending_push;
+	optional <T>* pending_pop;
+
+	// Returns true when the producer must wait.
+	bool suspend_push(coroutine_handle <> handle, T& value) {
+		coroutine_handle <> popper;
+		{
+			lock_guard <mutex> guard (lock);
+			if (waiting_popper) {
+				*pending_pop = std::move(value);
+				popper = waiting_popper;
+				waiting_popper = nullptr;
+			}
+			else if (items.size() < capacity) {
+				items.push_back(std::move(value));
+				return false;
+			}
+			else {
+				waiting_pusher = handle;
+				pending_push = &value;
+				return true;
+			}
+		}
+		executor.schedule(popper);
+		return false;
+	}
+
+	// Returns true when the consumer must wait.
+	bool suspend_pop(coroutine_handle <> handle, optional <T>& value) {
+		coroutine_handle <> pusher;
+		{
+			lock_guard <mutex> guard (lock);
+			if (!items.empty()) {
+				value = std::move(items.front());
+				items.pop_front();
+				if (waiting_pusher) {
+					items.push_back(std::move(*pending_push));
+				}
+			}
+			else if (waiting_pusher) {
+				value = std::move(*pending_push);
+			}
+			else if (!closed) {
+				waiting_popper = handle;
+				pending_pop = &value;
+				return true;
+			}
+			pusher = waiting_pusher;
+			waiting_pusher = nullptr;
+		}
+		if (pusher) {
+			executor.schedule(pusher);
+		}
+		return false;
+	}
+};
+
+typedef vector <ReplayEvent> EventBatch;
+typedef vector <ReplayResult> ResultBatch;
+
+StageTask decode_stage(istream& log, ReplayChannel <EventBatch>& out, int batch,
+	StageStats& stats, StageLatch& done)
+{
+	string line;
+	while (true) {
+		chrono::steady_clock::time_point t = chrono::steady_clock::now();
+		EventBatch events;
+		events.reserve(batch);
+		ReplayEvent event;
+		while ((int) events.size() < batch && getline(log, line)) {
+			if (parse_replay_event(line, event)) {
+				events.push_back(event);
+			}
+		}
+		stats.items += events.size();
+		stats.busy_seconds += seconds_since(t);
+		if (events.empty()) {
+			break;
+		}
+		co_await out.push(std::move(events));
+	}
+	out.close();
+	done.count_down();
+}
+
+StageTask filter_stage(HistogramFilter& filter, ReplayChannel <EventBatch>& in,
+	ReplayChannel <ResultBatch>& out, StageStats& stats, StageLatch& done)
+{
+	while (optional <EventBatch> events = co_await in.pop()) {
+		chrono::steady_clock::time_point t = chrono::steady_clock::now();
+		ResultBatch results;
+		results.reserve(events->size());
+		for (size_t e = 0; e < events->size(); e++) {
+			results.push_back(apply_replay_event(filter, (*events)[e], stats.items++));
+		}
+		stats.busy_seconds += seconds_since(t);
+		co_await out.push(std::move(results));
+	}
+	out.close();
+	done.count_down();
+}
+
+StageTask encode_stage(ReplayChannel <ResultBatch>& in, ostream& out, StageStats& stats, StageLatch& done) {
+	while (optional <ResultBatch> results = co_await in.pop()) {
+		chrono::steady_clock::time_point t = chrono::steady_clock::now();
+		ostringstream text;
+		for (size_t r = 0; r < results->size(); r++) {
+			write_replay_result(text, (*results)[r]);
+		}
+		out << text.str();
+		stats.items += results->size();
+		stats.busy_seconds += seconds_since(t);
+	}
+	done.count_down();
+}
+
+ReplayReport replay_pipelined(istream& log, HistogramFilter& filter, ostream& out, int batch, int depth) {
+	ReplayReport report;
+	report.stages.push_back(StageStats {"decode", 0, 0.0});
+	report.stages.push_back(StageStats {"filter", 0, 0.0});
+	report.stages.push_back(StageStats {"encode", 0, 0.0});
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	{
+		ReplayExecutor executor (3);
+		ReplayChannel <EventBatch> events (depth, executor);
+		ReplayChannel <ResultBatch> results (depth, executor);
+		StageLatch done (3);
+
+		executor.schedule(decode_stage(log, events, batch, report.stages[0], done).handle);
+		executor.schedule(filter_stage(filter, events, results, report.stages[1], done).handle);
+		executor.schedule(encode_stage(results, out, report.stages[2], done).handle);
+		done.wait();
+	}
+
+	report.events = report.stages[1].items;
+	report.seconds = seconds_since(start);
+	return report;
+}
+
+#else
+
+ReplayReport replay_pipelined(istream& log, HistogramFilter& filter, ostream& out, int, int) {
+	return replay_sequential(log, filter, out);
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include "histogram_filter.h"
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define LOCALIZER_HAS_COROUTINES 1
+#endif
+#endif
+
+/**
+	One event of a replay log. Logs hold one event per line:
+	"S <color>" for a sensed color and "M <dy> <dx>" for a motion;
+	blank lines and lines starting with '#' are skipped.
+*/
+struct ReplayEvent {
+	char kind;
+	char color;
+	int dy, dx;
+};
+
+// The most likely cell after an event.
+struct ReplayResult {
+	long index;
+	int row, col;
+	float belief;
+};
+
+// Work done by one pipeline stage and the time it spent doing it.
+struct StageStats {
+	std::string name;
+	long items;
+	double busy_seconds;
+};
+
+struct ReplayReport {
+	long events;
+	double seconds;
+	std::vector <StageStats> stages;
+};
+
+// Parses one log line. Returns false for lines that hold no event.
+bool parse_replay_event(const std::string& line, ReplayEvent& event);
+
+// Applies an event to a filter and returns its most likely cell.
+ReplayResult apply_replay_event(HistogramFilter& filter, const ReplayEvent& event, long index);
+
+// Writes a result as "<index> <row> <col> <belief>".
+void write_replay_result(std::ostream& out, const ReplayResult& result);
+
+// Reads, filters and writes one event at a time.
+ReplayReport replay_sequential(std::istream& log, HistogramFilter& filter, std::ostream& out);
+
+/**
+    Replays a log through three coroutine stages (decode, filter,
+    encode) on a small thread executor, with at most depth batches
+    of batch events buffered between two stages. The output is the
+    same as replay_sequential's. Without C++20 coroutines it runs
+    replay_sequential.
+*/
+ReplayReport replay_pipelined(std::istream& log, HistogramFilter& filter, std::ostream& out,
+	int batch = 256, int depth = 4);
+
+#endif /* REPLAY_H */
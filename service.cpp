@@ -0,0 +1,527 @@
+/**
+	service.cpp
+
+	Purpose: a single-threaded epoll loop serving many robots over
+	a Unix domain socket. Requests of robots on the same map are
+	collected into FilterBatch lanes and advanced together, one
+	lane-interleaved sweep per round instead of one pass per robot.
+*/
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include "service.h"
+
+#ifdef LOCALIZER_HAS_EPOLL
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+using namespace std;
+
+// Longest request line accepted; longer input closes the connection.
+const size_t MAX_SERVICE_LINE = 4096;
+
+LocalizationService::LocalizationService(float p_hit, float p_miss, float blurring) :
+	p_hit(p_hit), p_miss(p_miss), blurring(blurring), listen_fd(-1), epoll_fd(-1), stopping(false)
+{
+	stats.clients = stats.requests = stats.sweeps = stats.lanes_swept = 0;
+}
+
+void LocalizationService::add_map(const string& name, const vector < vector <char> >& grid) {
+	ServiceMap& map = maps[name];
+	map.grid = grid;
+}
+
+void LocalizationService::stop() {
+	stopping = true;
+}
+
+void LocalizationService::run() {
+	while (!stopping && poll(100) >= 0) {
+	}
+}
+
+/**
+    Binds a client to a map: the first free lane of the map's
+    batches, or a lane of a new batch when all are taken.
+
+    @return - false when the map is unknown or empty.
+*/
+bool LocalizationService::attach(ServiceClient& client, const string& map_name) {
+	std::map <string, ServiceMap>::iterator found = maps.find(map_name);
+	if (found == maps.end() || found->second.grid.empty() || found->second.grid[0].empty()) {
+		return false;
+	}
+	ServiceMap& map = found->second;
+
+	int batch = -1, lane = -1;
+	for (size_t b = 0; b < map.lanes.size() && batch < 0; b++) {
+		for (int l = 0; l < BATCH_LANES; l++) {
+			if (map.lanes[b][l] < 0) {
+				batch = b;
+				lane = l;
+				break;
+			}
+		}
+	}
+	if (batch < 0) {
+		map.batches.push_back(FilterBatch(map.grid.size(), map.grid[0].size()));
+		map.lanes.push_back(vector <int> (BATCH_LANES, -1));
+		batch = map.batches.size() - 1;
+		lane = 0;
+	}
+
+	map.batches[batch].set_map(lane, map.grid);
+	map.lanes[batch][lane] = client.fd;
+	client.map_name = map_name;
+	client.batch = batch;
+	client.lane = lane;
+	return true;
+}
+
+// Queues one request line, or answers it at once when the client has no map yet.
+void LocalizationService::handle_line(ServiceClient& client, const string& line) {
+	istringstream fields(line);
+	string word;
+	if (!(fields >> word)) {
+		return;
+	}
+
+	if (client.lane < 0) {
+		string name;
+		if (word != "MAP" || !(fields >> name)) {
+			client.output += "ERR expected MAP <name>\n";
+		}
+		else if (!attach(client, name)) {
+			client.output += "ERR unknown map " + name + "\n";
+		}
+		else {
+			const ServiceMap& map = maps[name];
+			ostringstream ok;
+			ok << "OK " << map.grid.size() << ' ' << map.grid[0].size() << '\n';
+			client.output += ok.str();
+		}
+		return;
+	}
+
+	ServiceRequest request;
+	request.kind = 'E';
+	if (word == "B") {
+		request.kind = 'B';
+	}
+	else if (parse_replay_event(line, request.event)) {
+		request.kind = request.event.kind;
+	}
+	else {
+		request.error = "ERR bad request";
+	}
+	client.pending.push_back(request);
+	stats.requests++;
+}
+
+/**
+    Runs one sweep of a batch: the oldest waiting request of every
+    robot in it. Motions are applied in one masked move over all lanes
+    and sensed colors in one masked sense, so a robot with no request
+    of that kind, or a lane with no robot, keeps its beliefs exactly.
+
+    @return - the number of requests answered.
+*/
+int LocalizationService::sweep(ServiceMap& map, int b) {
+	FilterBatch& batch = map.batches[b];
+	ServiceClient* owners[BATCH_LANES] = {NULL};
+	ServiceRequest heads[BATCH_LANES];
+	char sensed[BATCH_LANES] = {0};
+	int dy[BATCH_LANES] = {0}, dx[BATCH_LANES] = {0};
+	bool moving[BATCH_LANES] = {false}, sensing[BATCH_LANES] = {false};
+	bool any_sense = false, any_move = false;
+	int taken = 0, stepped = 0;
+
+	for (int lane = 0; lane < BATCH_LANES; lane++) {
+		int fd = map.lanes[b][lane];
+		if (fd < 0) {
+			continue;
+		}
+		ServiceClient& client = clients[fd];
+		if (client.pending.empty()) {
+			continue;
+		}
+		heads[lane] = client.pending.front();
+		client.pending.pop_front();
+		owners[lane] = &client;
+		taken++;
+
+		if (heads[lane].kind == 'S') {
+			sensing[lane] = true;
+			sensed[lane] = heads[lane].event.color;
+			any_sense = true;
+			stepped++;
+		}
+		else if (heads[lane].kind == 'M') {
+			moving[lane] = true;
+			dy[lane] = heads[lane].event.dy;
+			dx[lane] = heads[lane].event.dx;
+			any_move = true;
+			stepped++;
+		}
+	}
+
+	if (any_move) {
+		batch.move(dy, dx, blurring, moving);
+	}
+	if (any_sense) {
+		batch.sense(sensed, p_hit, p_miss, sensing);
+	}
+	if (stepped > 0) {
+		stats.sweeps++;
+		stats.lanes_swept += stepped;
+	}
+
+	for (int lane = 0; lane < BATCH_LANES; lane++) {
+		if (owners[lane] != NULL) {
+			reply(*owners[lane], heads[lane], batch);
+		}
+	}
+	return taken;
+}
+
+void LocalizationService::reply(ServiceClient& client, const ServiceRequest& request, const FilterBatch& batch) {
+	if (request.kind == 'E') {
+		client.output += request.error + "\n";
+		return;
+	}
+
+	int area = batch.height * batch.width;
+	const float* beliefs = &batch.beliefs[client.lane];
+	ostringstream out;
+	if (request.kind == 'B') {
+		out << batch.height << ' ' << batch.width;
+		for (int cell = 0; cell < area; cell++) {
+			out << ' ' << beliefs[(size_t) cell * BATCH_LANES];
+		}
+		out << '\n';
+	}
+	else {
+		int best = 0;
+		for (int cell = 1; cell < area; cell++) {
+			if (beliefs[(size_t) cell * BATCH_LANES] > beliefs[(size_t) best * BATCH_LANES]) {
+				best = cell;
+			}
+		}
+		ReplayResult result = {client.events++, best / batch.width, best % batch.width,
+			beliefs[(size_t) best * BATCH_LANES]};
+		write_replay_result(out, result);
+	}
+	client.output += out.str();
+}
+
+#ifdef LOCALIZER_HAS_EPOLL
+
+LocalizationService::~LocalizationService() {
+	for (std::map <int, ServiceClient>::iterator c = clients.begin(); c != clients.end(); ++c) {
+		::close(c->first);
+	}
+	if (listen_fd >= 0) {
+		::close(listen_fd);
+		unlink(socket_path.c_str());
+	}
+	if (epoll_fd >= 0) {
+		::close(epoll_fd);
+	}
+}
+
+// Fills a Unix socket address. Returns false when the path is too long.
+bool unix_address(const string& path, sockaddr_un& address) {
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) {
+		return false;
+	}
+	memcpy(address.sun_path, path.c_str(), path.size());
+	return true;
+}
+
+bool LocalizationService::listen(const string& path) {
+	sockaddr_un address;
+	if (listen_fd >= 0 || !unix_address(path, address)) {
+		return false;
+	}
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (epoll_fd < 0 || listen_fd < 0) {
+		return false;
+	}
+
+	unlink(path.c_str());
+	if (bind(listen_fd, (sockaddr*) &address, sizeof(address)) != 0
+		|| ::listen(listen_fd, SOMAXCONN) != 0)
+	{
+		::close(listen_fd);
+		listen_fd = -1;
+		return false;
+	}
+	socket_path = path;
+
+	epoll_event event;
+	event.events = EPOLLIN;
+	event.data.fd = listen_fd;
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == 0;
+}
+
+void LocalizationService::accept_clients() {
+	while (true) {
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			return;
+		}
+		epoll_event event;
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.fd = fd;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+			::close(fd);
+			continue;
+		}
+
+		ServiceClient& client = clients[fd];
+		client.fd = fd;
+		client.batch = client.lane = -1;
+		client.events = 0;
+		client.closing = false;
+		client.interest = event.events;
+		stats.clients++;
+	}
+}
+
+void LocalizationService::close_client(int fd) {
+	std::map <int, ServiceClient>::iterator found = clients.find(fd);
+	if (found == clients.end()) {
+		return;
+	}
+	if (found->second.lane >= 0) {
+		maps[found->second.map_name].lanes[found->second.batch][found->second.lane] = -1;
+	}
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	::close(fd);
+	clients.erase(found);
+}
+
+// Reads everything available and queues the complete lines.
+void LocalizationService::read_client(ServiceClient& client) {
+	char chunk[4096];
+	bool closed = false;
+	while (true) {
+		ssize_t n = recv(client.fd, chunk, sizeof(chunk), 0);
+		if (n > 0) {
+			client.input.append(chunk, n);
+			continue;
+		}
+		closed = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		break;
+	}
+
+	size_t begin = 0, end;
+	while ((end = client.input.find('\n', begin)) != string::npos) {
+		handle_line(client, client.input.substr(begin, end - begin));
+		begin = end + 1;
+	}
+	client.input.erase(0, begin);
+
+	// requests already read are still answered; the robot just is not heard from again
+	if (closed || client.input.size() > MAX_SERVICE_LINE) {
+		client.closing = true;
+		client.input.clear();
+	}
+}
+
+// Writes as much output as the socket takes; the rest waits for EPOLLOUT.
+void LocalizationService::flush(ServiceClient& client) {
+	size_t sent = 0;
+	while (sent < client.output.size()) {
+		ssize_t n = send(client.fd, client.output.data() + sent, client.output.size() - sent, MSG_NOSIGNAL);
+		if (n > 0) {
+			sent += n;
+		}
+		else if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		else {
+			break;
+		}
+	}
+	client.output.erase(0, sent);
+
+	unsigned interest = (client.closing ? 0u : (unsigned) (EPOLLIN | EPOLLRDHUP))
+		| (client.output.empty() ? 0u : (unsigned) EPOLLOUT);
+	if (interest != client.interest) {
+		epoll_event event;
+		event.events = interest;
+		event.data.fd = client.fd;
+		epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client.fd, &event);
+		client.interest = interest;
+	}
+}
+
+int LocalizationService::poll(int timeout_ms) {
+	if (epoll_fd < 0) {
+		return -1;
+	}
+	epoll_event events[64];
+	int n = epoll_wait(epoll_fd, events, 64, timeout_ms);
+	if (n < 0) {
+		return errno == EINTR ? 0 : -1;
+	}
+
+	vector <int> hung_up;
+	for (int e = 0; e < n; e++) {
+		int fd = events[e].data.fd;
+		if (fd == listen_fd) {
+			accept_clients();
+			continue;
+		}
+		std::map <int, ServiceClient>::iterator found = clients.find(fd);
+		if (found == clients.end()) {
+			continue;
+		}
+		if (!found->second.closing && (events[e].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+			read_client(found->second);
+		}
+		if (events[e].events & (EPOLLHUP | EPOLLERR)) {
+			hung_up.push_back(fd);
+		}
+	}
+
+	// sweep every batch until no robot has a request left
+	int answered = 0, progress;
+	do {
+		progress = 0;
+		for (std::map <string, ServiceMap>::iterator m = maps.begin(); m != maps.end(); ++m) {
+			for (size_t b = 0; b < m->second.batches.size(); b++) {
+				progress += sweep(m->second, b);
+			}
+		}
+		answered += progress;
+	} while (progress > 0);
+
+	for (std::map <int, ServiceClient>::iterator c = clients.begin(); c != clients.end(); ++c) {
+		flush(c->second);
+		if (c->second.closing && c->second.output.empty()) {
+			hung_up.push_back(c->first);
+		}
+	}
+	for (size_t k = 0; k < hung_up.size(); k++) {
+		close_client(hung_up[k]);
+	}
+	return answered;
+}
+
+ServiceConnection::ServiceConnection() : fd(-1) {
+}
+
+ServiceConnection::~ServiceConnection() {
+	close();
+}
+
+bool ServiceConnection::connect(const string& socket_path) {
+	sockaddr_un address;
+	close();
+	if (!unix_address(socket_path, address)) {
+		return false;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || ::connect(fd, (sockaddr*) &address, sizeof(address)) != 0) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool ServiceConnection::send(const string& line) {
+	string framed = line + "\n";
+	size_t sent = 0;
+	while (fd >= 0 && sent < framed.size()) {
+		ssize_t n = ::send(fd, framed.data() + sent, framed.size() - sent, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		sent += n;
+	}
+	return fd >= 0;
+}
+
+bool ServiceConnection::receive(string& line) {
+	size_t end;
+	while ((end = buffer.find('\n')) == string::npos) {
+		char chunk[4096];
+		ssize_t n = fd < 0 ? 0 : recv(fd, chunk, sizeof(chunk), 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		buffer.append(chunk, n);
+	}
+	line = buffer.substr(0, end);
+	buffer.erase(0, end + 1);
+	return true;
+}
+
+void ServiceConnection::close() {
+	if (fd >= 0) {
+		::close(fd);
+		fd = -1;
+	}
+	buffer.clear();
+}
+
+#else
+
+LocalizationService::~LocalizationService() {
+}
+
+bool LocalizationService::listen(const string&) {
+	return false;
+}
+
+int LocalizationService::poll(int) {
+	return -1;
+}
+
+ServiceConnection::ServiceConnection() : fd(-1) {
+}
+
+ServiceConnection::~ServiceConnection() {
+}
+
+bool ServiceConnection::connect(const string&) {
+	return false;
+}
+
+bool ServiceConnection::send(const string&) {
+	return false;
+}
+
+bool ServiceConnection::receive(string&) {
+	return false;
+}
+
+void ServiceConnection::close() {
+}
+
+#endif
+
+bool ServiceConnection::request(const string& line, string& reply) {
+	return send(line) && receive(reply);
+}
@@ -0,0 +1,154 @@
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include <deque>
+#include <atomic>
+#include "batched_filter.h"
+#include "replay.h"
+
+#if defined(__linux__)
+#define LOCALIZER_HAS_EPOLL 1
+#endif
+
+/**
+	The service protocol is line based. A client is one robot; its
+	first line names the map it lives on and every later line is a
+	request, answered in order with one line:
+
+		MAP <name>      ->  OK <height> <width>
+		S <color>       ->  <n> <row> <col> <belief>   (most likely cell)
+		M <dy> <dx>     ->  <n> <row> <col> <belief>
+		B               ->  <height> <width> <belief> ...   (posterior)
+
+	where n counts the robot's sense and move events. Malformed lines
+	get "ERR <reason>".
+*/
+
+// Counts kept by the service; lanes_swept / sweeps is the mean batch occupancy.
+struct ServiceStats {
+	long clients;
+	long requests;
+	long sweeps;
+	long lanes_swept;
+};
+
+// A request waiting for its robot's next sweep.
+struct ServiceRequest {
+	// 'S' or 'M' (see event), 'B' for the posterior, 'E' for an error reply
+	char kind;
+	ReplayEvent event;
+	std::string error;
+};
+
+// One connected robot.
+struct ServiceClient {
+	int fd;
+	std::string map_name;
+	int batch;
+	int lane;
+	long events;
+	// the robot sent its last request; close once the replies are out
+	bool closing;
+	// the epoll events currently watched
+	unsigned interest;
+	std::string input;
+	std::string output;
+	std::deque <ServiceRequest> pending;
+};
+
+// The robots of one map, BATCH_LANES per FilterBatch.
+struct ServiceMap {
+	std::vector < std::vector <char> > grid;
+	std::vector <FilterBatch> batches;
+	// lanes[batch][lane] is the fd of the robot in that lane, or -1
+	std::vector < std::vector <int> > lanes;
+};
+
+/**
+	Serves many robots from one process over a Unix domain socket.
+	Each round of poll() reads every ready connection, then sweeps
+	the filters: robots of the same map share FilterBatches, so one
+	sweep advances every robot of a batch that has a request waiting
+	with a single lane-interleaved pass. The more robots are active
+	at once, the more lanes each pass carries. A robot's requests
+	are answered in the order it sent them.
+
+	The service is single threaded; stop() may be called from any
+	thread.
+*/
+class LocalizationService {
+public:
+	ServiceStats stats;
+
+	LocalizationService(float p_hit, float p_miss, float blurring);
+	~LocalizationService();
+
+	// Makes a map available to clients under a name.
+	void add_map(const std::string& name, const std::vector < std::vector <char> >& grid);
+
+	// Listens on a Unix socket path, replacing a stale socket file. Returns false on failure.
+	bool listen(const std::string& socket_path);
+
+	/**
+	    Waits up to timeout_ms for activity and handles it: accepts
+	    clients, reads requests, runs sweeps and writes replies.
+	    Returns the number of requests answered, or -1 on error.
+	*/
+	int poll(int timeout_ms);
+
+	// Polls until stop() is called.
+	void run();
+
+	void stop();
+
+private:
+	float p_hit, p_miss, blurring;
+	int listen_fd, epoll_fd;
+	std::string socket_path;
+	std::atomic <bool> stopping;
+	std::map <std::string, ServiceMap> maps;
+	std::map <int, ServiceClient> clients;
+
+	void accept_clients();
+	void read_client(ServiceClient& client);
+	void handle_line(ServiceClient& client, const std::string& line);
+	bool attach(ServiceClient& client, const std::string& map_name);
+	void close_client(int fd);
+	int sweep(ServiceMap& map, int batch);
+	void reply(ServiceClient& client, const ServiceRequest& request, const FilterBatch& batch);
+	void flush(ServiceClient& client);
+};
+
+/**
+	A blocking client connection, as used by robots, tests and the
+	load generator. Requests may be pipelined: send several, then
+	receive their replies in order.
+*/
+class ServiceConnection {
+public:
+	ServiceConnection();
+	~ServiceConnection();
+
+	// Connects to a service socket. Returns false on failure.
+	bool connect(const std::string& socket_path);
+
+	// Sends one request line (without the newline).
+	bool send(const std::string& line);
+
+	// Reads one reply line. Returns false when the connection closed first.
+	bool receive(std::string& line);
+
+	// Sends one request and reads its reply.
+	bool request(const std::string& line, std::string& reply);
+
+	void close();
+
+private:
+	int fd;
+	std::string buffer;
+};
+
+#endif /* SERVICE_H */
@@ -0,0 +1,137 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/**
+	simd.h
+
+	Purpose: a thin portable SIMD layer for the histogram filter
+	kernels. When the standard library ships std::experimental::simd
+	it is used directly; otherwise a small fixed-width wrapper over
+	plain arrays is used, which compilers auto-vectorize.
+
+	The vector width is chosen at compile time from the target
+	instruction set (-msse2, -mavx2, -mavx512f, /arch:AVX2, ...),
+	so the same kernel source gives SSE, AVX2 and AVX-512 builds.
+	Define LOCALIZER_SIMD_WIDTH to force a width, or
+	LOCALIZER_NO_STD_SIMD to force the fallback wrapper.
+*/
+
+#if !defined(LOCALIZER_NO_STD_SIMD) && defined(__has_include) && __cplusplus >= 201703L
+#if __has_include(<experimental/simd>)
+#include <experimental/simd>
+#define LOCALIZER_HAS_STD_SIMD 1
+#endif
+#endif
+
+#ifdef LOCALIZER_HAS_STD_SIMD
+
+#ifdef LOCALIZER_SIMD_WIDTH
+typedef std::experimental::fixed_size_simd<float, LOCALIZER_SIMD_WIDTH> simd_float;
+#else
+typedef std::experimental::native_simd<float> simd_float;
+#endif
+
+// Number of floats held by one simd_float.
+const int SIMD_WIDTH = (int) simd_float::size();
+
+// Loads SIMD_WIDTH floats from (not necessarily aligned) memory.
+inline simd_float simd_load(const float* p) {
+	return simd_float(p, std::experimental::element_aligned);
+}
+
+// Stores SIMD_WIDTH floats to (not necessarily aligned) memory.
+inline void simd_store(const simd_float& v, float* p) {
+	v.copy_to(p, std::experimental::element_aligned);
+}
+
+// Sums the lanes of a vector.
+inline float simd_reduce(const simd_float& v) {
+	return std::experimental::reduce(v);
+}
+
+// 1.0 in the lanes where v is below limit, 0.0 elsewhere.
+inline simd_float simd_below(const simd_float& v, const simd_float& limit) {
+	simd_float r(0.0f);
+	std::experimental::where(v < limit, r) = 1.0f;
+	return r;
+}
+
+// Lane-wise maximum.
+inline simd_float simd_max(const simd_float& a, const simd_float& b) {
+	return std::experimental::max(a, b);
+}
+
+#else /* fallback wrapper */
+
+#if defined(LOCALIZER_SIMD_WIDTH)
+#define LOCALIZER_FALLBACK_WIDTH LOCALIZER_SIMD_WIDTH
+#elif defined(__AVX512F__)
+#define LOCALIZER_FALLBACK_WIDTH 16
+#elif defined(__AVX__) || defined(__AVX2__)
+#define LOCALIZER_FALLBACK_WIDTH 8
+#else
+#define LOCALIZER_FALLBACK_WIDTH 4
+#endif
+
+// Fixed-width vector of floats; every operation is a plain loop
+// over the lanes so that the compiler can emit vector code.
+struct simd_float {
+	float v[LOCALIZER_FALLBACK_WIDTH];
+
+	simd_float() {}
+	simd_float(float x) {
+		for (int k = 0; k < LOCALIZER_FALLBACK_WIDTH; k++) v[k] = x;
+	}
+	float operator[](int k) const { return v[k]; }
+
+	simd_float& operator+=(const simd_float& o) {
+		for (int k = 0; k < LOCALIZER_FALLBACK_WIDTH; k++) v[k] += o.v[k];
+		return *this;
+	}
+	simd_float& operator*=(const simd_float& o) {
+		for (int k = 0; k < LOCALIZER_FALLBACK_WIDTH; k++) v[k] *= o.v[k];
+		return *this;
+	}
+	simd_float& operator-=(const simd_float& o) {
+		for (int k = 0; k < LOCALIZER_FALLBACK_WIDTH; k++) v[k] -= o.v[k];
+		return *this;
+	}
+};
+
+inline simd_float operator+(simd_float a, const simd_float& b) { return a += b; }
+inline simd_float operator-(simd_float a, const simd_float& b) { return a -= b; }
+inline simd_float operator*(simd_float a, const simd_float& b) { return a *= b; }
+
+const int SIMD_WIDTH = LOCALIZER_FALLBACK_WIDTH;
+
+inline simd_float simd_load(const float* p) {
+	simd_float r;
+	for (int k = 0; k < SIMD_WIDTH; k++) r.v[k] = p[k];
+	return r;
+}
+
+inline void simd_store(const simd_float& v, float* p) {
+	for (int k = 0; k < SIMD_WIDTH; k++) p[k] = v.v[k];
+}
+
+inline float simd_reduce(const simd_float& v) {
+	float total = 0.0;
+	for (int k = 0; k < SIMD_WIDTH; k++) total += v.v[k];
+	return total;
+}
+
+inline simd_float simd_below(const simd_float& v, const simd_float& limit) {
+	simd_float r;
+	for (int k = 0; k < SIMD_WIDTH; k++) r.v[k] = v.v[k] < limit.v[k] ? 1.0f : 0.0f;
+	return r;
+}
+
+inline simd_float simd_max(const simd_float& a, const simd_float& b) {
+	simd_float r;
+	for (int k = 0; k < SIMD_WIDTH; k++) r.v[k] = a.v[k] < b.v[k] ? b.v[k] : a.v[k];
+	return r;
+}
+
+#endif /* LOCALIZER_HAS_STD_SIMD */
+
+#endif /* SIMD_H */
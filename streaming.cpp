@@ -0,0 +1,80 @@
+/**
+	streaming.cpp
+
+	Purpose: non-temporal stores and software prefetch for grids
+	that do not fit in cache. Targets without SSE2 fall back to
+	plain copies, so the streaming mode is always safe to enable.
+*/
+
+#include <string.h>
+#include <stdint.h>
+#include "streaming.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LOCALIZER_HAS_STREAMING_STORES 1
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+/**
+    Returns the defaults for this machine.
+
+    @return - a threshold of twice the last-level cache (32 MiB
+    	   when the cache size cannot be queried) and a prefetch
+    	   distance of two rows.
+*/
+StreamingConfig default_streaming_config() {
+	StreamingConfig config;
+	config.threshold_bytes = 32 * 1024 * 1024;
+	config.prefetch_rows = 2;
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+	long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	if (llc > 0) {
+		config.threshold_bytes = 2 * (size_t) llc;
+	}
+#endif
+	return config;
+}
+
+StreamingConfig streaming_config = default_streaming_config();
+
+bool use_streaming(size_t bytes) {
+	return bytes > streaming_config.threshold_bytes;
+}
+
+void stream_copy(float* dst, const float* src, int count) {
+#ifdef LOCALIZER_HAS_STREAMING_STORES
+	int k = 0;
+	// _mm_stream_ps needs a 16 byte aligned destination
+	for (; k < count && ((uintptr_t) (dst + k) & 15) != 0; k++) {
+		dst[k] = src[k];
+	}
+	for (; k + 4 <= count; k += 4) {
+		_mm_stream_ps(dst + k, _mm_loadu_ps(src + k));
+	}
+	for (; k < count; k++) {
+		dst[k] = src[k];
+	}
+#else
+	memcpy(dst, src, count * sizeof(float));
+#endif
+}
+
+void stream_fence() {
+#ifdef LOCALIZER_HAS_STREAMING_STORES
+	_mm_sfence();
+#endif
+}
+
+void prefetch_floats(const float* p, int count) {
+#ifdef LOCALIZER_HAS_STREAMING_STORES
+	const int line = 64 / sizeof(float);
+	for (int k = 0; k < count; k += line) {
+		_mm_prefetch((const char*) (p + k), _MM_HINT_T0);
+	}
+#endif
+}
@@ -0,0 +1,36 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+#include <stddef.h>
+
+/**
+	Settings for the streaming mode used by move and blur on grids
+	much larger than the last-level cache. In streaming mode output
+	rows are written with non-temporal stores, which skip the
+	read-for-ownership of the destination lines, and input rows are
+	prefetched prefetch_rows ahead of the row being computed.
+*/
+struct StreamingConfig {
+	size_t threshold_bytes;
+	int prefetch_rows;
+};
+
+// Returns the defaults for this machine (twice the last-level cache).
+StreamingConfig default_streaming_config();
+
+// The settings used by the kernels; may be replaced at startup.
+extern StreamingConfig streaming_config;
+
+// Returns true when a kernel touching this many bytes should stream.
+bool use_streaming(size_t bytes);
+
+// Copies count floats, bypassing the cache when the target supports it.
+void stream_copy(float* dst, const float* src, int count);
+
+// Orders streaming stores before any later stores. Call after a streaming pass.
+void stream_fence();
+
+// Prefetches count floats starting at p into the cache.
+void prefetch_floats(const float* p, int count);
+
+#endif /* STREAMING_H */
@@ -0,0 +1,152 @@
+/**
+	summed_area.cpp
+
+	Purpose: O(1) probability mass queries over rectangles of the
+	belief grid, for planners that ask "how likely is the robot
+	inside zone Z" many times per step.
+*/
+
+#include <vector>
+#include <string>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "summed_area.h"
+#include "kernels.h"
+#include "numeric_health.h"
+
+using namespace std;
+
+void clamp_region(int& rows, int& cols, int height, int width) {
+	rows = max(0, min(rows, height));
+	cols = max(0, min(cols, width));
+}
+
+double SummedAreaTable::rectangle(int top, int left, int bottom, int right) const {
+	int stride = width + 1;
+	return sums[(size_t) bottom * stride + right] - sums[(size_t) top * stride + right]
+		- sums[(size_t) bottom * stride + left] + sums[(size_t) top * stride + left];
+}
+
+/**
+    Mass of a cyclic rectangle. A rectangle that runs past the
+    bottom or right edge is split into at most four pieces that
+    do not wrap.
+
+    @param top - the first row; any integer, taken modulo height.
+
+    @param left - the first column; any integer, taken modulo width.
+
+    @param rows - how many rows; clamped to [0, height].
+
+    @param cols - how many columns; clamped to [0, width].
+
+    @return - the probability mass inside the rectangle.
+*/
+double SummedAreaTable::region(int top, int left, int rows, int cols) const {
+	clamp_region(rows, cols, height, width);
+	top = ((top % height) + height) % height;
+	left = ((left % width) + width) % width;
+
+	int row_begin[2] = {top, 0};
+	int row_end[2] = {min(top + rows, height), top + rows - height};
+	int col_begin[2] = {left, 0};
+	int col_end[2] = {min(left + cols, width), left + cols - width};
+
+	double mass = 0.0;
+	for (int r = 0; r < 2; r++) {
+		for (int c = 0; c < 2; c++) {
+			if (row_end[r] > row_begin[r] && col_end[c] > col_begin[c]) {
+				mass += rectangle(row_begin[r], col_begin[c], row_end[r], col_end[c]);
+			}
+		}
+	}
+	return mass;
+}
+
+/**
+    Normalizes a flat grid and builds its summed-area table. The
+    first pass finds the total; the second scales each row and
+    accumulates its prefix sums while the row is still in cache.
+
+    @param cells - height * width unnormalized beliefs.
+
+    @param sat - the table to fill; resized as needed.
+
+    @param active - when not NULL, receives the indices of the cells
+    	   above threshold (see normalize_and_collect).
+
+    @param health - when not NULL, receives the health counts of the
+    	   normalized cells, and cells below floor are raised to it
+    	   before they enter the table and the active set.
+
+    @return - the total before normalizing.
+*/
+float normalize_with_summed_area(float* cells, int height, int width, SummedAreaTable& sat,
+	vector <int>* active, float threshold, HealthCounts* health, float floor)
+{
+	int stride = width + 1;
+	sat.height = height;
+	sat.width = width;
+	sat.sums.assign((size_t) (height + 1) * stride, 0.0);
+
+	float total = grid_sum(cells, height * width);
+	float factor = total != 0.0 ? 1.0f / total : 1.0f;
+
+	for (int i = 0; i < height; i++) {
+		float* row = cells + (size_t) i * width;
+		scale_kernel(row, width, factor);
+		if (health != NULL) {
+			scan_and_floor(row, width, floor, *health);
+		}
+
+		const double* above = &sat.sums[(size_t) i * stride];
+		double* sums = &sat.sums[(size_t) (i + 1) * stride];
+		double running = 0.0;
+		for (int j = 0; j < width; j++) {
+			running += row[j];
+			sums[j + 1] = above[j + 1] + running;
+			if (active != NULL && row[j] > threshold) {
+				active->push_back(i * width + j);
+			}
+		}
+	}
+	return total;
+}
+
+/**
+    Reads named zones.
+
+    @param file_name - a text file with one zone per line:
+    	   "name top left rows cols". Blank lines and lines
+    	   starting with # are skipped.
+
+    @return - the zones by name; empty when the file is missing.
+*/
+map <string, Zone> read_zones(string file_name) {
+	map <string, Zone> zones;
+	ifstream infile(file_name);
+	string line;
+	while (getline(infile, line)) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		istringstream fields(line);
+		string name;
+		Zone zone;
+		if (fields >> name >> zone.top >> zone.left >> zone.rows >> zone.cols) {
+			zones[name] = zone;
+		}
+	}
+	return zones;
+}
+
+string zones_file_for(string map_file_name) {
+	size_t dot = map_file_name.rfind('.');
+	size_t slash = map_file_name.find_last_of("/\\");
+	if (dot == string::npos || (slash != string::npos && dot < slash)) {
+		return map_file_name + ".zones";
+	}
+	return map_file_name.substr(0, dot) + ".zones";
+}
@@ -0,0 +1,60 @@
+#ifndef SUMMED_AREA_H
+#define SUMMED_AREA_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include "numeric_health.h"
+
+/**
+	Summed-area table of a belief grid: sums[(i + 1) * (width + 1) + j + 1]
+	holds the total of the cells above and to the left of (i, j),
+	inclusive. Kept in double so that differences of large prefix
+	sums stay accurate.
+*/
+struct SummedAreaTable {
+	int height, width;
+	std::vector <double> sums;
+
+	// Mass of the cells in rows [top, bottom) and columns [left, right).
+	double rectangle(int top, int left, int bottom, int right) const;
+
+	/**
+	    Mass of a rows x cols rectangle whose top-left corner is
+	    (top, left), wrapping cyclically past the bottom and right edges.
+	    rows and cols are clamped to the grid (see clamp_region).
+	*/
+	double region(int top, int left, int rows, int cols) const;
+};
+
+// A named rectangle of the map, wrapping cyclically like region().
+struct Zone {
+	int top, left, rows, cols;
+};
+
+/**
+    Clamps a region's size to a height x width grid: more rows or
+    columns than the grid has cover it once, and negative sizes are
+    empty. Zones read from a file are clamped this way at query time,
+    so they stay valid when a map of another shape is installed.
+*/
+void clamp_region(int& rows, int& cols, int height, int width);
+
+/**
+    Normalizes height * width cells in place and fills sat in the
+    same pass over the normalized values. When active is given, the
+    indices of cells above threshold are appended to it in that pass
+    too, and when health is given each row is checked and floored
+    first (see scan_and_floor). Returns the total before normalizing.
+*/
+float normalize_with_summed_area(float* cells, int height, int width, SummedAreaTable& sat,
+	std::vector <int>* active = NULL, float threshold = 0.0, HealthCounts* health = NULL,
+	float floor = 0.0);
+
+// Reads named zones, one "name top left rows cols" per line.
+std::map <std::string, Zone> read_zones(std::string file_name);
+
+// Returns the zone file that goes with a map file (maps/m1.txt -> maps/m1.zones).
+std::string zones_file_for(std::string map_file_name);
+
+#endif /* SUMMED_AREA_H */
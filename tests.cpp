@@ -1,6 +1,13 @@
 #include <iostream>
+#include <thread>
+#include <sstream>
+#include <random>
+#include <cstdlib>
+#include <cstddef>
 #include "tests.h"
 #include "simulate.cpp"
+#include "differential.cpp"
+#include "embedded_m1.h"
 
 using namespace std;
 
@@ -9,6 +16,31 @@ int main() {
 	test_helpers();
 	test_localizer();
 	cout << endl;
+	test_kernels();
+	test_tiled();
+	test_batched();
+	test_differential();
+	test_summed_area();
+	test_hypotheses();
+	test_active_localization();
+	test_motion_classes();
+	test_snapshots();
+	test_map_reload();
+	test_map_registry();
+	test_map_cache();
+	test_embedded_map();
+	test_tuning();
+	test_realtime();
+	test_replay();
+	test_async_io();
+	test_c_api();
+	test_service();
+	test_map_edits();
+	test_memory_governor();
+	test_calibration();
+	test_numeric_health();
+	test_map_channels();
+	cout << endl;
 	return 0;
 }
 
@@ -281,6 +313,1646 @@ bool test_localizer() {
 	return correct;
 }
 
+bool test_kernels() {
+	int height = 7;
+	int width = 13;
+	vector < vector <float> > in = zeros(height, width);
+	vector < vector <char> > map (height, vector <char> (width, 'g'));
+
+	int i, j;
+	for (i=0; i<height; i++) {
+		for (j=0; j<width; j++) {
+			in[i][j] = (float) ((i * 7 + j * 3) % 11 + 1);
+			if ((i + 2 * j) % 3 == 0) {
+				map[i][j] = 'r';
+			}
+		}
+	}
+	in = normalize(in);
+
+	CompiledMap compiled = compile_map(map);
+	vector <float> cells = flatten(in);
+	vector <float> out (cells.size());
+	bool right = true;
+
+	sense_kernel(&cells[0], compiled.plane(compiled.color_index('r')), &out[0], cells.size(), 2.0, 1.0);
+	normalize_kernel(&out[0], out.size());
+	if (!close_enough(sense('r', map, in, 2.0, 1.0), unflatten(out, height, width))) {
+		cout << "X - sense_kernel does not match sense.\n";
+		right = false;
+	}
+
+	blur_kernel(&cells[0], &out[0], height, width, 0.12);
+	normalize_kernel(&out[0], out.size());
+	if (!close_enough(blur(in, 0.12), unflatten(out, height, width))) {
+		cout << "X - blur_kernel does not match blur.\n";
+		right = false;
+	}
+
+	// once through the cache and once with streaming stores
+	StreamingConfig saved = streaming_config;
+	int pass;
+	for (pass=0; pass<2; pass++) {
+		streaming_config.threshold_bytes = pass == 0 ? saved.threshold_bytes : 0;
+		move_kernel(&cells[0], &out[0], height, width, -3, 15, 0.2);
+		normalize_kernel(&out[0], out.size());
+		if (!close_enough(move(-3, 15, in, 0.2), unflatten(out, height, width))) {
+			cout << "X - move_kernel does not match move" << (pass ? " when streaming" : "") << ".\n";
+			right = false;
+		}
+	}
+	streaming_config = saved;
+
+	if (right) {
+		cout << "! - flat kernels match the reference functions\n";
+	}
+	return right;
+}
+
+bool test_tiled() {
+	int height = 37;
+	int width = 70;
+	int tile = 16;
+	int count = height * width;
+	vector <float> cells (count), plane (count), out (count), expected (count);
+
+	int k;
+	for (k=0; k<count; k++) {
+		cells[k] = (float) (k % 17 + 1);
+		plane[k] = (k % 5 == 0) ? 1.0 : 0.0;
+	}
+	normalize_kernel(&cells[0], count);
+
+	TiledGrid in = to_tiled(&cells[0], height, width, tile);
+	TiledGrid hits = to_tiled(&plane[0], height, width, tile);
+	TiledGrid tiled_out (height, width, tile);
+	bool right = true;
+
+	sense_kernel(&cells[0], &plane[0], &expected[0], count, 3.0, 1.0);
+	normalize_kernel(&expected[0], count);
+	sense_tiled(in, hits, tiled_out, 3.0, 1.0);
+	normalize_tiled(tiled_out);
+	if (!close_enough(unflatten(expected, height, width), unflatten(to_row_major(tiled_out), height, width))) {
+		cout << "X - sense_tiled does not match sense_kernel.\n";
+		right = false;
+	}
+
+	blur_kernel(&cells[0], &expected[0], height, width, 0.3);
+	normalize_kernel(&expected[0], count);
+	blur_tiled(in, tiled_out, 0.3);
+	normalize_tiled(tiled_out);
+	if (!close_enough(unflatten(expected, height, width), unflatten(to_row_major(tiled_out), height, width))) {
+		cout << "X - blur_tiled does not match blur_kernel.\n";
+		right = false;
+	}
+
+	if (right) {
+		cout << "! - tile-major kernels match the row-major kernels\n";
+	}
+	return right;
+}
+
+bool test_batched() {
+	int height = 5;
+	int width = 4;
+	FilterBatch batch (height, width);
+	vector < vector < vector <char> > > maps;
+	vector < vector < vector <float> > > expected;
+	char sensed[BATCH_LANES];
+	int dy[BATCH_LANES], dx[BATCH_LANES];
+
+	int lane, i, j;
+	for (lane=0; lane<BATCH_LANES; lane++) {
+		vector < vector <char> > map (height, vector <char> (width, 'g'));
+		for (i=0; i<height; i++) {
+			for (j=0; j<width; j++) {
+				if ((i * 3 + j * 5 + lane) % 4 == 0) {
+					map[i][j] = 'r';
+				}
+			}
+		}
+		maps.push_back(map);
+		expected.push_back(initialize_beliefs(map));
+		batch.set_map(lane, map);
+	}
+
+	for (lane=0; lane<BATCH_LANES; lane++) {
+		sensed[lane] = lane % 3 == 0 ? 'g' : 'r';
+		dy[lane] = lane % 3 - 1;
+		dx[lane] = lane % 5 - 2;
+	}
+
+	for (lane=0; lane<BATCH_LANES; lane++) {
+		expected[lane] = sense(sensed[lane], maps[lane], expected[lane], 0.8, 0.2);
+		expected[lane] = move(1, -1, expected[lane], 0.1);
+		expected[lane] = move(dy[lane], dx[lane], expected[lane], 0.3);
+		expected[lane] = sense(sensed[(lane + 1) % BATCH_LANES], maps[lane], expected[lane], 0.8, 0.2);
+	}
+
+	batch.sense(sensed, 0.8, 0.2);
+	batch.move(1, -1, 0.1);
+	batch.move(dy, dx, 0.3);
+	char rotated[BATCH_LANES];
+	for (lane=0; lane<BATCH_LANES; lane++) {
+		rotated[lane] = sensed[(lane + 1) % BATCH_LANES];
+	}
+	batch.sense(rotated, 0.8, 0.2);
+
+	bool right = true;
+	for (lane=0; lane<BATCH_LANES; lane++) {
+		if (!close_enough(expected[lane], batch.lane_beliefs(lane))) {
+			cout << "X - FilterBatch lane " << lane << " does not match the reference filter.\n";
+			right = false;
+		}
+	}
+	if (right) {
+		cout << "! - FilterBatch matches independent filters\n";
+	}
+	return right;
+}
+
+bool test_differential() {
+	vector <ErrorStats> report = run_differential(100, 7, 32);
+
+	bool right = true;
+	size_t v;
+	for (v=0; v<report.size(); v++) {
+		if (!(report[v].max_abs <= 0.0001 && report[v].max_rel <= 0.0001)) {
+			right = false;
+		}
+	}
+
+	if (right) {
+		cout << "! - optimized variants agree with the reference on random cases\n";
+	}
+	else {
+		cout << "X - optimized variants disagree with the reference:\n\n";
+		show_report(report);
+	}
+	return right;
+}
+
+bool test_summed_area() {
+	HistogramFilter filter ("maps/m1.txt", 3.0, 1.0, 0.2);
+	HistogramFilter scanning ("maps/m1.txt", 3.0, 1.0, 0.2);
+	vector < vector <char> > map = read_map("maps/m1.txt");
+	vector < vector <float> > expected = initialize_beliefs(map);
+	filter.set_summed_area(true);
+
+	filter.sense('g');
+	filter.move(1, 2);
+	filter.sense('r');
+	scanning.sense('g');
+	scanning.move(1, 2);
+	scanning.sense('r');
+	expected = sense('r', map, move(1, 2, sense('g', map, expected, 3.0, 1.0), 0.2), 3.0, 1.0);
+
+	bool right = close_enough(expected, filter.belief_grid());
+	if (!right) {
+		cout << "X - HistogramFilter does not match the reference filter.\n";
+	}
+
+	// wrapped_corner covers cells (2,2) (2,0) (0,2) (0,0)
+	float corner = expected[2][2] + expected[2][0] + expected[0][2] + expected[0][0];
+	if (filter.zones.size() != 3 || !close_enough(filter.zone_mass("wrapped_corner"), corner)) {
+		cout << "X - zone_mass does not match the summed beliefs.\n";
+		right = false;
+	}
+
+	const char* names[] = {"center", "top_row", "wrapped_corner"};
+	int z;
+	for (z=0; z<3; z++) {
+		if (!close_enough(filter.zone_mass(names[z]), scanning.zone_mass(names[z]))) {
+			cout << "X - summed-area zone " << names[z] << " does not match a scan.\n";
+			right = false;
+		}
+	}
+	// oversized regions cover the map once, on both paths
+	if (!close_enough(filter.region_mass(2, 1, 7, 3), scanning.region_mass(2, 1, 7, 3))
+		|| !close_enough(filter.region_mass(1, 0, 2, 5), scanning.region_mass(1, 0, 2, 5))
+		|| !close_enough(filter.region_mass(0, 0, 9, 9), 1.0) || filter.region_mass(0, 0, -2, 3) != 0.0)
+	{
+		cout << "X - oversized regions are not clamped to the map.\n";
+		right = false;
+	}
+	if (!close_enough(filter.region_mass(-1, -1, 3, 3), 1.0) || filter.zone_mass("missing") != -1.0) {
+		cout << "X - region_mass of the whole map is not 1.\n";
+		right = false;
+	}
+
+	if (right) {
+		cout << "! - summed-area region queries worked correctly\n";
+	}
+	return right;
+}
+
+bool test_hypotheses() {
+	int height = 10;
+	int width = 12;
+	vector <float> cells (height * width, 0.0);
+
+	// a heavy blob wrapping across the bottom-right corner
+	cells[9 * width + 11] = 4.0;
+	cells[9 * width + 0] = 2.0;
+	cells[0 * width + 11] = 2.0;
+	cells[0 * width + 0] = 2.0;
+
+	// a lighter blob in the middle
+	cells[4 * width + 5] = 3.0;
+	cells[5 * width + 6] = 3.0;
+
+	HypothesisTracker tracker;
+	tracker.resize(height, width);
+	normalize_and_collect(&cells[0], cells.size(), 0.01, tracker.active);
+	vector <Hypothesis> found = tracker.hypotheses(&cells[0], 5);
+
+	bool right = found.size() == 2
+		&& close_enough(found[0].mass, 0.625) && close_enough(found[1].mass, 0.375)
+		&& found[0].top == 9 && found[0].rows == 2 && found[0].left == 11 && found[0].cols == 2
+		&& close_enough(found[0].row, 9.4) && close_enough(found[0].col, 11.4)
+		&& found[1].top == 4 && found[1].rows == 2 && close_enough(found[1].col, 5.5);
+
+	// the filter collects its active set while normalizing
+	HistogramFilter filter ("maps/m1.txt", 3.0, 1.0, 0.0);
+	filter.set_hypothesis_threshold(0.01);
+	filter.sense('g');
+	vector <Hypothesis> modes = filter.hypotheses(3);
+	if (modes.empty() || modes[0].cells != 9) {
+		right = false;
+	}
+
+	if (right) {
+		cout << "! - hypotheses clustered correctly\n";
+	}
+	else {
+		cout << "X - hypotheses were not clustered correctly.\n";
+	}
+	return right;
+}
+
+// Entropy (nats) of a grid of probabilities.
+double entropy(vector < vector <float> > grid) {
+	double h = 0.0;
+	size_t i, j;
+	for (i=0; i<grid.size(); i++) {
+		for (j=0; j<grid[0].size(); j++) {
+			if (grid[i][j] > 0.0) {
+				h -= grid[i][j] * log(grid[i][j]);
+			}
+		}
+	}
+	return h;
+}
+
+bool test_active_localization() {
+	int height = 5;
+	int width = 7;
+	const char palette[] = "rgb";
+	float p_hit = 4.0;
+	float p_miss = 1.0;
+	float blurring = 0.2;
+
+	vector < vector <char> > map (height, vector <char> (width));
+	vector < vector <float> > beliefs = zeros(height, width);
+	int i, j;
+	for (i=0; i<height; i++) {
+		for (j=0; j<width; j++) {
+			map[i][j] = palette[(i * i + j) % 3];
+			beliefs[i][j] = (float) ((i * 5 + j * 2) % 7 + 1);
+		}
+	}
+	beliefs = normalize(beliefs);
+
+	HistogramFilter filter (map, p_hit, p_miss, blurring);
+	vector <CandidateAction> actions;
+	int a, c;
+	size_t k;
+	for (a=0; a<6; a++) {
+		CandidateAction action = {a % 3 - 1, a - 2};
+		actions.push_back(action);
+	}
+	vector <float> cells = flatten(beliefs);
+	vector <ActionScore> scores = evaluate_actions(&cells[0], filter.map, actions, p_hit, p_miss, blurring);
+
+	// brute force: move, then sense every color with the reference functions
+	bool right = scores.size() == actions.size();
+	float norm = p_hit + 2 * p_miss;
+	for (k=0; k<actions.size() && right; k++) {
+		vector < vector <float> > predicted = move(actions[k].dy, actions[k].dx, beliefs, blurring);
+		double expected = 0.0;
+		for (c=0; c<3; c++) {
+			double z = 0.0;
+			for (i=0; i<height; i++) {
+				for (j=0; j<width; j++) {
+					z += predicted[i][j] * (map[i][j] == palette[c] ? p_hit : p_miss);
+				}
+			}
+			expected += z / norm * entropy(sense(palette[c], map, predicted, p_hit, p_miss));
+		}
+		if (!close_enough(scores[k].expected_entropy, expected)
+			|| !close_enough(scores[k].information_gain, entropy(predicted) - expected)) {
+			right = false;
+		}
+	}
+	int best = best_action(scores);
+	for (k=0; k<scores.size() && right; k++) {
+		if (scores[k].information_gain > scores[best].information_gain) {
+			right = false;
+		}
+	}
+	if (best_action(vector <ActionScore> ()) != -1) {
+		right = false;
+	}
+
+	if (right) {
+		cout << "! - expected information gain matches brute force\n";
+	}
+	else {
+		cout << "X - expected information gain does not match brute force.\n";
+	}
+	return right;
+}
+
+// The scatter of blur(), with the window of each source cell's class.
+vector < vector <float> > blur_with_classes(vector < vector <float> > grid,
+	vector <unsigned char> classes, const float* class_blurring)
+{
+	int height = grid.size();
+	int width = grid[0].size();
+	vector < vector <float> > out = zeros(height, width);
+	int i, j, di, dj;
+	for (i=0; i<height; i++) {
+		for (j=0; j<width; j++) {
+			float b = class_blurring[classes[i * width + j]];
+			for (di=-1; di<2; di++) {
+				for (dj=-1; dj<2; dj++) {
+					float weight = (di == 0 && dj == 0) ? 1.0 - b : (di == 0 || dj == 0) ? b / 6.0 : b / 12.0;
+					out[(i + di + height) % height][(j + dj + width) % width] += weight * grid[i][j];
+				}
+			}
+		}
+	}
+	return out;
+}
+
+bool test_motion_classes() {
+	int height = 6;
+	int width = 19;
+	float class_blurring[] = {0.1, 0.6, 0.0};
+	vector <float> cells (height * width), out (height * width), uniform (height * width);
+	vector <unsigned char> classes (height * width);
+
+	int i, j;
+	for (i=0; i<height; i++) {
+		for (j=0; j<width; j++) {
+			cells[i * width + j] = (float) ((i * 3 + j) % 5 + 1);
+			classes[i * width + j] = (j / 4 + i) % 3;
+		}
+	}
+
+	blur_classes_kernel(&cells[0], &out[0], height, width, &classes[0], class_blurring);
+	vector < vector <float> > expected = blur_with_classes(unflatten(cells, height, width), classes, class_blurring);
+	bool right = close_enough(expected, unflatten(out, height, width));
+
+	// a single class behaves like the uniform blur
+	vector <unsigned char> one_class (height * width, 1);
+	blur_classes_kernel(&cells[0], &out[0], height, width, &one_class[0], class_blurring);
+	blur_kernel(&cells[0], &uniform[0], height, width, 0.6);
+	if (!close_enough(unflatten(uniform, height, width), unflatten(out, height, width))) {
+		right = false;
+	}
+
+	// classes loaded next to the map: sense, then move with noise
+	HistogramFilter filter ("maps/m1.txt", 3.0, 1.0, 0.0);
+	vector < vector <char> > map = read_map("maps/m1.txt");
+	float noise[] = {0.0, 0.5};
+	if (!read_motion_classes(filter.map, "maps/m1.noise", vector <float> (noise, noise + 2))) {
+		right = false;
+	}
+
+	// class ids must be digits of known classes
+	CompiledMap checked = filter.map;
+	vector < vector <char> > bad_classes (3, vector <char> (3, '0'));
+	bad_classes[1][2] = '2';
+	right = right && !set_motion_classes(checked, bad_classes, vector <float> (noise, noise + 2));
+	bad_classes[1][2] = 'x';
+	right = right && !set_motion_classes(checked, bad_classes, vector <float> (10, 0.1));
+	bad_classes[1][2] = '1';
+	bad_classes[2].pop_back();
+	right = right && !set_motion_classes(checked, bad_classes, vector <float> (noise, noise + 2))
+		&& checked.motion_classes == filter.map.motion_classes;
+	filter.sense('g');
+	filter.move(1, 1);
+	expected = move(1, 1, sense('g', map, initialize_beliefs(map), 3.0, 1.0), 0.0);
+	expected = normalize(blur_with_classes(expected, filter.map.motion_classes, noise));
+	if (!close_enough(expected, filter.belief_grid())) {
+		right = false;
+	}
+
+	// actions are scored with the class blur the filter moves with
+	vector <CandidateAction> actions;
+	for (i=0; i<4; i++) {
+		CandidateAction action = {i % 2, i / 2 - 1};
+		actions.push_back(action);
+	}
+	vector <ActionScore> scores = filter.evaluate_actions(actions);
+	const vector <char>& palette = filter.map.palette;
+	float norm = 3.0 + (palette.size() - 1) * 1.0;
+	for (size_t a = 0; right && a < actions.size(); a++) {
+		vector < vector <float> > predicted = move(actions[a].dy, actions[a].dx, filter.belief_grid(), 0.0);
+		predicted = normalize(blur_with_classes(predicted, filter.map.motion_classes, noise));
+		double expected_entropy = 0.0;
+		for (size_t c = 0; c < palette.size(); c++) {
+			double z = 0.0;
+			for (i=0; i<(int) map.size(); i++) {
+				for (j=0; j<(int) map[0].size(); j++) {
+					z += predicted[i][j] * (map[i][j] == palette[c] ? 3.0 : 1.0);
+				}
+			}
+			expected_entropy += z / norm * entropy(sense(palette[c], map, predicted, 3.0, 1.0));
+		}
+		right = close_enough(scores[a].expected_entropy, expected_entropy)
+			&& close_enough(scores[a].information_gain, entropy(predicted) - expected_entropy);
+	}
+
+	if (right) {
+		cout << "! - motion classes blur correctly\n";
+	}
+	else {
+		cout << "X - motion classes do not blur correctly.\n";
+	}
+	return right;
+}
+
+bool test_snapshots() {
+	HistogramFilter filter ("maps/m1.txt", 3.0, 1.0, 0.1);
+	HistogramFilter plain ("maps/m1.txt", 3.0, 1.0, 0.1);
+	SnapshotPublisher publisher;
+	filter.set_publisher(&publisher);
+	bool right = true;
+
+	// a guard keeps its version unchanged while the filter steps on
+	SnapshotReader reader (publisher);
+	{
+		SnapshotGuard guard (reader);
+		const BeliefVersion* pinned = guard.version();
+		vector <float> before = pinned->cells;
+		filter.sense('g');
+		filter.move(0, 1);
+		plain.sense('g');
+		plain.move(0, 1);
+		if (pinned->cells != before || pinned == publisher.latest()) {
+			cout << "X - a pinned snapshot changed while it was read.\n";
+			right = false;
+		}
+	}
+	if (!close_enough(filter.belief_grid(), plain.belief_grid())) {
+		cout << "X - publishing changed the filter's results.\n";
+		right = false;
+	}
+
+	// readers on other threads while the filter keeps stepping
+	bool readers_ok = true;
+	std::atomic <bool> stop (false);
+	vector <thread> readers;
+	int t;
+	for (t=0; t<3; t++) {
+		readers.push_back(thread([&publisher, &stop, &readers_ok]() {
+			SnapshotReader me (publisher);
+			uint64_t last = 0;
+			while (!stop.load()) {
+				SnapshotGuard guard (me);
+				const BeliefVersion* v = guard.version();
+				float total = grid_sum(&v->cells[0], v->cells.size());
+				if (v->epoch < last || total < 0.999 || total > 1.001) {
+					readers_ok = false;
+				}
+				last = v->epoch;
+			}
+		}));
+	}
+	int step;
+	for (step=0; step<3000; step++) {
+		filter.sense(step % 3 ? 'r' : 'g');
+		filter.move(1, step % 2);
+	}
+	stop.store(true);
+	for (t=0; t<3; t++) {
+		readers[t].join();
+	}
+	if (!readers_ok) {
+		cout << "X - a reader saw a torn or out-of-order snapshot.\n";
+		right = false;
+	}
+
+	// once no reader is inside a guard, steps reuse pooled buffers
+	filter.sense('r');
+	int allocated = publisher.allocated;
+	for (step=0; step<100; step++) {
+		filter.sense('g');
+		filter.move(0, 1);
+	}
+	if (publisher.retired_count() != 0 || publisher.allocated != allocated) {
+		cout << "X - snapshot buffers were not recycled.\n";
+		right = false;
+	}
+
+	if (right) {
+		cout << "! - RCU snapshots worked correctly\n";
+	}
+	return right;
+}
+
+bool test_map_reload() {
+	vector < vector <char> > old_map = read_map("maps/m1.txt");
+	vector < vector <char> > new_map = old_map;
+	new_map[0][2] = 'g';
+	new_map[1][1] = 'r';
+	HistogramFilter filter (old_map, 3.0, 1.0, 0.1);
+	MapReloader reloader;
+	filter.set_reloader(&reloader);
+	bool right = true;
+
+	// same dimensions: the beliefs carry over to the new map
+	filter.sense('g');
+	reloader.request(new_map);
+	reloader.wait();
+	filter.sense('g');
+	vector < vector <float> > expected = initialize_beliefs(old_map);
+	expected = sense('g', old_map, expected, 3.0, 1.0);
+	expected = sense('g', new_map, expected, 3.0, 1.0);
+	if (filter.map.colors[2] != filter.map.color_index('g') || !close_enough(expected, filter.belief_grid())) {
+		right = false;
+	}
+
+	// new dimensions: start over from uniform on the new map
+	vector < vector <char> > wide (2, vector <char> (5, 'r'));
+	wide[1][4] = 'g';
+	reloader.request(wide);
+	reloader.wait();
+	filter.sense('g');
+	expected = sense('g', wide, initialize_beliefs(wide), 3.0, 1.0);
+	if (filter.map.width != 5 || !close_enough(expected, filter.belief_grid())) {
+		right = false;
+	}
+
+	// maps the kernels cannot use are dropped
+	vector < vector <char> > ragged = wide;
+	ragged[1].pop_back();
+	reloader.request(ragged);
+	reloader.wait();
+	reloader.request(vector < vector <char> > ());
+	reloader.wait();
+	filter.move(0, 1);
+	if (reloader.failures.load() != 2 || filter.map.width != 5) {
+		right = false;
+	}
+
+	// a burst of requests does not block and ends on the newest map
+	for (int width = 2; width <= 6; width++) {
+		reloader.request(vector < vector <char> > (2, vector <char> (width, 'g')));
+	}
+	reloader.wait();
+	filter.move(0, 1);
+	if (filter.map.width != 6) {
+		right = false;
+	}
+
+	if (right) {
+		cout << "! - maps reload between steps\n";
+	}
+	else {
+		cout << "X - maps do not reload correctly.\n";
+	}
+	return right;
+}
+
+// Directory for the tests' scratch files: $TMPDIR, $TMP or $TEMP, else /tmp.
+string temp_directory() {
+	const char* variables[] = {"TMPDIR", "TMP", "TEMP"};
+	for (int v = 0; v < 3; v++) {
+		const char* directory = getenv(variables[v]);
+		if (directory != NULL && directory[0] != '\0') {
+			return directory;
+		}
+	}
+	return "/tmp";
+}
+
+string temp_path(const string& name) {
+	return temp_directory() + "/" + name;
+}
+
+bool test_map_registry() {
+	vector < vector <char> > grid = read_map("maps/m1.txt");
+	MapRegistry registry (temp_directory());
+	string path = registry.path_for(map_content_hash(grid));
+	remove(path.c_str());
+	CompiledMap compiled = compile_map(grid);
+	bool right = true;
+
+	// the first attach compiles, the second maps the same file
+	bool created_first, created_second;
+	CompiledMap first = registry.attach(grid, &created_first);
+	CompiledMap second = registry.attach(grid, &created_second);
+	if (!created_first || created_second || second.palette != compiled.palette
+		|| second.colors != compiled.colors)
+	{
+		right = false;
+	}
+	int area = grid.size() * grid[0].size();
+	for (int c = 0; c < (int) compiled.palette.size(); c++) {
+		if (memcmp(second.plane(c), compiled.plane(c), area * sizeof(float)) != 0) {
+			right = false;
+		}
+	}
+
+	// filters on an attached map step like filters on a private one
+	HistogramFilter shared (second, 3.0, 1.0, 0.1);
+	HistogramFilter plain (grid, 3.0, 1.0, 0.1);
+	shared.sense('g');
+	shared.move(1, 0);
+	plain.sense('g');
+	plain.move(1, 0);
+	if (!close_enough(plain.belief_grid(), shared.belief_grid())) {
+		right = false;
+	}
+
+	// a damaged file or another grid with the same name is rebuilt
+	FILE* file = fopen(path.c_str(), "r+b");
+	fseek(file, 0, SEEK_END);
+	fputc(0, file);
+	fclose(file);
+	bool created_again;
+	registry.attach(grid, &created_again);
+	vector < vector <char> > other = grid;
+	other[0][0] = 'g';
+	CompiledMap mismatch;
+	if (!created_again || map_compiled_file(path, other, mismatch)) {
+		right = false;
+	}
+	remove(path.c_str());
+
+	if (right) {
+		cout << "! - compiled maps are shared through the registry\n";
+	}
+	else {
+		cout << "X - compiled maps are not shared through the registry.\n";
+	}
+	return right;
+}
+
+// Writes a map file with one line per row.
+void write_map_file(string file_name, const vector < vector <char> >& grid) {
+	ofstream outfile (file_name);
+	for (size_t i = 0; i < grid.size(); i++) {
+		for (size_t j = 0; j < grid[i].size(); j++) {
+			outfile << grid[i][j] << ' ';
+		}
+		outfile << '\n';
+	}
+}
+
+bool test_map_cache() {
+	vector < vector <char> > grid = read_map("maps/m1.txt");
+	string source = temp_path("localizer-cache-test.txt");
+	string cache = compiled_file_for(source);
+	write_map_file(source, grid);
+	remove(cache.c_str());
+	bool right = cache == temp_path("localizer-cache-test.compiled");
+
+	// a cold start compiles and writes the cache, a warm start maps it
+	bool cold_hit, warm_hit;
+	load_compiled_map(source, &cold_hit);
+	CompiledMap warm = load_compiled_map(source, &warm_hit);
+	CompiledMap compiled = compile_map(grid);
+	if (cold_hit || !warm_hit || warm.palette != compiled.palette || warm.colors != compiled.colors
+		|| memcmp(warm.plane(1), compiled.plane(1), 9 * sizeof(float)) != 0)
+	{
+		right = false;
+	}
+
+	HistogramFilter filter (source, 3.0, 1.0, 0.1, true);
+	filter.sense('g');
+	vector < vector <float> > expected = sense('g', grid, initialize_beliefs(grid), 3.0, 1.0);
+	if (!close_enough(expected, filter.belief_grid())) {
+		right = false;
+	}
+
+	// editing the source invalidates the cache
+	grid.push_back(grid[0]);
+	write_map_file(source, grid);
+	bool edited_hit;
+	CompiledMap edited = load_compiled_map(source, &edited_hit);
+	if (edited_hit || edited.height != 4) {
+		right = false;
+	}
+	remove(cache.c_str());
+	remove(source.c_str());
+
+	if (right) {
+		cout << "! - compiled maps are cached on disk\n";
+	}
+	else {
+		cout << "X - compiled maps are not cached correctly.\n";
+	}
+	return right;
+}
+
+bool test_embedded_map() {
+	vector < vector <char> > grid = read_map("maps/m1.txt");
+	CompiledMap compiled = compile_map(grid);
+	CompiledMap embedded = attach_embedded_map(m1_embedded);
+
+	// the generated header must match the map file it came from
+	uint64_t hash = 0;
+	file_content_hash("maps/m1.txt", hash);
+	bool right = hash == m1_embedded.source_hash && embedded.palette == compiled.palette
+		&& embedded.colors == compiled.colors && embedded.plane(0) == m1_planes;
+	for (int c = 0; c < (int) compiled.palette.size(); c++) {
+		if (memcmp(embedded.plane(c), compiled.plane(c), 9 * sizeof(float)) != 0) {
+			right = false;
+		}
+	}
+
+	HistogramFilter filter (embedded, 3.0, 1.0, 0.1);
+	filter.sense('g');
+	filter.move(0, 1);
+	vector < vector <float> > expected = sense('g', grid, initialize_beliefs(grid), 3.0, 1.0);
+	expected = move(0, 1, expected, 0.1);
+	if (!close_enough(expected, filter.belief_grid())) {
+		right = false;
+	}
+
+	if (right) {
+		cout << "! - embedded maps match their map files\n";
+	}
+	else {
+		cout << "X - embedded maps do not match their map files (rerun embed_map).\n";
+	}
+	return right;
+}
+
+bool test_tuning() {
+	int height = 37;
+	int width = 53;
+	int count = height * width;
+	vector <float> cells (count), plane (count), serial (count), threaded (count);
+	int k;
+	for (k=0; k<count; k++) {
+		cells[k] = (float) (k % 7 + 1) / count;
+		plane[k] = k % 3 == 0 ? 1.0f : 0.0f;
+	}
+	TuningProfile saved = current_tuning_profile();
+	bool right = true;
+
+	// bands and chunks on several threads compute exactly the same cells
+	vector <float> sensed (count), sensed_threaded (count);
+	for (int streaming = 0; streaming < 2; streaming++) {
+		TuningProfile profile = saved;
+		profile.streaming_threshold_bytes = streaming ? 0 : (size_t) -1;
+		profile.threads = 1;
+		apply_tuning_profile(profile);
+		move_kernel(&cells[0], &serial[0], height, width, 2, -3, 0.2);
+		sense_kernel(&cells[0], &plane[0], &sensed[0], count, 3.0, 1.0);
+
+		profile.threads = 3;
+		profile.parallel_min_cells = 0;
+		apply_tuning_profile(profile);
+		move_kernel(&cells[0], &threaded[0], height, width, 2, -3, 0.2);
+		sense_kernel(&cells[0], &plane[0], &sensed_threaded[0], count, 3.0, 1.0);
+		if (serial != threaded || sensed != sensed_threaded) {
+			right = false;
+		}
+	}
+	apply_tuning_profile(saved);
+
+	// profiles round-trip, and one tuned for another SIMD width is ignored
+	TuningProfile written = saved;
+	written.threads = 6;
+	written.parallel_min_cells = 4096;
+	written.streaming_threshold_bytes = 123456789;
+	written.prefetch_rows = 4;
+	TuningProfile read;
+	string file_name = temp_path("localizer-test.tuning");
+	if (!write_tuning_profile(file_name, written) || !read_tuning_profile(file_name, read)
+		|| read.threads != 6 || read.parallel_min_cells != 4096
+		|| read.streaming_threshold_bytes != 123456789 || read.prefetch_rows != 4)
+	{
+		right = false;
+	}
+	written.simd_width = SIMD_WIDTH * 2;
+	write_tuning_profile(file_name, written);
+	if (read_tuning_profile(file_name, read)) {
+		right = false;
+	}
+	remove(file_name.c_str());
+
+	if (right) {
+		cout << "! - tuned kernels match the defaults\n";
+	}
+	else {
+		cout << "X - tuned kernels do not match the defaults.\n";
+	}
+	return right;
+}
+
+bool test_realtime() {
+	HistogramFilter filter ("maps/m1.txt", 3.0, 1.0, 0.1);
+	HistogramFilter plain ("maps/m1.txt", 3.0, 1.0, 0.1);
+	filter.set_summed_area(true);
+	plain.set_summed_area(true);
+	filter.sense('g');
+	plain.sense('g');
+
+	// the default config changes nothing and cannot fail
+	RealtimeStatus status = filter.enter_realtime(default_realtime_config());
+	bool right = status.pinned && status.fifo && status.locked;
+
+	// entering real-time mode (warm-up move included) leaves the beliefs alone
+	filter.move(1, 1);
+	plain.move(1, 1);
+	if (!close_enough(plain.belief_grid(), filter.belief_grid())) {
+		right = false;
+	}
+
+	// pinned workers compute the same cells
+	ParallelConfig saved = parallel_config;
+	vector <float> cells (64 * 64, 1.0f / 4096), serial (cells.size()), pinned (cells.size());
+	cells[100] = 0.5;
+	move_kernel(&cells[0], &serial[0], 64, 64, 3, 5, 0.3);
+	parallel_config.threads = 2;
+	parallel_config.min_cells = 0;
+	parallel_config.cores = vector <int> (1, 0);
+	move_kernel(&cells[0], &pinned[0], 64, 64, 3, 5, 0.3);
+	parallel_config = saved;
+	if (serial != pinned) {
+		right = false;
+	}
+
+	if (right) {
+		cout << "! - real-time mode keeps the filter's results\n";
+	}
+	else {
+		cout << "X - real-time mode changes the filter's results.\n";
+	}
+	return right;
+}
+
+bool test_replay() {
+	ostringstream log;
+	log << "# a replay log\n\n";
+	int e;
+	for (e=0; e<500; e++) {
+		if (e % 3 == 2) {
+			log << "M " << e % 2 << " " << (e / 3) % 3 - 1 << "\n";
+		}
+		else {
+			log << "S " << (e % 7 == 0 ? 'g' : 'r') << "\n";
+		}
+	}
+
+	HistogramFilter first ("maps/m1.txt", 3.0, 1.0, 0.1);
+	HistogramFilter second ("maps/m1.txt", 3.0, 1.0, 0.1);
+	istringstream sequential_log (log.str()), pipelined_log (log.str());
+	ostringstream sequential_out, pipelined_out;
+	ReplayReport sequential = replay_sequential(sequential_log, first, sequential_out);
+
+	// tiny batches and one slot per channel make every stage wait on the others
+	ReplayReport pipelined = replay_pipelined(pipelined_log, second, pipelined_out, 3, 1);
+
+	bool right = sequential.events == 500 && pipelined.events == 500
+		&& pipelined.stages.size() == 3 && pipelined.stages[0].items == 500
+		&& pipelined.stages[2].items == 500
+		&& sequential_out.str() == pipelined_out.str()
+		&& close_enough(first.belief_grid(), second.belief_grid());
+
+	if (right) {
+		cout << "! - pipelined replay matches sequential replay\n";
+	}
+	else {
+		cout << "X - pipelined replay does not match sequential replay.\n";
+	}
+	return right;
+}
+
+bool test_async_io() {
+	ostringstream log;
+	int e;
+	for (e=0; e<3000; e++) {
+		log << (e % 2 ? "M 1 0\n" : (e % 5 ? "S r\n" : "S g\n"));
+	}
+	string log_file = temp_path("localizer-test.log");
+	string checkpoint_file = temp_path("localizer-test.ckpt");
+	ofstream (log_file) << log.str();
+	bool right = true;
+
+	for (int uring = 0; uring < 2; uring++) {
+		// small chunks so that lines straddle chunk boundaries
+		HistogramFilter from_memory ("maps/m1.txt", 3.0, 1.0, 0.1);
+		HistogramFilter from_disk ("maps/m1.txt", 3.0, 1.0, 0.1);
+		istringstream memory_log (log.str());
+		PrefetchedLog prefetched (log_file, 4096, 3, uring == 1);
+		istream disk_log (&prefetched);
+		ostringstream memory_out, disk_out;
+		replay_sequential(memory_log, from_memory, memory_out);
+		replay_sequential(disk_log, from_disk, disk_out);
+		if (!prefetched.is_open() || memory_out.str() != disk_out.str()) {
+			right = false;
+		}
+
+		// the newest whole checkpoint wins; a damaged one falls back to the other slot
+		remove(checkpoint_file.c_str());
+		{
+			CheckpointWriter writer (checkpoint_file, 3, 3, true, uring == 1);
+			writer.save(from_memory.beliefs(), 10);
+			writer.flush();
+			from_memory.move(0, 1);
+			writer.save(from_memory.beliefs(), 11);
+			if (!writer.flush() || writer.saved != 2) {
+				right = false;
+			}
+		}
+		vector <float> cells;
+		int height = 0, width = 0;
+		uint64_t step = 0;
+		HistogramFilter restored ("maps/m1.txt", 3.0, 1.0, 0.1);
+		if (!read_checkpoint(checkpoint_file, cells, height, width, step) || step != 11
+			|| !restored.set_beliefs(&cells[0], height, width)
+			|| !close_enough(from_memory.belief_grid(), restored.belief_grid()))
+		{
+			right = false;
+		}
+
+		fstream damaged (checkpoint_file, ios::in | ios::out | ios::binary);
+		damaged.seekp(4096 + sizeof(CheckpointHeader));
+		damaged.put('x');
+		damaged.close();
+		if (!read_checkpoint(checkpoint_file, cells, height, width, step) || step != 10) {
+			right = false;
+		}
+
+		// A header claiming far more cells than the file holds is rejected before anything is allocated
+		int32_t huge = 0x7fffffff;
+		damaged.open(checkpoint_file, ios::in | ios::out | ios::binary);
+		damaged.seekp(offsetof(CheckpointHeader, height));
+		damaged.write((const char*) &huge, sizeof(huge));
+		damaged.seekp(offsetof(CheckpointHeader, width));
+		damaged.write((const char*) &huge, sizeof(huge));
+		damaged.close();
+		if (read_checkpoint(checkpoint_file, cells, height, width, step)) {
+			right = false;
+		}
+	}
+	remove(log_file.c_str());
+	remove(checkpoint_file.c_str());
+
+	if (right) {
+		cout << "! - asynchronous log reads and checkpoints worked correctly\n";
+	}
+	else {
+		cout << "X - asynchronous log reads or checkpoints did not work correctly.\n";
+	}
+	return right;
+}
+
+bool test_c_api() {
+	bool right = localizer_abi_version() == LOCALIZER_ABI_VERSION;
+
+	// the map as a C caller would hold it: padded rows of chars
+	vector < vector <char> > grid = read_map("maps/m1.txt");
+	int height = grid.size(), width = grid[0].size(), stride = width + 3;
+	vector <char> cells ((size_t) height * stride, '#');
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			cells[(size_t) i * stride + j] = grid[i][j];
+		}
+	}
+
+	// caller storage, aligned by hand inside an over-allocated buffer
+	size_t bytes = localizer_storage_bytes(height, width);
+	size_t alignment = localizer_storage_alignment();
+	vector <char> buffer (bytes + 64 + alignment);
+	char* storage = &buffer[0] + (alignment - (uintptr_t) &buffer[0] % alignment) % alignment;
+	if (bytes < 2 * (size_t) height * width * sizeof(float)) {
+		right = false;
+		storage = NULL;
+	}
+	if (storage != NULL) {
+		float* base = (float*) storage;
+		if (localizer_create(&cells[0], height, width, stride, 3.0, 1.0, 0.1, base + 1, bytes) != NULL
+			|| localizer_create(&cells[0], height, width, stride, 3.0, 1.0, 0.1, base, bytes - 1) != NULL
+			|| localizer_create(&cells[0], height, width, width - 1, 3.0, 1.0, 0.1, NULL, 0) != NULL)
+		{
+			right = false;
+		}
+
+		localizer_filter* filter = localizer_create(&cells[0], height, width, stride,
+			3.0, 1.0, 0.1, base, bytes);
+		HistogramFilter reference (grid, 3.0, 1.0, 0.1);
+		int moves[][2] = {{0, 1}, {1, 0}, {-1, 2}, {0, -3}};
+		const char* colors = "rgrg";
+		for (int n = 0; filter != NULL && n < 4; n++) {
+			localizer_step(filter, moves[n][0], moves[n][1], colors[n]);
+			reference.move(moves[n][0], moves[n][1]);
+			reference.sense(colors[n]);
+
+			// beliefs live in the caller's storage and match the C++ filter
+			const float* beliefs = localizer_beliefs(filter);
+			if (beliefs < base || beliefs >= base + bytes / sizeof(float)
+				|| !close_enough(unflatten(vector <float> (beliefs, beliefs + height * width), height, width),
+					reference.belief_grid()))
+			{
+				right = false;
+			}
+		}
+		if (filter == NULL || localizer_height(filter) != height || localizer_width(filter) != width
+			|| localizer_set_beliefs(filter, reference.beliefs()) != LOCALIZER_OK
+			|| localizer_sense(NULL, 'r') != LOCALIZER_EINVAL)
+		{
+			right = false;
+		}
+		localizer_destroy(filter);
+	}
+
+	// the library may also own the storage
+	localizer_filter* owned = localizer_create(&cells[0], height, width, stride, 3.0, 1.0, 0.1, NULL, 0);
+	if (owned == NULL || localizer_move(owned, 1, 1) != LOCALIZER_OK
+		|| fabs(grid_sum(localizer_beliefs(owned), height * width) - 1.0) > 1e-5)
+	{
+		right = false;
+	}
+	localizer_destroy(owned);
+
+	if (right) {
+		cout << "! - the C interface worked correctly\n";
+	}
+	else {
+		cout << "X - the C interface did not work correctly.\n";
+	}
+	return right;
+}
+
+bool test_service() {
+#ifndef LOCALIZER_HAS_EPOLL
+	cout << "- skipped the localization service test: no epoll on this platform\n";
+	return true;
+#else
+	string run = to_string(random_device()());
+	string socket_path = temp_path("localizer_test_" + run + ".sock");
+	LocalizationService service (3.0, 1.0, 0.1);
+	// an irregular map, so that the most likely cell is never a tie
+	vector < vector <char> > grid (6, vector <char> (7));
+	for (int i = 0; i < 6; i++) {
+		for (int j = 0; j < 7; j++) {
+			grid[i][j] = "rgb"[(i * i + 2 * j + i * j) % 3];
+		}
+	}
+	service.add_map("lab", grid);
+	bool right = service.listen(socket_path);
+
+	// two robots on the same map with different logs, pipelined before the service runs
+	const int robots = 2, events = 60;
+	ServiceConnection connections[robots];
+	string expected[robots];
+	for (int r = 0; right && r < robots; r++) {
+		ostringstream log;
+		for (int e = 0; e < events; e++) {
+			if ((e + r) % 3 == 2) {
+				log << "M " << (e + r) % 2 << " " << (e / 3 + r) % 3 - 1 << "\n";
+			}
+			else {
+				log << "S " << "rgbr"[(e * 3 + r) % 4] << "\n";
+			}
+		}
+		HistogramFilter filter (grid, 3.0, 1.0, 0.1);
+		istringstream replay_log (log.str());
+		ostringstream replay_out;
+		replay_sequential(replay_log, filter, replay_out);
+		expected[r] = replay_out.str();
+
+		istringstream lines (log.str());
+		string line;
+		right = connections[r].connect(socket_path) && connections[r].send("MAP lab");
+		while (right && getline(lines, line)) {
+			right = connections[r].send(line);
+		}
+		right = right && connections[r].send("B") && connections[r].send("X 1");
+	}
+
+	thread server ([&service]() { service.run(); });
+	for (int r = 0; right && r < robots; r++) {
+		string reply;
+		right = connections[r].receive(reply) && reply == "OK 6 7";
+
+		// same cells as the single filter, beliefs equal up to rounding
+		istringstream lines (expected[r]);
+		string line;
+		while (right && getline(lines, line)) {
+			long index, served_index;
+			int row, col, served_row, served_col;
+			float belief, served_belief;
+			istringstream (line) >> index >> row >> col >> belief;
+			right = connections[r].receive(reply);
+			istringstream (reply) >> served_index >> served_row >> served_col >> served_belief;
+			right = right && served_index == index && served_row == row && served_col == col
+				&& fabs(served_belief - belief) < 1e-4;
+		}
+
+		istringstream posterior;
+		int height = 0, width = 0;
+		float total = 0.0, value;
+		right = right && connections[r].receive(reply);
+		posterior.str(reply);
+		posterior >> height >> width;
+		while (posterior >> value) {
+			total += value;
+		}
+		right = right && height == 6 && width == 7 && fabs(total - 1.0) < 1e-4
+			&& connections[r].receive(reply) && reply.compare(0, 3, "ERR") == 0;
+	}
+
+	ServiceConnection stranger;
+	string reply;
+	right = right && stranger.connect(socket_path)
+		&& stranger.request("MAP nowhere", reply) && reply.compare(0, 3, "ERR") == 0;
+
+	service.stop();
+	server.join();
+
+	// both robots were advanced in the same sweeps
+	right = right && service.stats.clients == 3
+		&& service.stats.lanes_swept == robots * events
+		&& service.stats.sweeps < service.stats.lanes_swept;
+
+	// with p_miss 0, a robot that only moves keeps its beliefs while another one senses
+	string strict_path = temp_path("localizer_test_strict_" + run + ".sock");
+	LocalizationService strict (3.0, 0.0, 0.1);
+	strict.add_map("lab", grid);
+	right = right && strict.listen(strict_path);
+	thread strict_server ([&strict]() { strict.run(); });
+	ServiceConnection seer, walker;
+	right = right && walker.connect(strict_path) && walker.request("MAP lab", reply)
+		&& seer.connect(strict_path) && seer.request("MAP lab", reply)
+		&& seer.request("S r", reply) && walker.request("M 0 1", reply)
+		&& walker.request("B", reply);
+	istringstream walked (reply);
+	int walked_height = 0, walked_width = 0;
+	float walked_belief;
+	walked >> walked_height >> walked_width;
+	right = right && walked_height == 6 && walked_width == 7;
+	while (right && walked >> walked_belief) {
+		right = fabs(walked_belief - 1.0 / 42) < 1e-6;
+	}
+	strict.stop();
+	strict_server.join();
+
+	if (right) {
+		cout << "! - the localization service batched requests correctly\n";
+	}
+	else {
+		cout << "X - the localization service did not batch requests correctly.\n";
+	}
+	return right;
+#endif
+}
+
+// True when two compiled maps have the same color in every cell and the same hit planes.
+bool same_cells(const CompiledMap& a, const CompiledMap& b) {
+	size_t area = (size_t) a.height * a.width;
+	if (a.height != b.height || a.width != b.width) {
+		return false;
+	}
+	for (size_t cell = 0; cell < area; cell++) {
+		if (a.palette[a.colors[cell]] != b.palette[b.colors[cell]]) {
+			return false;
+		}
+	}
+	for (size_t c = 0; c < a.palette.size(); c++) {
+		int other = b.color_index(a.palette[c]);
+		for (size_t cell = 0; cell < area; cell++) {
+			float expected = other < 0 ? 0.0f : b.plane(other)[cell];
+			if (a.plane(c)[cell] != expected) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool test_map_edits() {
+	vector < vector <char> > grid (40, vector <char> (50));
+	for (int i = 0; i < 40; i++) {
+		for (int j = 0; j < 50; j++) {
+			grid[i][j] = "rgb"[(i * 7 + j * j) % 3];
+		}
+	}
+	CompiledMap edited = compile_map(grid);
+
+	// repaint to existing colors, to new ones, and one cell twice
+	vector <MapEdit> edits;
+	MapEdit repaints[] = {{0, 0, 'g'}, {39, 49, 'y'}, {10, 20, 'r'}, {10, 20, 'k'}, {5, 5, 'y'}, {7, 3, 'b'}};
+	for (size_t e = 0; e < sizeof(repaints) / sizeof(repaints[0]); e++) {
+		edits.push_back(repaints[e]);
+		grid[repaints[e].row][repaints[e].col] = repaints[e].color;
+	}
+	bool right = edited.apply_edits(edits) && same_cells(edited, compile_map(grid))
+		&& edited.palette.size() == 5;
+
+	// edits off the map are refused as a whole
+	MapEdit outside[] = {{1, 1, 'g'}, {40, 0, 'g'}};
+	CompiledMap before = edited;
+	right = right && !edited.apply_edits(vector <MapEdit> (outside, outside + 2))
+		&& edited.colors == before.colors && edited.planes == before.planes;
+
+	// a map over read-only planes is copied on its first edit; the green center stays in the binary
+	CompiledMap embedded = attach_embedded_map(m1_embedded);
+	vector < vector <char> > m1 = read_map("maps/m1.txt");
+	MapEdit center = {1, 1, 'r'};
+	m1[1][1] = 'r';
+	right = right && embedded.apply_edits(vector <MapEdit> (1, center))
+		&& same_cells(embedded, compile_map(m1)) && m1_planes[9 + 4] == 1.0f;
+
+	// the filter senses the repainted map and keeps its beliefs
+	HistogramFilter filter (compile_map(read_map("maps/m1.txt")), 3.0, 1.0, 0.1);
+	HistogramFilter reference (m1, 3.0, 1.0, 0.1);
+	filter.sense('g');
+	reference.set_beliefs(filter.beliefs(), 3, 3);
+	right = right && filter.edit_map(vector <MapEdit> (1, center));
+	filter.sense('r');
+	reference.sense('r');
+	right = right && close_enough(filter.belief_grid(), reference.belief_grid());
+
+	if (right) {
+		cout << "! - map edits matched a full recompile\n";
+	}
+	else {
+		cout << "X - map edits did not match a full recompile.\n";
+	}
+	return right;
+}
+
+bool test_memory_governor() {
+	vector < vector <char> > grid (30, vector <char> (40));
+	for (int i = 0; i < 30; i++) {
+		for (int j = 0; j < 40; j++) {
+			grid[i][j] = "rgb"[(i * 5 + j * j) % 3];
+		}
+	}
+	int area = 30 * 40;
+
+	// two filters know where they are, four do not
+	vector <HistogramFilter*> fleet;
+	MemoryGovernor governor (0);
+	vector <float> peaked (area, 0.0f);
+	peaked[77] = 0.9f;
+	peaked[78] = 0.1f;
+	for (int f = 0; f < 6; f++) {
+		fleet.push_back(new HistogramFilter(grid, 3.0, 1.0, 0.1));
+		if (f == 2 || f == 4) {
+			fleet[f]->set_beliefs(&peaked[0], 30, 40);
+		}
+		else {
+			fleet[f]->sense("rgb"[f % 3]);
+		}
+		governor.add(fleet[f], "robot" + to_string(f));
+	}
+	HistogramFilter reference (grid, 3.0, 1.0, 0.1);
+	reference.set_beliefs(fleet[1]->beliefs(), 30, 40);
+
+	// trackers cost nothing until hypotheses are asked for
+	FilterMemory before = governor.usage();
+	bool right = before.tables == 0 && before.beliefs == 6 * area * sizeof(float)
+		&& before.scratch == 6 * area * sizeof(float);
+
+	// scratch grids and the converged filters are enough
+	governor.budget_bytes = before.total() - before.scratch - area * sizeof(float);
+	vector <DegradedFilter> report = governor.enforce();
+	right = right && report.size() == 8 && governor.usage().total() <= governor.budget_bytes
+		&& report[6].action == PARKED_SPARSE && report[7].action == PARKED_SPARSE
+		&& report[6].name == "robot2" && report[7].name == "robot4"
+		&& fleet[0]->storage() == DENSE_BELIEFS;
+	for (size_t k = 0; right && k < 6; k++) {
+		right = report[k].action == RELEASED_SCRATCH && report[k].bytes_freed == area * sizeof(float);
+	}
+
+	// a tighter budget parks two more at 16 bits (sparse parking kept 16 bytes)
+	governor.budget_bytes -= 2 * area * sizeof(float) - 100;
+	report = governor.enforce();
+	right = right && report.size() == 2 && report[0].action == PARKED_COMPACT
+		&& report[1].action == PARKED_COMPACT && governor.usage().total() <= governor.budget_bytes
+		&& report[1].name == "robot1" && fleet[1]->storage() == COMPACT_BELIEFS
+		&& fleet[5]->storage() == DENSE_BELIEFS;
+
+	// a sparse filter keeps stepping sparsely and tracks a dense one up to the cutoff
+	HistogramFilter walker (grid, 3.0, 1.0, 0.1), dense (grid, 3.0, 1.0, 0.1);
+	walker.set_beliefs(&peaked[0], 30, 40);
+	dense.set_beliefs(&peaked[0], 30, 40);
+	walker.release_scratch();
+	right = right && walker.park_sparse(1e-6);
+	for (int step = 0; step < 6; step++) {
+		walker.move(1, step % 3 - 1);
+		dense.move(1, step % 3 - 1);
+		walker.sense("rgb"[step % 3]);
+		dense.sense("rgb"[step % 3]);
+	}
+	right = right && walker.storage() == SPARSE_BELIEFS
+		&& walker.memory_usage().total() < dense.memory_usage().total() - area * sizeof(float);
+	for (int k = 0; right && k < area; k++) {
+		right = fabs(walker.beliefs()[k] - dense.beliefs()[k]) < 1e-4;
+	}
+
+	// parked filters come back on use, sparse ones exactly and compact ones to 16 bits
+	right = right && fabs(fleet[2]->beliefs()[77] - 0.9f) < 1e-6 && fleet[2]->storage() == DENSE_BELIEFS;
+	fleet[1]->move(1, 1);
+	reference.move(1, 1);
+	for (int k = 0; right && k < area; k++) {
+		right = fabs(fleet[1]->beliefs()[k] - reference.beliefs()[k]) <= reference.beliefs()[k] / 128;
+	}
+
+	for (int f = 0; f < 6; f++) {
+		governor.remove(fleet[f]);
+		delete fleet[f];
+	}
+	right = right && governor.usage().total() == 0;
+
+	if (right) {
+		cout << "! - the memory governor kept the fleet within budget\n";
+	}
+	else {
+		cout << "X - the memory governor did not keep the fleet within budget.\n";
+	}
+	return right;
+}
+
+/**
+    Simulates a logged run: a robot that moves with the filter's
+    motion noise and senses its cell's color with probability hit.
+*/
+vector <ReplayEvent> simulated_run(const vector < vector <char> >& grid, float hit, float blurring,
+	int events, mt19937& rng)
+{
+	const char colors[] = "rgb";
+	int height = grid.size(), width = grid[0].size();
+	uniform_real_distribution<float> unit (0.0f, 1.0f);
+	int i = rng() % height, j = rng() % width;
+
+	vector <ReplayEvent> run;
+	for (int e = 0; e < events; e++) {
+		ReplayEvent event = {'S', 0, 0, 0};
+		if (e % 2 == 1) {
+			event.kind = 'M';
+			event.dy = (int) (rng() % 3) - 1;
+			event.dx = (int) (rng() % 3) - 1;
+
+			// noise offsets drawn with the blur window's weights
+			float u = unit(rng);
+			int ny = 0, nx = 0;
+			if (u >= 1.0f - blurring) {
+				int k = rng() % 12;
+				int offsets[][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}, {-1, -1}, {-1, 1}, {1, -1}, {1, 1}};
+				int pick = k < 8 ? k / 2 : 4 + (k - 8);
+				ny = offsets[pick][0];
+				nx = offsets[pick][1];
+			}
+			i = ((i + event.dy + ny) % height + height) % height;
+			j = ((j + event.dx + nx) % width + width) % width;
+		}
+		else if (unit(rng) < hit) {
+			event.color = grid[i][j];
+		}
+		else {
+			event.color = grid[i][j];
+			while (event.color == grid[i][j]) {
+				event.color = colors[rng() % 3];
+			}
+		}
+		run.push_back(event);
+	}
+	return run;
+}
+
+bool test_calibration() {
+	vector < vector <char> > grid (12, vector <char> (15));
+	for (int i = 0; i < 12; i++) {
+		for (int j = 0; j < 15; j++) {
+			grid[i][j] = "rgb"[(i * i + 3 * j + i * j / 2) % 3];
+		}
+	}
+	CompiledMap map = compile_map(grid);
+
+	mt19937 rng (7);
+	vector < vector <ReplayEvent> > runs;
+	for (int r = 0; r < 24; r++) {
+		runs.push_back(simulated_run(grid, 0.8, 0.2, 300, rng));
+	}
+
+	CalibrationResult serial = calibrate(map, runs, 0.5, 0.25, 0.5, 1);
+	CalibrationResult threaded = calibrate(map, runs, 0.5, 0.25, 0.5, 4);
+
+	// the true values were p_hit 0.8, p_miss 0.1 and blurring 0.2
+	bool right = fabs(serial.p_hit - 0.8) < 0.05 && fabs(serial.p_miss - 0.1) < 0.025
+		&& fabs(serial.blurring - 0.2) < 0.05 && serial.iterations > 1
+		&& fabs(threaded.p_hit - serial.p_hit) < 1e-4 && fabs(threaded.blurring - serial.blurring) < 1e-4;
+	for (size_t k = 1; right && k < serial.log_likelihoods.size(); k++) {
+		right = serial.log_likelihoods[k] >= serial.log_likelihoods[k - 1] - 1e-3;
+	}
+
+	// logs read back into the same events
+	ostringstream log;
+	log << "# run 0\n";
+	for (size_t e = 0; e < runs[0].size(); e++) {
+		if (runs[0][e].kind == 'S') {
+			log << "S " << runs[0][e].color << "\n";
+		}
+		else {
+			log << "M " << runs[0][e].dy << " " << runs[0][e].dx << "\n";
+		}
+	}
+	istringstream in (log.str());
+	vector <ReplayEvent> read = read_replay_log(in);
+	right = right && read.size() == runs[0].size() && read[1].dy == runs[0][1].dy
+		&& read[2].color == runs[0][2].color;
+
+	if (right) {
+		cout << "! - calibration recovered the sensor and motion parameters\n";
+	}
+	else {
+		cout << "X - calibration did not recover the sensor and motion parameters ("
+			<< serial.p_hit << ", " << serial.p_miss << ", " << serial.blurring << ").\n";
+	}
+	return right;
+}
+
+bool test_numeric_health() {
+	vector < vector <char> > grid (8, vector <char> (8, 'r'));
+	grid[3][4] = 'g';
+
+	// every miss costs a factor of 1000, so 13 senses push the red cells below FLT_MIN
+	HistogramFilter unchecked (grid, 1.0, 1e-3, 0.1);
+	HistogramFilter checked (grid, 1.0, 1e-3, 0.1);
+	checked.set_health_checks(true);
+	for (int s = 0; s < 14; s++) {
+		unchecked.sense('g');
+		checked.sense('g');
+	}
+	// with the summed-area table and hypotheses on, both are built from the floored cells
+	HistogramFilter tabled (grid, 1.0, 1e-3, 0.1);
+	tabled.set_health_checks(true, 1e-3f);
+	tabled.set_summed_area(true);
+	tabled.set_hypothesis_threshold(5e-4f);
+	for (int s = 0; s < 3; s++) {
+		tabled.sense('g');
+	}
+	double corner = 0.0, everything = 0.0;
+	for (int k = 0; k < 64; k++) {
+		everything += tabled.beliefs()[k];
+		corner += k / 8 < 2 && k % 8 < 2 ? tabled.beliefs()[k] : 0.0;
+	}
+	bool tables_right = tabled.health().floored == 3 * 63 && tabled.beliefs()[0] == 1e-3f
+		&& fabs(tabled.region_mass(0, 0, 2, 2) - corner) < 1e-6 && fabs(tabled.region_mass(0, 0, 8, 8) - everything) < 1e-6
+		&& tabled.hypotheses(4).size() == 1 && tabled.hypotheses(4)[0].cells == 64;
+
+	HealthCounts drifted = scan_health(unchecked.beliefs(), 64, DEFAULT_BELIEF_FLOOR);
+	HealthCounts floored = scan_health(checked.beliefs(), 64, DEFAULT_BELIEF_FLOOR);
+	const HealthMetrics& metrics = checked.health();
+	bool right = drifted.denormals + drifted.zeros == 63 && floored.denormals == 0 && floored.tiny == 0
+		&& floored.zeros == 0 && metrics.passes == 14 && metrics.floored >= 63
+		&& checked.beliefs()[3 * 8 + 4] > 0.99f && metrics.resets == 0 && tables_right;
+
+	// lost beliefs restart from uniform; one NaN spreads to every cell when normalizing
+	vector <float> broken (64, 0.0f);
+	checked.set_beliefs(&broken[0], 8, 8);
+	broken[5] = NAN;
+	checked.set_beliefs(&broken[0], 8, 8);
+	right = right && metrics.resets == 2 && metrics.total.nans == 64
+		&& checked.beliefs()[0] == 1.0f / 64 && checked.beliefs()[5] == 1.0f / 64;
+
+	ostringstream exported;
+	write_health_metrics(exported, metrics, "robot");
+	right = right && exported.str().find("localizer_belief_resets_total{filter=\"robot\"} 2\n") != string::npos;
+
+	// denormal results flush to zero inside the guard, on kernel workers too
+	if (flush_denormals_supported()) {
+		volatile float tiny = 1e-30f;
+		float results[4];
+		{
+			FlushDenormals flush;
+			WorkerPool pool (2);
+			pool.run(4, [&](int k) { results[k] = tiny * 1e-10f; });
+			right = right && tiny * 1e-10f == 0.0f;
+		}
+		for (int k = 0; right && k < 4; k++) {
+			right = results[k] == 0.0f;
+		}
+		right = right && tiny * 1e-10f != 0.0f;
+	}
+
+	if (right) {
+		cout << "! - numeric health checks worked correctly\n";
+	}
+	else {
+		cout << "X - numeric health checks did not work correctly.\n";
+	}
+	return right;
+}
+
+bool test_map_channels() {
+	int height = 6, width = 7;
+	vector < vector <char> > colors (height, vector <char> (width)), texture = colors, fiducials = colors;
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			colors[i][j] = "rgb"[(i * 5 + j * 3 + i * j) % 3];
+			texture[i][j] = "wct"[(i + 2 * j) % 3];
+			fiducials[i][j] = (i * width + j) % 11 == 4 ? 'F' : '.';
+		}
+	}
+
+	HistogramFilter filter (colors, 3.0, 1.0, 0.1), plain (colors, 3.0, 1.0, 0.1);
+	MapChannel floor, tags, ragged;
+	bool right = compile_channel(floor, "texture", texture, 0.9, 0.05)
+		&& compile_channel(tags, "fiducial", fiducials, 0.8, 0.01)
+		&& filter.add_channel(floor) == 1 && filter.add_channel(tags) == 2
+		&& filter.channel_index("fiducial") == 2 && filter.channel_index("wifi") == -1;
+
+	// a channel must cover the map exactly
+	vector < vector <char> > small (3, vector <char> (width, '.'));
+	right = right && compile_channel(ragged, "small", small, 0.9, 0.1) && filter.add_channel(ragged) == -1;
+	small[1].pop_back();
+	right = right && !compile_channel(ragged, "small", small, 0.9, 0.1);
+
+	// reading only the colors is the plain sense
+	vector <ChannelReading> readings (1);
+	readings[0].channel = 0;
+	readings[0].value = 'g';
+	right = right && filter.sense(readings);
+	plain.sense('g');
+	right = right && close_enough(plain.belief_grid(), filter.belief_grid());
+
+	// the fused sense multiplies in every channel's likelihood
+	vector <float> expected (filter.beliefs(), filter.beliefs() + height * width);
+	ChannelReading seen[3] = { { 0, 'r' }, { 1, 't' }, { 2, 'F' } };
+	readings.assign(seen, seen + 3);
+	right = right && filter.sense(readings);
+	float total = 0.0;
+	for (int k = 0; k < height * width; k++) {
+		int i = k / width, j = k % width;
+		expected[k] *= (colors[i][j] == 'r' ? 3.0f : 1.0f) * (texture[i][j] == 't' ? 0.9f : 0.05f)
+			* (fiducials[i][j] == 'F' ? 0.8f : 0.01f);
+		total += expected[k];
+	}
+	for (int k = 0; right && k < height * width; k++) {
+		right = fabs(filter.beliefs()[k] - expected[k] / total) < 1e-6;
+	}
+
+	// an unknown channel changes nothing
+	readings[1].channel = 3;
+	right = right && !filter.sense(readings);
+	for (int k = 0; right && k < height * width; k++) {
+		right = fabs(filter.beliefs()[k] - expected[k] / total) < 1e-6;
+	}
+
+	// edited cells get new joint codes, as if the map had been built that way
+	MapEdit edit = {2, 3, colors[2][3] == 'r' ? 'g' : 'r'};
+	colors[2][3] = edit.color;
+	HistogramFilter edited (colors, 3.0, 1.0, 0.1);
+	edited.add_channel(floor);
+	edited.add_channel(tags);
+	readings[1].channel = 1;
+	right = right && filter.edit_map(vector <MapEdit> (1, edit));
+	filter.set_beliefs(edited.beliefs(), height, width);
+	right = right && filter.sense(readings) && edited.sense(readings)
+		&& close_enough(edited.belief_grid(), filter.belief_grid());
+
+	// parallel chunks give the same cells
+	vector <float> cells (64 * 64), serial (cells.size()), chunked (cells.size()), weights (6);
+	vector <unsigned char> values (cells.size()), classes (cells.size());
+	for (size_t k = 0; k < cells.size(); k++) {
+		cells[k] = 1.0f + k % 13;
+		values[k] = k % 3;
+		classes[k] = 3 + k % 7 / 3;
+	}
+	for (int k = 0; k < 6; k++) {
+		weights[k] = 0.5f + k;
+	}
+	ChannelLikelihood lookups[2] = { { &values[0], &weights[0] }, { &classes[0], &weights[0] } };
+	fused_sense_kernel(&cells[0], lookups, 2, &serial[0], cells.size());
+	ParallelConfig saved = parallel_config;
+	parallel_config.threads = 2;
+	parallel_config.min_cells = 0;
+	fused_sense_kernel(&cells[0], lookups, 2, &chunked[0], cells.size());
+	parallel_config = saved;
+	right = right && serial == chunked && serial[5] == cells[5] * weights[2] * weights[4];
+
+	if (right) {
+		cout << "! - multi-channel sense worked correctly\n";
+	}
+	else {
+		cout << "X - multi-channel sense did not work correctly.\n";
+	}
+	return right;
+}
+
 // bool test_simulation() {
 // 	// todo 
 // }
\ No newline at end of file
@@ -22,6 +22,78 @@ bool test_sense();
 // Test for implementation of correct localizer functions
 bool test_localizer();
 
+// Test for flat SIMD kernels matching the reference functions
+bool test_kernels();
+
+// Test for tile-major grids matching the row-major kernels
+bool test_tiled();
+
+// Test for lockstep batches matching independent filters
+bool test_batched();
+
+// Test for every optimized variant agreeing with the reference on random cases
+bool test_differential();
+
+// Test for HistogramFilter and its summed-area region queries
+bool test_summed_area();
+
+// Test for clustering the posterior into hypotheses
+bool test_hypotheses();
+
+// Test for batched expected-information-gain evaluation
+bool test_active_localization();
+
+// Test for blur with per-cell motion noise classes
+bool test_motion_classes();
+
+// Test for RCU snapshots of the posterior read from other threads
+bool test_snapshots();
+
+// Test for swapping in maps compiled on a background thread
+bool test_map_reload();
+
+// Test for attaching compiled maps from a shared registry
+bool test_map_registry();
+
+// Test for the on-disk compiled map cache
+bool test_map_cache();
+
+// Test for maps compiled into the binary by embed_map
+bool test_embedded_map();
+
+// Test for threaded kernels and tuning profiles
+bool test_tuning();
+
+// Test for the real-time execution mode
+bool test_realtime();
+
+// Test for the coroutine replay pipeline
+bool test_replay();
+
+// Test for prefetched log reads and asynchronous checkpoints
+bool test_async_io();
+
+// Test for the C interface
+bool test_c_api();
+
+// Test for the batching localization service
+bool test_service();
+
+// Test for incremental map edits
+bool test_map_edits();
+
+// Test for the fleet memory governor
+bool test_memory_governor();
+
+// Test for EM calibration of the filter parameters
+bool test_calibration();
+
+// Test for numeric health checks and denormal flushing
+bool test_numeric_health();
+
+// Test for multi-channel maps and the fused multi-modal sense
+bool test_map_channels();
+
 // bool test_simulation();	// todo
 
 #endif /* TESTS_H */
\ No newline at end of file
@@ -0,0 +1,83 @@
+#ifndef TILED_GRID_H
+#define TILED_GRID_H
+
+#include <vector>
+
+// Default edge length of a square tile, in cells (64x64 floats = 16 KiB).
+const int DEFAULT_TILE_SIZE = 64;
+
+// A run of contiguous cells of one grid row inside one tile.
+struct GridSegment {
+	int row;
+	int col;
+	int length;
+	float* cells;
+};
+
+class TiledGrid;
+
+// Walks the segments of a TiledGrid in storage order.
+class SegmentIterator {
+public:
+	SegmentIterator(TiledGrid* grid, int tile_index, int local_row);
+	GridSegment operator*() const;
+	SegmentIterator& operator++();
+	bool operator!=(const SegmentIterator& other) const;
+
+private:
+	TiledGrid* grid;
+	int tile_index;
+	int local_row;
+};
+
+/**
+	A belief grid stored tile-major: the grid is cut into square
+	tiles of tile x tile cells, tiles are laid out one after the
+	other, and cells inside a tile are row-major. Edge tiles are
+	padded to a full tile; padding cells are zero and stay zero.
+	Iterating the grid yields GridSegments, so kernels never need
+	to know the layout.
+*/
+class TiledGrid {
+public:
+	int height, width, tile;
+	int tile_rows, tile_cols;
+	std::vector <float> cells;
+
+	TiledGrid();
+	TiledGrid(int height, int width, int tile = DEFAULT_TILE_SIZE);
+
+	float& at(int i, int j);
+	float at(int i, int j) const;
+
+	// Returns the cells of row i covered by tile column tile_col.
+	float* segment(int i, int tile_col);
+	const float* segment(int i, int tile_col) const;
+
+	// Returns how many columns tile column tile_col covers.
+	int segment_width(int tile_col) const;
+
+	SegmentIterator begin();
+	SegmentIterator end();
+};
+
+// Copies a flat row-major grid into tile-major storage.
+TiledGrid to_tiled(const float* cells, int height, int width, int tile = DEFAULT_TILE_SIZE);
+
+// Copies tile-major storage back into a flat row-major vector.
+std::vector <float> to_row_major(const TiledGrid& grid);
+
+/**
+    Sensing update on tile-major grids. hit_plane must be tiled with
+    the same tile size. Does not normalize.
+*/
+void sense_tiled(const TiledGrid& beliefs, const TiledGrid& hit_plane, TiledGrid& out,
+	float p_hit, float p_miss);
+
+// Blurs a tile-major grid into out. Does not normalize.
+void blur_tiled(const TiledGrid& in, TiledGrid& out, float blurring);
+
+// Normalizes a tile-major grid in place. Returns the total before normalizing.
+float normalize_tiled(TiledGrid& grid);
+
+#endif /* TILED_GRID_H */
@@ -0,0 +1,242 @@
+/**
+	tuning.cpp
+
+	Purpose: machine-specific kernel auto-tuning. autotune() times
+	the kernel variants the tree has (thread counts, streaming
+	stores, prefetch distance) on representative grids, and the
+	chosen settings are persisted in a small profile file that an
+	application applies at startup with load_default_tuning().
+*/
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include "tuning.h"
+#include "simd.h"
+#include "kernels.h"
+#include "streaming.h"
+#include "parallel.h"
+
+using namespace std;
+
+TuningProfile current_tuning_profile() {
+	TuningProfile profile;
+	profile.simd_width = SIMD_WIDTH;
+	profile.threads = parallel_config.threads;
+	profile.parallel_min_cells = parallel_config.min_cells;
+	profile.streaming_threshold_bytes = streaming_config.threshold_bytes;
+	profile.prefetch_rows = streaming_config.prefetch_rows;
+	return profile;
+}
+
+void apply_tuning_profile(const TuningProfile& profile) {
+	parallel_config.threads = profile.threads < 1 ? 1 : profile.threads;
+	parallel_config.min_cells = profile.parallel_min_cells;
+	streaming_config.threshold_bytes = profile.streaming_threshold_bytes;
+	streaming_config.prefetch_rows = profile.prefetch_rows;
+}
+
+bool read_tuning_profile(string file_name, TuningProfile& profile) {
+	ifstream infile(file_name);
+	if (!infile.is_open()) {
+		return false;
+	}
+
+	// keys missing from the file keep the settings in effect
+	TuningProfile read = current_tuning_profile();
+	read.simd_width = 0;
+	string line;
+	while (getline(infile, line)) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		istringstream fields(line);
+		string key;
+		fields >> key;
+		if (key == "simd_width") {
+			fields >> read.simd_width;
+		}
+		else if (key == "threads") {
+			fields >> read.threads;
+		}
+		else if (key == "parallel_min_cells") {
+			fields >> read.parallel_min_cells;
+		}
+		else if (key == "streaming_threshold_bytes") {
+			fields >> read.streaming_threshold_bytes;
+		}
+		else if (key == "prefetch_rows") {
+			fields >> read.prefetch_rows;
+		}
+	}
+
+	if (read.simd_width != SIMD_WIDTH) {
+		return false;
+	}
+	profile = read;
+	return true;
+}
+
+bool write_tuning_profile(string file_name, const TuningProfile& profile) {
+	ofstream outfile(file_name);
+	outfile << "# localizer tuning profile, written by benchmark tune\n"
+		<< "simd_width " << profile.simd_width << "\n"
+		<< "threads " << profile.threads << "\n"
+		<< "parallel_min_cells " << profile.parallel_min_cells << "\n"
+		<< "streaming_threshold_bytes " << profile.streaming_threshold_bytes << "\n"
+		<< "prefetch_rows " << profile.prefetch_rows << "\n";
+	outfile.close();
+	return !outfile.fail();
+}
+
+string default_tuning_file() {
+	const char* configured = getenv("LOCALIZER_TUNING");
+	if (configured != NULL && configured[0] != '\0') {
+		return configured;
+	}
+	return "localizer.tuning";
+}
+
+bool load_default_tuning() {
+	TuningProfile profile;
+	if (!read_tuning_profile(default_tuning_file(), profile)) {
+		return false;
+	}
+	apply_tuning_profile(profile);
+	return true;
+}
+
+// Returns the best of repeats wall times of fn in microseconds.
+template <typename Fn>
+double best_time_us(Fn fn, int repeats) {
+	double best = 0.0;
+	for (int r = 0; r < repeats; r++) {
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		fn();
+		chrono::duration<double, micro> elapsed = chrono::steady_clock::now() - start;
+		if (r == 0 || elapsed.count() < best) {
+			best = elapsed.count();
+		}
+	}
+	return best;
+}
+
+// One filter step's worth of work: sense, then move (shift + blur).
+double time_step(int size, vector <float>& cells, vector <float>& plane, vector <float>& out) {
+	int count = size * size;
+	int repeats = count >= (1 << 22) ? 3 : 10;
+	return best_time_us([&]() {
+		sense_kernel(&cells[0], &plane[0], &out[0], count, 0.9, 0.1);
+		move_kernel(&out[0], &cells[0], size, size, 1, 1, 0.12);
+	}, repeats);
+}
+
+/**
+    Picks the settings in three rounds: the thread count on the
+    largest grid, then the smallest grid that threads pay off on,
+    then whether and from what size streaming stores win, and their
+    prefetch distance.
+*/
+TuningProfile autotune(const vector <int>& sizes, ostream* log) {
+	TuningProfile saved = current_tuning_profile();
+	TuningProfile best = saved;
+	int largest = sizes.back();
+	vector <float> cells ((size_t) largest * largest), plane (cells.size()), out (cells.size());
+	for (size_t k = 0; k < cells.size(); k++) {
+		cells[k] = 1.0f / cells.size();
+		plane[k] = k % 3 == 0 ? 1.0f : 0.0f;
+	}
+
+	// threads, on the largest grid without streaming
+	TuningProfile trial = saved;
+	trial.parallel_min_cells = 0;
+	trial.streaming_threshold_bytes = (size_t) -1;
+	int hardware = max(1, (int) thread::hardware_concurrency());
+	vector <int> counts;
+	for (int threads = 1; threads < hardware; threads *= 2) {
+		counts.push_back(threads);
+	}
+	counts.push_back(hardware);
+
+	double best_us = 0.0;
+	for (size_t c = 0; c < counts.size(); c++) {
+		int threads = counts[c];
+		trial.threads = threads;
+		apply_tuning_profile(trial);
+		double us = time_step(largest, cells, plane, out);
+		if (log != NULL) {
+			*log << "threads " << threads << "\t" << largest << "x" << largest << "\t" << us << " us" << endl;
+		}
+		if (threads == 1 || us < best_us * 0.95) {
+			best_us = us;
+			best.threads = threads;
+		}
+	}
+
+	// the smallest grid where those threads beat one thread
+	best.parallel_min_cells = (size_t) -1;
+	for (size_t s = 0; s < sizes.size() && best.threads > 1; s++) {
+		trial.threads = 1;
+		apply_tuning_profile(trial);
+		double serial = time_step(sizes[s], cells, plane, out);
+		trial.threads = best.threads;
+		apply_tuning_profile(trial);
+		double parallel = time_step(sizes[s], cells, plane, out);
+		if (parallel < serial * 0.95) {
+			best.parallel_min_cells = (size_t) sizes[s] * sizes[s];
+			break;
+		}
+	}
+	if (best.parallel_min_cells == (size_t) -1) {
+		best.threads = 1;
+		best.parallel_min_cells = saved.parallel_min_cells;
+	}
+
+	// streaming: the threshold sits below the smallest grid from which it always wins
+	trial.threads = best.threads;
+	trial.parallel_min_cells = best.parallel_min_cells;
+	size_t threshold = (size_t) -1;
+	for (int s = sizes.size() - 1; s >= 0; s--) {
+		trial.streaming_threshold_bytes = (size_t) -1;
+		apply_tuning_profile(trial);
+		double cached = time_step(sizes[s], cells, plane, out);
+		trial.streaming_threshold_bytes = 0;
+		apply_tuning_profile(trial);
+		double streamed = time_step(sizes[s], cells, plane, out);
+		if (log != NULL) {
+			*log << "streaming\t" << sizes[s] << "x" << sizes[s] << "\t" << cached << " us cached\t"
+				<< streamed << " us streamed" << endl;
+		}
+		if (streamed >= cached * 0.97) {
+			break;
+		}
+		threshold = 2 * (size_t) sizes[s] * sizes[s] * sizeof(float) - 1;
+	}
+
+	// never won on the tested sizes: keep the cache-size default for larger grids
+	size_t largest_bytes = 2 * (size_t) largest * largest * sizeof(float);
+	best.streaming_threshold_bytes = threshold != (size_t) -1 ? threshold
+		: max(saved.streaming_threshold_bytes, largest_bytes);
+
+	if (threshold != (size_t) -1) {
+		trial.streaming_threshold_bytes = 0;
+		best_us = 0.0;
+		for (int prefetch = 0; prefetch <= 8; prefetch = prefetch == 0 ? 1 : prefetch * 2) {
+			trial.prefetch_rows = prefetch;
+			apply_tuning_profile(trial);
+			double us = time_step(largest, cells, plane, out);
+			if (prefetch == 0 || us < best_us) {
+				best_us = us;
+				best.prefetch_rows = prefetch;
+			}
+		}
+	}
+
+	apply_tuning_profile(saved);
+	return best;
+}
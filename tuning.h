@@ -0,0 +1,57 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <stddef.h>
+
+/**
+	The kernel settings picked for one machine and one build:
+	how many threads move, blur and sense use and from what grid
+	size on, and when and how move and blur stream. simd_width
+	records the build the profile was tuned with; it is fixed at
+	compile time, so a profile from another build is not used.
+*/
+struct TuningProfile {
+	int simd_width;
+	int threads;
+	size_t parallel_min_cells;
+	size_t streaming_threshold_bytes;
+	int prefetch_rows;
+};
+
+// The settings currently in effect (parallel_config and streaming_config).
+TuningProfile current_tuning_profile();
+
+// Makes a profile the settings in effect.
+void apply_tuning_profile(const TuningProfile& profile);
+
+/**
+    Reads a profile, one "key value" per line. Returns false when the
+    file is missing or was tuned for another SIMD width.
+*/
+bool read_tuning_profile(std::string file_name, TuningProfile& profile);
+
+// Writes a profile. Returns false when the file could not be written.
+bool write_tuning_profile(std::string file_name, const TuningProfile& profile);
+
+// $LOCALIZER_TUNING, else localizer.tuning in the working directory.
+std::string default_tuning_file();
+
+/**
+    Applies the default tuning file, if there is a usable one, and
+    returns whether it did. Nothing calls it implicitly: an
+    application that wants the machine's profile calls it once at
+    startup, before it creates filters or changes parallel_config.
+*/
+bool load_default_tuning();
+
+/**
+    Times move and sense on square grids of the given sizes on this
+    machine and returns the best settings. Progress is written to log
+    when it is not NULL. The settings in effect are restored.
+*/
+TuningProfile autotune(const std::vector <int>& sizes, std::ostream* log = NULL);
+
+#endif /* TUNING_H */